@@ -0,0 +1,287 @@
+/*
+ * archive
+ * An append-only, memory-mapped file of closed auctions, stored a column at
+ * 	a time in chunks so that history queries read only what they need.
+ * Author: Hamza
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+// Where each column of a chunk starts.
+typedef struct {
+    double* openTimes;
+    double* closeTimes;
+    int* reserves;
+    int* finalBids;
+    int* sellers;
+    int* winners;
+    unsigned int* nameEnds;
+    char* names;
+} ChunkColumns;
+
+/* chunk_size()
+ * ------------
+ * Works out the size of a chunk, padding included.
+ *
+ * count: the number of records in the chunk.
+ * namesLength: the length of their names, terminators included.
+ *
+ * Returns: the size in bytes.
+ */
+static size_t chunk_size(unsigned int count, unsigned long namesLength) {
+    size_t size = sizeof(ArchiveChunk) + count * (2 * sizeof(double)
+	    + 4 * sizeof(int) + sizeof(unsigned int)) + namesLength;
+    return (size + 7) & ~(size_t) 7;
+}
+
+/* chunk_columns()
+ * ---------------
+ * Finds the columns of a chunk.
+ *
+ * chunk: the chunk.
+ * columns: set to where each column starts.
+ *
+ * Returns: void
+ */
+static void chunk_columns(ArchiveChunk* chunk, ChunkColumns* columns) {
+    unsigned int count = chunk->count;
+    columns->openTimes = (double*) (chunk + 1);
+    columns->closeTimes = columns->openTimes + count;
+    columns->reserves = (int*) (columns->closeTimes + count);
+    columns->finalBids = columns->reserves + count;
+    columns->sellers = columns->finalBids + count;
+    columns->winners = columns->sellers + count;
+    columns->nameEnds = (unsigned int*) (columns->winners + count);
+    columns->names = (char*) (columns->nameEnds + count);
+}
+
+/* lock_archive()
+ * --------------
+ * Waits for one of an archive's locks, even if a signal interrupts.
+ *
+ * lock: the lock.
+ *
+ * Returns: void
+ */
+static void lock_archive(sem_t* lock) {
+    while (sem_wait(lock) == -1 && errno == EINTR) {
+    }
+}
+
+/* archive_open()
+ * --------------
+ * Opens an archive to append to, creating it if need be. A chunk left
+ * 	half written by a crash is cut off.
+ *
+ * path: the archive file.
+ *
+ * Returns: the archive, or NULL if the file cannot be opened, mapped, or is
+ * 	not an archive.
+ */
+Archive* archive_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	if (fd >= 0) {
+	    close(fd);
+	}
+	return NULL;
+    }
+    unsigned long size = info.st_size;
+    if (size == 0) {
+	if (pwrite(fd, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH, 0)
+		!= ARCHIVE_MAGIC_LENGTH) {
+	    close(fd);
+	    return NULL;
+	}
+	size = ARCHIVE_MAGIC_LENGTH;
+    }
+
+    // Pages past the end of the file become readable as it grows.
+    char* map = mmap(NULL, ARCHIVE_MAX_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED || size < ARCHIVE_MAGIC_LENGTH
+	    || memcmp(map, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH) != 0) {
+	if (map != MAP_FAILED) {
+	    munmap(map, ARCHIVE_MAX_SIZE);
+	}
+	close(fd);
+	return NULL;
+    }
+
+    Archive* archive = calloc(1, sizeof(Archive));
+    archive->fd = fd;
+    archive->path = path;
+    archive->map = map;
+    archive->committed = ARCHIVE_MAGIC_LENGTH;
+    sem_init(&archive->lock, 0, 1);
+    sem_init(&archive->writeLock, 0, 1);
+    while (archive->committed + sizeof(ArchiveChunk) <= size) {
+	ArchiveChunk* chunk = (ArchiveChunk*) (map + archive->committed);
+	if (chunk->magic != ARCHIVE_CHUNK_MAGIC || chunk->count > size
+		|| chunk->namesLength > size || archive->committed
+		+ chunk_size(chunk->count, chunk->namesLength) > size) {
+	    break;
+	}
+	archive->committed += chunk_size(chunk->count, chunk->namesLength);
+	archive->numOfRecords += chunk->count;
+    }
+    // Later chunks are written over a torn one even if it cannot be cut off.
+    if (archive->committed < size) {
+	ftruncate(fd, archive->committed);
+    }
+    return archive;
+}
+
+/* archive_append()
+ * ----------------
+ * Queues a closed auction to be written with the next chunk.
+ *
+ * archive: the archive.
+ * record: the auction, whose name is copied.
+ *
+ * Returns: void
+ */
+void archive_append(Archive* archive, const ArchiveRecord* record) {
+    lock_archive(&archive->lock);
+    if (archive->numOfPending == archive->pendingCapacity) {
+	archive->pendingCapacity = archive->pendingCapacity
+		? archive->pendingCapacity * 2 : 64;
+	archive->pending = realloc(archive->pending,
+		sizeof(ArchiveRecord) * archive->pendingCapacity);
+    }
+    ArchiveRecord* copy = &archive->pending[archive->numOfPending++];
+    *copy = *record;
+    copy->item = strdup(record->item);
+    sem_post(&archive->lock);
+}
+
+/* archive_flush()
+ * ---------------
+ * Writes everything queued as one chunk at the end of the archive, then
+ * 	makes it visible to queries.
+ *
+ * archive: the archive.
+ *
+ * Returns: true if there was nothing to write or it was written, false if
+ * 	it could not be, in which case those records are lost.
+ */
+bool archive_flush(Archive* archive) {
+    lock_archive(&archive->writeLock);
+    lock_archive(&archive->lock);
+    ArchiveRecord* records = archive->pending;
+    unsigned int count = archive->numOfPending;
+    archive->pending = NULL;
+    archive->numOfPending = 0;
+    archive->pendingCapacity = 0;
+    sem_post(&archive->lock);
+    if (count == 0) {
+	sem_post(&archive->writeLock);
+	return true;
+    }
+
+    unsigned long namesLength = 0;
+    for (int i = 0; i < count; i++) {
+	namesLength += strlen(records[i].item) + 1;
+    }
+    size_t size = chunk_size(count, namesLength);
+    ArchiveChunk* chunk = calloc(1, size);
+    chunk->magic = ARCHIVE_CHUNK_MAGIC;
+    chunk->count = count;
+    chunk->namesLength = namesLength;
+    chunk->minClose = records[0].closeTime;
+    chunk->maxClose = records[0].closeTime;
+    ChunkColumns columns;
+    chunk_columns(chunk, &columns);
+    char* name = columns.names;
+    for (int i = 0; i < count; i++) {
+	ArchiveRecord* record = &records[i];
+	columns.openTimes[i] = record->openTime;
+	columns.closeTimes[i] = record->closeTime;
+	columns.reserves[i] = record->reserve;
+	columns.finalBids[i] = record->finalBid;
+	columns.sellers[i] = record->seller;
+	columns.winners[i] = record->winner;
+	name = stpcpy(name, record->item) + 1;
+	columns.nameEnds[i] = name - columns.names;
+	if (record->closeTime < chunk->minClose) {
+	    chunk->minClose = record->closeTime;
+	}
+	if (record->closeTime > chunk->maxClose) {
+	    chunk->maxClose = record->closeTime;
+	}
+	free(record->item);
+    }
+    free(records);
+
+    size_t written = 0;
+    while (archive->committed + size <= ARCHIVE_MAX_SIZE && written < size) {
+	ssize_t bytes = pwrite(archive->fd, (char*) chunk + written,
+		size - written, archive->committed + written);
+	if (bytes < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (bytes <= 0) {
+	    break;
+	}
+	written += bytes;
+    }
+    free(chunk);
+    if (written == size) {
+	archive->numOfRecords += count;
+	__atomic_store_n(&archive->committed, archive->committed + size,
+		__ATOMIC_RELEASE);
+    }
+    sem_post(&archive->writeLock);
+    return written == size;
+}
+
+/* archive_query()
+ * ---------------
+ * Writes every archived auction whose name starts with a prefix and which
+ * 	closed at or after a time, oldest first, as "name reserve finalBid
+ * 	seller winner openTime closeTime|". Only the name and close time
+ * 	columns are read for auctions which do not match. Takes no lock.
+ *
+ * archive: the archive.
+ * prefix: the start of the names wanted, or "" for all.
+ * since: the earliest close time wanted, in milliseconds of the wall clock.
+ * output: the stream to write to.
+ *
+ * Returns: void
+ */
+void archive_query(Archive* archive, const char* prefix, double since,
+	FILE* output) {
+    unsigned long committed = __atomic_load_n(&archive->committed,
+	    __ATOMIC_ACQUIRE);
+    size_t prefixLength = strlen(prefix);
+    unsigned long offset = ARCHIVE_MAGIC_LENGTH;
+    while (offset < committed) {
+	ArchiveChunk* chunk = (ArchiveChunk*) (archive->map + offset);
+	offset += chunk_size(chunk->count, chunk->namesLength);
+	if (chunk->maxClose < since) {
+	    continue;
+	}
+	ChunkColumns columns;
+	chunk_columns(chunk, &columns);
+	const char* name = columns.names;
+	for (int i = 0; i < chunk->count; i++) {
+	    if (columns.closeTimes[i] >= since
+		    && strncmp(name, prefix, prefixLength) == 0) {
+		fprintf(output, "%s %d %d %d %d %.0f %.0f|", name,
+			columns.reserves[i], columns.finalBids[i],
+			columns.sellers[i], columns.winners[i],
+			columns.openTimes[i], columns.closeTimes[i]);
+	    }
+	    name = columns.names + columns.nameEnds[i];
+	}
+    }
+}
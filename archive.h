@@ -0,0 +1,69 @@
+/*
+ * archive
+ * An append-only, memory-mapped file of closed auctions, stored a column at
+ * 	a time in chunks so that history queries read only what they need.
+ * Author: Hamza
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <semaphore.h>
+
+// The first bytes of an archive file, and of every chunk in it.
+#define ARCHIVE_MAGIC "AUCTARC1"
+#define ARCHIVE_MAGIC_LENGTH 8
+#define ARCHIVE_CHUNK_MAGIC 0x4b4e4843u
+
+// Address space the file is mapped into. The archive stops growing here.
+#define ARCHIVE_MAX_SIZE (1UL << 36)
+
+// A closed auction. Clients are numbered as in captures, -1 for none, and
+// times are milliseconds of the wall clock.
+typedef struct {
+    char* item;
+    int reserve;
+    int finalBid;
+    int seller;
+    int winner;
+    double openTime;
+    double closeTime;
+} ArchiveRecord;
+
+// Each chunk is this header, then its records a column at a time: open
+// times, close times, reserves, final bids, sellers, winners, and the end
+// of each name in the names which follow, terminated. Chunks are padded to
+// 8 bytes. The range of close times lets queries skip whole chunks.
+typedef struct {
+    unsigned int magic;
+    unsigned int count;
+    unsigned long namesLength;
+    double minClose;
+    double maxClose;
+} ArchiveChunk;
+
+// An open archive. Records closed since the last write wait in pending,
+// under lock. The file is mapped once at its largest size, so readers need
+// no lock: everything up to committed has been written and never changes.
+typedef struct {
+    int fd;
+    const char* path;
+    char* map;
+    unsigned long committed;
+    sem_t lock;
+    sem_t writeLock;
+    ArchiveRecord* pending;
+    int numOfPending;
+    int pendingCapacity;
+    unsigned long numOfRecords;
+} Archive;
+
+Archive* archive_open(const char* path);
+void archive_append(Archive* archive, const ArchiveRecord* record);
+bool archive_flush(Archive* archive);
+void archive_query(Archive* archive, const char* prefix, double since,
+	FILE* output);
+
+#endif
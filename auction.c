@@ -0,0 +1,2166 @@
+/*
+ * auction
+ * The auction itself: items, bids, expiry and the command set, kept apart
+ * 	from sockets and threads so it can be driven directly.
+ * Author: Hamza
+ */
+
+#include <csse2310a4.h>
+#include <csse2310a3.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <ctype.h>
+#include "auction.h"
+#include "trace.h"
+#include "transport.h"
+#include "placement.h"
+
+static void expiry_insert(ProgramParameters* parameters, int itemIndex);
+static void expiry_remove(ProgramParameters* parameters, int itemIndex);
+static void release_item(ProgramParameters* parameters, int itemIndex);
+static void compact_items(ProgramParameters* parameters);
+static void wake_timer(ProgramParameters* parameters, double expiryTime);
+
+/* init_lock()
+ * -----------
+ * Initialises the semaphore lock.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void init_lock(sem_t* lock) {
+    sem_init(lock, 0, 1);
+}
+
+/* take_lock()
+ * -----------
+ * Locks other threads from accessing shared data struct.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void take_lock(sem_t* lock) {
+    // A signal handler running in this thread must not let it in unlocked.
+    while (sem_wait(lock) == -1 && errno == EINTR) {
+    }
+}
+
+/* release_lock()
+ * -----------
+ * Allows other threads to access shared data struct.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void release_lock(sem_t* lock) {
+    sem_post(lock);
+}
+
+/* take_traced_lock()
+ * ------------------
+ * Takes the auction lock, recording in the flight recorder how long it was
+ * 	waited for. Only this lock is traced, so that the trace's held spans
+ * 	are never closed early by a lock taken inside it.
+ *
+ * lock: a pointer to the auction lock.
+ *
+ * Returns: void
+ */
+void take_traced_lock(sem_t* lock) {
+    unsigned long start = trace_now();
+    take_lock(lock);
+    unsigned long wait = trace_now() - start;
+    trace_event(TRACE_LOCK_ACQUIRED, wait > INT_MAX ? INT_MAX : wait);
+}
+
+/* release_traced_lock()
+ * ---------------------
+ * Releases the auction lock taken with take_traced_lock().
+ *
+ * lock: a pointer to the auction lock.
+ *
+ * Returns: void
+ */
+void release_traced_lock(sem_t* lock) {
+    trace_event(TRACE_LOCK_RELEASED, 0);
+    release_lock(lock);
+}
+
+/* clock_ms()
+ * ----------
+ * Gets the current time of the auction clock. All auction times are taken
+ * 	from here so that a virtual clock can stand in for the real one.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: the time in milliseconds.
+ */
+double clock_ms(ProgramParameters* parameters) {
+    if (parameters->virtualClock) {
+	return parameters->virtualTime;
+    }
+    return get_time_ms();
+}
+
+/* expire_items()
+ * --------------
+ * Clears the batch items which are due, then closes every auction whose
+ * 	expiry time has passed, soonest first, and sends corresponding
+ * 	message to clients if necessary. The items closing are taken from the
+ * 	top of the expiry heap, and the rest are moved up in one pass at the
+ * 	end, however many closed. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: void
+ */
+void expire_items(ProgramParameters* parameters) {
+    clear_batches(parameters, false);
+    double now = clock_ms(parameters);
+    int numOfClosed = 0;
+    while (parameters->numOfExpiries > 0
+	    && now >= parameters->expiries[0].expiryTime) {
+	int i = parameters->expiries[0].item;
+	// Bids waiting to be cleared are counted before it closes, and
+	// may extend it.
+	if (parameters->items[i].batch) {
+	    clear_batch(parameters, i);
+	    if (now < parameters->items[i].expiryTime) {
+		continue;
+	    }
+	}
+	ItemList item = parameters->items[i];	
+	CloseTiming* timing = &parameters->closeTiming;
+	double late = now - item.expiryTime;
+	timing->numOfCloses++;
+	timing->totalLateMs += late;
+	if (late > timing->maxLateMs) {
+	    timing->maxLateMs = late;
+	}
+
+	// Send sold or unsold message to seller.
+	FILE* sellerOutput = item.seller.output;
+	if (item.highestBidder == false) {
+	    if (item.sellerActive) {
+		fprintf(sellerOutput, ":unsold %s\n", item.item);
+		fflush(sellerOutput);
+		trace_event(TRACE_NOTIFY_FLUSHED, item.seller.session);
+	    }
+	} else {
+	    if (item.sellerActive) {
+		fprintf(sellerOutput, ":sold %s %d\n", item.item,
+			item.highestBid);
+		fflush(sellerOutput);
+		trace_event(TRACE_NOTIFY_FLUSHED, item.seller.session);
+	    }
+		    
+	    // Send won message to highest bidder.
+	    Client highestBidder = item.topBidder;
+	    if (item.bidderActive) {
+		FILE* bidderOutput = highestBidder.output;
+		fprintf(bidderOutput, ":won %s %d\n", item.item,
+			item.highestBid);
+		fflush(bidderOutput);
+		trace_event(TRACE_NOTIFY_FLUSHED, highestBidder.session);
+	    }
+	}
+	// Remove item, leaving its place to be compacted after the loop.
+	trace_event(TRACE_ITEM_EXPIRED, item.highestBid);
+	publish_event(parameters, CLOSE_EVENT, "%s", item.item);
+	archive_closed(parameters, i);
+	release_item(parameters, i);
+	numOfClosed++;
+    }
+    if (numOfClosed) {
+	compact_items(parameters);
+    }
+}
+
+/* advance_clock()
+ * ---------------
+ * Moves the virtual clock forward and closes any auctions that expire as a
+ * 	result, then replies with the new time.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void advance_clock(char** splitLine, ProgramParameters* parameters,
+	FILE* output) {
+    char* remainderText;
+    double milliseconds = strtod(splitLine[1], &remainderText);
+    if (!parameters->virtualClock || strlen(remainderText) != 0
+	    || milliseconds < 0) {
+	fprintf(output, ":invalid\n");
+	return;
+    }
+    parameters->virtualTime += milliseconds;
+    expire_items(parameters);
+    fprintf(output, ":advanced %.0f\n", parameters->virtualTime);
+}
+
+/* remove_item()
+ * -------------
+ * Removes an item and all of its corresponding data from items data struct,
+ * 	keeping the remaining items in the order they were listed.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item to remove in the item data struct.
+ *
+ * Returns: void
+ */
+void remove_item(ProgramParameters* parameters, int itemIndex) {
+    ItemList* items = parameters->items;
+    release_item(parameters, itemIndex);
+
+    // Items after it move down one place. Their slots are found while the
+    // index still matches the array.
+    for (int i = itemIndex + 1; i < parameters->numOfItems; i++) {
+	index_slot(parameters, items[i].item)->item = i - 1;
+	parameters->expiries[items[i].expirySlot].item = i - 1;
+    }
+
+    // Remove item from item data struct.
+    memmove(&items[itemIndex], &items[itemIndex + 1],
+	    sizeof(ItemList) * (parameters->numOfItems - itemIndex - 1));
+    parameters->numOfItems--;
+}
+
+/* release_item()
+ * --------------
+ * Takes an item out of the name index, the expiry heap and its batch, and
+ * 	credits its seller, leaving its place in the items data struct to be
+ * 	removed by the caller. Its expiry slot is set to -1 to mark it.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ *
+ * Returns: void
+ */
+static void release_item(ProgramParameters* parameters, int itemIndex) {
+    ItemList* item = &parameters->items[itemIndex];
+    index_remove(parameters, item->item);
+    expiry_remove(parameters, itemIndex);
+    item->expirySlot = -1;
+    if (item->batch) {
+	close_batch(parameters, itemIndex);
+    }
+
+    // A seller which has left no longer has a connection to credit. The
+    // name is kept a while longer for delta lists.
+    if (item->sellerActive) {
+	charge_connection(item->seller.charged,
+		-(long) (ITEM_MEMORY + strlen(item->item) + 1));
+    }
+    // The items after it are about to move, so their view chunks must be
+    // copied again.
+    if (itemIndex < parameters->viewMovedFrom) {
+	parameters->viewMovedFrom = itemIndex;
+    }
+    items_changed(parameters);
+    log_closed(parameters, item->item);
+}
+
+/* compact_items()
+ * ---------------
+ * Removes every item released by release_item() from the items data struct
+ * 	in one pass, keeping the rest in the order they were listed.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: void
+ */
+static void compact_items(ProgramParameters* parameters) {
+    ItemList* items = parameters->items;
+    int numOfKept = 0;
+    for (int i = 0; i < parameters->numOfItems; i++) {
+	if (items[i].expirySlot == -1) {
+	    continue;
+	}
+	if (i != numOfKept) {
+	    index_slot(parameters, items[i].item)->item = numOfKept;
+	    parameters->expiries[items[i].expirySlot].item = numOfKept;
+	    items[numOfKept] = items[i];
+	}
+	numOfKept++;
+    }
+    parameters->numOfItems = numOfKept;
+}
+
+/* check_input()
+ * -------------
+ * Checks the input from client, validates it, and executes it.
+ *
+ * length: the number of words in the input command from client.
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * output: the output file descriptor of the client.
+ * clientIndex: index of client in the array of client struct.
+ * 
+ * Returns: void
+ */
+void check_input(int length, char** splitLine, ProgramParameters* parameters,
+	FILE* output, int clientIndex) {
+    trace_event(TRACE_COMMAND_START, clientIndex);
+    if (strcmp(splitLine[0], "sell") == 0) {
+	// An optional clearing interval sells the item by batches of bids,
+	// and may be followed by a soft close window and extension.
+	if (length != 4 && length != 5 && length != 7) {
+	    fprintf(output, ":invalid\n");
+	} else if (parameters->role == REPLICA) {
+	    fprintf(output, ":rejected\n");
+	} else {
+	    // Validate item to sell
+	    check_sell(splitLine, parameters,
+		    parameters->clients[clientIndex]);
+	}
+    } else if (strcmp(splitLine[0], "sellbatch") == 0) {
+	if (length < 4 || (length - 1) % 3 != 0) {
+	    fprintf(output, ":invalid\n");
+	} else if (parameters->role == REPLICA) {
+	    fprintf(output, ":rejected\n");
+	} else {
+	    // Every listing goes in under the one lock already held.
+	    sell_batch(length, splitLine, parameters,
+		    parameters->clients[clientIndex]);
+	}
+    } else if (strcmp(splitLine[0], "bid") == 0) {
+	if (length != 3) {
+	    fprintf(output, ":invalid\n");
+	} else if (parameters->role == REPLICA) {
+	    fprintf(output, ":rejected\n");
+	} else {
+	    // Validate item to bid
+	    place_bid(splitLine, parameters,
+		    parameters->clients[clientIndex]);
+	}
+    } else if (strcmp(splitLine[0], "list") == 0) {
+	if (length != 1) {
+	    fprintf(output, ":invalid\n");
+	} else {
+	    // List all items
+	    list_all_items(parameters, output);
+	}
+    } else if (strcmp(splitLine[0], "advance") == 0) {
+	if (length != 2) {
+	    fprintf(output, ":invalid\n");
+	} else {
+	    advance_clock(splitLine, parameters, output);
+	}
+    } else if (strcmp(splitLine[0], "lag") == 0) {
+	if (length != 1) {
+	    fprintf(output, ":invalid\n");
+	} else {
+	    report_lag(parameters, output);
+	}
+    } else if (strcmp(splitLine[0], "delta") == 0) {
+	// The lock is already held.
+	list_delta(parameters, -1, length, splitLine, output);
+    } else if (strcmp(splitLine[0], "history") == 0) {
+	report_history(parameters, length, splitLine, output);
+    } else if (strcmp(splitLine[0], "stats") == 0) {
+	if (length != 1) {
+	    fprintf(output, ":invalid\n");
+	} else {
+	    report_stats(parameters, output);
+	}
+    } else if (strcmp(splitLine[0], "trace") == 0) {
+	if (length != 1) {
+	    fprintf(output, ":invalid\n");
+	} else {
+	    // The dump is written by the timer thread, outside the lock.
+	    trace_request_dump();
+	    fprintf(output, ":trace %s\n", trace_path());
+	}
+    } else {
+	fprintf(output, ":invalid\n");
+    }
+
+    fflush(output);
+    trace_event(TRACE_COMMAND_DONE, clientIndex);
+}
+
+/* check_sell()
+ * ------------
+ * Checks if sell command is valid and places item for sale in corresponding
+ * 	struct. A clearing interval after the duration sells the item by
+ * 	clearing its bids every interval milliseconds instead of one by one.
+ * 	It may be followed by a soft close window and extension, in
+ * 	milliseconds, in which case an interval of 0 sells the item bid by bid.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' ',
+ * 	and terminated by NULL.
+ * parameters: a data struct containing all the data for the program.
+ * client: a struct containing the client tid and output file descriptor.
+ *
+ * Returns: void
+ */
+void check_sell(char** splitLine, ProgramParameters* parameters,
+	Client client) {
+    FILE* outputClient = client.output;
+    int interval = 0;
+    int softWindow = 0;
+    int softExtension = 0;
+    if (splitLine[4]) {
+	char* remainderText;
+	interval = strtol(splitLine[4], &remainderText, 10);
+	if (strlen(remainderText) != 0 || interval < (splitLine[5] ? 0 : 1)) {
+	    fprintf(outputClient, ":invalid\n");
+	    return;
+	}
+	if (splitLine[5]) {
+	    softWindow = strtol(splitLine[5], &remainderText, 10);
+	    bool valid = strlen(remainderText) == 0 && softWindow >= 1;
+	    softExtension = strtol(splitLine[6], &remainderText, 10);
+	    if (!valid || strlen(remainderText) != 0 || softExtension < 1) {
+		fprintf(outputClient, ":invalid\n");
+		return;
+	    }
+	}
+	// Room for the batch as well as the item.
+	if (interval && over_allowance(parameters, client.charged, ITEM_MEMORY
+		+ strlen(splitLine[1]) + 1 + sizeof(BidBatch))) {
+	    fprintf(outputClient, ":rejected\n");
+	    return;
+	}
+    }
+    int result = list_item(parameters, client, splitLine[1], splitLine[2],
+	    splitLine[3]);
+    if (result == LISTING_LISTED && softWindow) {
+	int itemIndex = parameters->numOfItems - 1;
+	parameters->items[itemIndex].softWindow = softWindow;
+	parameters->items[itemIndex].softExtension = softExtension;
+	publish_event(parameters, EXTEND_EVENT, "%s %d %d %d", splitLine[1],
+		(int) (parameters->items[itemIndex].expiryTime
+		- clock_ms(parameters)), softWindow, softExtension);
+    }
+    if (result == LISTING_LISTED && interval) {
+	open_batch(parameters, parameters->numOfItems - 1, interval);
+    }
+    if (result == LISTING_INVALID) {
+	fprintf(outputClient, ":invalid\n");
+    } else if (result == LISTING_REJECTED) {
+	fprintf(outputClient, ":rejected\n");
+    } else {
+	fprintf(outputClient, ":listed %s\n", splitLine[1]);
+    }
+}
+
+/* sell_batch()
+ * ------------
+ * Lists every item of a sellbatch command in one go, replying with one
+ * 	result per listing in the order given, e.g.
+ * 	":sellbatch listed rejected invalid".
+ *
+ * length: the number of words in the input command from client.
+ * splitLine: an array of arrays of the input from client, split by ' ',
+ * 	holding a name, reserve and duration for each listing.
+ * parameters: a data struct containing all the data for the program.
+ * client: a struct containing the client tid and output file descriptor.
+ *
+ * Returns: void
+ */
+void sell_batch(int length, char** splitLine, ProgramParameters* parameters,
+	Client client) {
+    const char* results[] = {"listed", "rejected", "invalid"};
+    FILE* outputClient = client.output;
+    reserve_items(parameters, parameters->numOfItems + (length - 1) / 3);
+    fprintf(outputClient, ":sellbatch");
+    for (int i = 1; i + 2 < length; i += 3) {
+	int result = list_item(parameters, client, splitLine[i],
+		splitLine[i + 1], splitLine[i + 2]);
+	fprintf(outputClient, " %s", results[result]);
+    }
+    fprintf(outputClient, "\n");
+}
+
+/* list_item()
+ * -----------
+ * Validates a listing and, if it is valid and the name is free, adds the item
+ * 	to the list of items being sold.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * seller: the client selling the item.
+ * item: the name of the item.
+ * reserveText: the reserve price as given by the client.
+ * durationText: the duration as given by the client.
+ *
+ * Returns: LISTING_LISTED, LISTING_REJECTED if the item is already on sale
+ * 	or the seller's connection has no memory left for it, or
+ * 	LISTING_INVALID if the name is too long or the reserve or duration is
+ * 	not valid.
+ */
+int list_item(ProgramParameters* parameters, Client seller, const char* item,
+	const char* reserveText, const char* durationText) {
+    // Names are kept for as long as the item is on sale.
+    long maxName = parameters->limits.maxName;
+    long nameLength = strlen(item);
+    if (maxName && nameLength > maxName) {
+	return LISTING_INVALID;
+    }
+
+    // Check if given reserve is valid.
+    char* remainderText;
+    int reserve = strtol(reserveText, &remainderText, 10);
+    if (strlen(remainderText) != 0 || reserve < 0) {
+	return LISTING_INVALID;
+    }
+
+    // Check if given duration is valid.
+    int duration = strtol(durationText, &remainderText, 10);
+    if (strlen(remainderText) != 0 || duration < 1) {
+	return LISTING_INVALID;
+    }
+
+    // Check if item is already on sale.
+    if (find_item_index(parameters, item) != -1
+	    || over_allowance(parameters, seller.charged,
+	    ITEM_MEMORY + nameLength + 1)) {
+	return LISTING_REJECTED;
+    }
+
+    // Add item to list of items being sold.
+    add_item(parameters, seller, item, reserve, duration);
+    publish_event(parameters, SELL_EVENT, "%s %d %d", item, reserve,
+	    duration);
+    return LISTING_LISTED;
+}
+
+/* add_item()
+ * ----------
+ * Adds an item to the list of items being sold. The caller must have checked
+ * 	that no item of that name is on sale.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * seller: the client selling the item.
+ * item: the name of the item.
+ * reserve: the reserve price of the item.
+ * duration: the number of milliseconds until the auction closes.
+ *
+ * Returns: the index of the new item in the items data struct.
+ */
+int add_item(ProgramParameters* parameters, Client seller, const char* item,
+	int reserve, int duration) {
+    reserve_items(parameters, parameters->numOfItems + 1);
+    int itemNum = parameters->numOfItems++;
+    parameters->items[itemNum].seller = seller;
+    parameters->items[itemNum].sellerActive = true;
+    parameters->items[itemNum].item = strdup(item);
+    parameters->items[itemNum].reserve = reserve;
+    parameters->items[itemNum].duration = duration;
+    parameters->items[itemNum].highestBidder = false;
+    parameters->items[itemNum].highestBid = 0;
+    parameters->items[itemNum].expiryTime = clock_ms(parameters) + duration;
+    parameters->items[itemNum].bidderActive = false;
+    parameters->items[itemNum].openTime = get_wall_time_ms();
+    parameters->items[itemNum].batch = NULL;
+    parameters->items[itemNum].softWindow = 0;
+    parameters->items[itemNum].softExtension = 0;
+    index_insert(parameters, itemNum);
+    expiry_insert(parameters, itemNum);
+    long size = strlen(item) + 1;
+    account_memory(parameters, MEMORY_NAMES, size);
+    charge_connection(seller.charged, ITEM_MEMORY + size);
+    item_changed(parameters, itemNum);
+    return itemNum;
+}
+
+/* list_all_items()
+ * ----------------
+ * Lists all the items available to bid.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * outputClient: the output file descriptor for the client to list the items
+ * 	for.
+ *
+ * Returns: void
+ */
+void list_all_items(ProgramParameters* parameters, FILE* outputClient) {
+    fprintf(outputClient, ":list ");
+    for (int i = 0; i < parameters->numOfItems; i++) {
+	ItemList* items = parameters->items;
+	int remainingDuration = (int)(items[i].expiryTime
+		- clock_ms(parameters));
+	fprintf(outputClient, "%s %d %d %d|", items[i].item, items[i].reserve,
+		items[i].highestBid, remainingDuration);
+    }
+    fprintf(outputClient, "\n");
+}
+
+/* place_bid()
+ * -----------
+ * Checks if bid command is correct and places bid on specified item, or
+ * 	queues it if the item is sold by clearing.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * client: a struct containing the client tid and output file descriptor.
+ *
+ * Returns: void
+ */
+void place_bid(char** splitLine, ProgramParameters* parameters,
+	Client client) {
+    int batchItem = find_item_index(parameters, splitLine[1]);
+    if (batchItem != -1 && parameters->items[batchItem].batch) {
+	queue_bid(splitLine, parameters, batchItem, client.id);
+	return;
+    }
+
+    int bidAmount = strtol(splitLine[2], NULL, 10);
+    bool valid = validate_bid_input(splitLine, parameters, client);
+    if (!valid) {
+	trace_event(TRACE_BID_REJECTED, bidAmount);
+	return;
+    }
+
+    FILE* outputClient = client.output;
+
+    // Get item ID
+    int itemId = find_item(splitLine, parameters, outputClient);
+    ItemList item = parameters->items[itemId];
+
+    // Send outbid message to previous topBidder.
+    if (item.highestBidder && item.bidderActive) {
+	fprintf(item.topBidder.output, ":outbid %s %d\n",
+		item.item, bidAmount);
+	fflush(item.topBidder.output);
+	trace_event(TRACE_NOTIFY_FLUSHED, item.topBidder.session);
+    }
+
+    // Add client as highest bidder.
+    parameters->items[itemId].highestBid = bidAmount;
+    item_changed(parameters, itemId);
+    parameters->items[itemId].highestBidder = true;
+    parameters->items[itemId].topBidder = client;
+    parameters->items[itemId].bidderActive = true;
+    publish_event(parameters, BID_EVENT, "%s %d", item.item, bidAmount);
+    soft_close(parameters, itemId);
+
+    trace_event(TRACE_BID_ACCEPTED, bidAmount);
+    fprintf(outputClient, ":bid %s\n", splitLine[1]);
+
+}
+
+/* validate_bid_input()
+ * --------------------
+ * Checks if the bid command from client is valid.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * client: a struct containing the client tid and output file descriptor.
+ *
+ * Returns: true if input is valid, but false if invalid.
+ */
+bool validate_bid_input(char** splitLine, ProgramParameters* parameters,
+	Client client) {
+    FILE* outputClient = client.output;
+
+    // Check if bid value is valid.
+    char* remainderText;
+    int bidAmount = strtol(splitLine[2], &remainderText, 10);
+    if (strlen(remainderText) != 0 || bidAmount < 1) {
+	fprintf(outputClient, ":invalid\n");
+	return false;
+    }
+
+    int itemId = find_item(splitLine, parameters, outputClient);
+    if (itemId == -1) {
+	return false;
+    }
+
+    // Check if client is placing a valid bid.
+    if ((same_client(client, parameters->items[itemId].seller)
+            && parameters->items[itemId].sellerActive)
+	    || bidAmount < parameters->items[itemId].reserve
+	    || bidAmount <= parameters->items[itemId].highestBid) { 
+	fprintf(outputClient, ":rejected\n");
+	return false;
+    }
+
+    ItemList item = parameters->items[itemId];
+    if (parameters->items[itemId].highestBidder != false) {
+	Client highestBidder = parameters->items[itemId].topBidder;
+	if (same_client(client, highestBidder) && item.bidderActive) {
+	    fprintf(outputClient, ":rejected\n");
+	    return false;
+	}
+    }
+    return true;
+}
+
+/* same_client()
+ * -------------
+ * Checks whether two clients are the same bidder or seller.
+ *
+ * first: a client.
+ * second: another client.
+ *
+ * Returns: true if they are served by the same thread in the same session.
+ */
+bool same_client(Client first, Client second) {
+    return first.tid == second.tid && first.session == second.session;
+}
+
+/* items_changed()
+ * ---------------
+ * Notes that something list shows has changed, so that the published view
+ * 	is out of date. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: void
+ */
+void items_changed(ProgramParameters* parameters) {
+    __atomic_add_fetch(&parameters->itemsVersion, 1, __ATOMIC_RELEASE);
+}
+
+/* item_changed()
+ * --------------
+ * Notes that something list shows of an item has changed, for delta lists
+ * 	as well as the published view. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ *
+ * Returns: void
+ */
+void item_changed(ProgramParameters* parameters, int itemIndex) {
+    items_changed(parameters);
+    parameters->items[itemIndex].changed = parameters->itemsVersion;
+
+    // The view chunk holding the item must be copied again.
+    int chunk = itemIndex / VIEW_CHUNK_ITEMS;
+    if (chunk >= parameters->viewChunkCapacity) {
+	int capacity = parameters->viewChunkCapacity
+		? parameters->viewChunkCapacity : 1;
+	while (chunk >= capacity) {
+	    capacity *= 2;
+	}
+	parameters->viewChunkChanged = realloc(parameters->viewChunkChanged,
+		sizeof(bool) * capacity);
+	memset(parameters->viewChunkChanged + parameters->viewChunkCapacity,
+		0, sizeof(bool) * (capacity - parameters->viewChunkCapacity));
+	parameters->viewChunkCapacity = capacity;
+    }
+    parameters->viewChunkChanged[chunk] = true;
+}
+
+/* log_closed()
+ * ------------
+ * Remembers that an item has closed, for delta lists. Must be called with
+ * 	the lock held, after items_changed().
+ *
+ * parameters: a data struct containing all the data for the program.
+ * item: the item's name, which the log takes over.
+ *
+ * Returns: void
+ */
+void log_closed(ProgramParameters* parameters, char* item) {
+    ClosedLog* log = &parameters->closed;
+    if (log->entries == NULL) {
+	log->entries = malloc(sizeof(ClosedItem) * CLOSED_LOG_SIZE);
+    }
+    if (log->numOfEntries == CLOSED_LOG_SIZE) {
+	int numOfDropped = CLOSED_LOG_SIZE / 2;
+	for (int i = 0; i < numOfDropped; i++) {
+	    account_memory(parameters, MEMORY_NAMES,
+		    -(long) (strlen(log->entries[i].item) + 1));
+	    free(log->entries[i].item);
+	}
+	log->floor = log->entries[numOfDropped - 1].version;
+	log->numOfEntries -= numOfDropped;
+	memmove(log->entries, log->entries + numOfDropped,
+		sizeof(ClosedItem) * log->numOfEntries);
+    }
+    log->entries[log->numOfEntries].item = item;
+    log->entries[log->numOfEntries].version = parameters->itemsVersion;
+    log->numOfEntries++;
+}
+
+/* destroy_view()
+ * --------------
+ * Frees a view once no reader can be using it. Its chunks are freed
+ * 	separately, as they may still be part of a newer view.
+ *
+ * view: the view to free.
+ *
+ * Returns: void
+ */
+static void destroy_view(void* view) {
+    placement_free(view, ((ItemView*) view)->size);
+}
+
+/* destroy_chunk()
+ * ---------------
+ * Frees a view chunk once no reader can be using a view which holds it.
+ *
+ * chunk: the chunk to free.
+ *
+ * Returns: void
+ */
+static void destroy_chunk(void* chunk) {
+    placement_free(chunk, ((ViewChunk*) chunk)->size);
+}
+
+/* copy_chunk()
+ * ------------
+ * Copies a run of the items being sold, and their names, into a new view
+ * 	chunk.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * first: the index of the first item to copy.
+ * numOfItems: the number of items to copy.
+ *
+ * Returns: the new chunk.
+ */
+static ViewChunk* copy_chunk(ProgramParameters* parameters, int first,
+	int numOfItems) {
+    ItemList* items = parameters->items + first;
+    size_t size = sizeof(ViewChunk) + sizeof(ViewItem) * numOfItems;
+    for (int i = 0; i < numOfItems; i++) {
+	size += strlen(items[i].item) + 1;
+    }
+    ViewChunk* chunk = placement_alloc(size);
+    chunk->size = size;
+    chunk->numOfItems = numOfItems;
+    char* name = (char*) (chunk->items + numOfItems);
+    for (int i = 0; i < numOfItems; i++) {
+	chunk->items[i].item = name;
+	chunk->items[i].reserve = items[i].reserve;
+	chunk->items[i].highestBid = items[i].highestBid;
+	chunk->items[i].expiryTime = items[i].expiryTime;
+	chunk->items[i].changed = items[i].changed;
+	name = stpcpy(name, items[i].item) + 1;
+    }
+    return chunk;
+}
+
+/* publish_view()
+ * --------------
+ * Makes sure the published view matches the items being sold, making a new
+ * 	view if they have changed. Only the chunks of VIEW_CHUNK_ITEMS items
+ * 	holding an item which has changed or moved are copied, and the rest
+ * 	are shared with the old view. The old view and the chunks it no
+ * 	longer shares are retired and freed once the readers which might be
+ * 	using them have finished. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: the published view.
+ */
+ItemView* publish_view(ProgramParameters* parameters) {
+    ItemView* old = parameters->view;
+    if (old && old->version == parameters->itemsVersion) {
+	return old;
+    }
+
+    int numOfItems = parameters->numOfItems;
+    int numOfChunks = (numOfItems + VIEW_CHUNK_ITEMS - 1) / VIEW_CHUNK_ITEMS;
+    size_t size = sizeof(ItemView) + sizeof(ViewChunk*) * numOfChunks;
+    ItemView* view = placement_alloc(size);
+    view->size = size;
+    view->version = parameters->itemsVersion;
+    view->numOfItems = numOfItems;
+    view->numOfChunks = numOfChunks;
+
+    // Only the current view and its chunks are accounted for. Old ones are
+    // freed as soon as their readers are done.
+    long change = size - (old ? old->size : 0);
+    int numOfOldChunks = old ? old->numOfChunks : 0;
+    for (int i = 0; i < numOfOldChunks || i < numOfChunks; i++) {
+	int first = i * VIEW_CHUNK_ITEMS;
+	int length = numOfItems - first < VIEW_CHUNK_ITEMS
+		? numOfItems - first : VIEW_CHUNK_ITEMS;
+	ViewChunk* chunk = i < numOfOldChunks ? old->chunks[i] : NULL;
+	if (chunk && (i >= numOfChunks || chunk->numOfItems != length
+		|| first + length > parameters->viewMovedFrom
+		|| (i < parameters->viewChunkCapacity
+		&& parameters->viewChunkChanged[i]))) {
+	    change -= chunk->size;
+	    epoch_retire(&parameters->epoch, chunk, destroy_chunk);
+	    chunk = NULL;
+	}
+	if (i < numOfChunks) {
+	    if (chunk == NULL) {
+		chunk = copy_chunk(parameters, first, length);
+		change += chunk->size;
+	    }
+	    view->chunks[i] = chunk;
+	}
+    }
+    memset(parameters->viewChunkChanged, 0,
+	    sizeof(bool) * parameters->viewChunkCapacity);
+    parameters->viewMovedFrom = INT_MAX;
+
+    __atomic_store_n(&parameters->view, view, __ATOMIC_SEQ_CST);
+    account_memory(parameters, MEMORY_VIEWS, change);
+    if (old) {
+	epoch_retire(&parameters->epoch, old, destroy_view);
+    }
+    epoch_reclaim(&parameters->epoch);
+    return view;
+}
+
+/* refresh_view()
+ * --------------
+ * Publishes a new view at the end of a change if a client has listed
+ * 	without the lock since the last one was published, so that the next
+ * 	list is likely to find it ready instead of waiting for the lock to
+ * 	publish it. Views nobody has asked for are not made. Must be called
+ * 	with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: void
+ */
+void refresh_view(ProgramParameters* parameters) {
+    if (__atomic_load_n(&parameters->viewWanted, __ATOMIC_RELAXED)) {
+	__atomic_store_n(&parameters->viewWanted, false, __ATOMIC_RELAXED);
+	publish_view(parameters);
+    }
+}
+
+/* list_view()
+ * -----------
+ * Sends a list of all items being sold to a client without holding the lock
+ * 	while formatting and writing, so a long list does not hold up bids.
+ * 	The list is formatted into a buffer first, so notifications to the
+ * 	client only wait for it to be written.
+ * 	Changes publish a new view for the next list (see refresh_view()),
+ * 	and the lock is only taken to publish one if the items have changed
+ * 	again since.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * reader: the calling thread's slot from epoch_register().
+ * outputClient: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void list_view(ProgramParameters* parameters, int reader,
+	FILE* outputClient) {
+    // Asks the next change to publish a view for the next list. The flag is
+    // only written when clear, so that readers rarely write to it.
+    if (!__atomic_load_n(&parameters->viewWanted, __ATOMIC_RELAXED)) {
+	__atomic_store_n(&parameters->viewWanted, true, __ATOMIC_RELAXED);
+    }
+
+    epoch_enter(&parameters->epoch, reader);
+    ItemView* view = __atomic_load_n(&parameters->view, __ATOMIC_SEQ_CST);
+    if (view == NULL || view->version
+	    != __atomic_load_n(&parameters->itemsVersion, __ATOMIC_ACQUIRE)) {
+	take_traced_lock(parameters->lock);
+	view = publish_view(parameters);
+	release_traced_lock(parameters->lock);
+    }
+
+    char* list;
+    size_t listLength;
+    FILE* listStream = open_memstream(&list, &listLength);
+    fprintf(listStream, ":list ");
+    double now = clock_ms(parameters);
+    for (int i = 0; i < view->numOfChunks; i++) {
+	ViewChunk* chunk = view->chunks[i];
+	for (int j = 0; j < chunk->numOfItems; j++) {
+	    ViewItem* item = &chunk->items[j];
+	    fprintf(listStream, "%s %d %d %d|", item->item, item->reserve,
+		    item->highestBid, (int) (item->expiryTime - now));
+	}
+    }
+    fprintf(listStream, "\n");
+    epoch_exit(&parameters->epoch, reader);
+    fclose(listStream);
+
+    // Notifications are written to the stream under the lock, so it is
+    // only kept from them for the one write of the finished list.
+    flockfile(outputClient);
+    fwrite(list, 1, listLength, outputClient);
+    fflush(outputClient);
+    funlockfile(outputClient);
+    free(list);
+}
+
+/* list_delta()
+ * ------------
+ * Replies to "delta since [z]" with only what has changed since the version
+ * 	of the items a client last saw, as ":delta version base entries". The
+ * 	entries are "name|" for each item which has closed, followed by
+ * 	"name reserve highestBid remaining|" for each item listed or bid on,
+ * 	in list order. A base of 0 means the entries are every item on sale,
+ * 	as the client is too far behind, or has given 0 to start afresh. With
+ * 	z, long entries are compressed and sent as ":zdelta version base
+ * 	length packed" instead (see pack_text()). The view is formatted
+ * 	without holding the lock, like list.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * reader: the calling thread's slot from epoch_register(), or -1 if the
+ * 	caller holds the lock.
+ * length: the number of words in the input command from client.
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * outputClient: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void list_delta(ProgramParameters* parameters, int reader, int length,
+	char** splitLine, FILE* outputClient) {
+    char* remainderText = "";
+    unsigned long since = length >= 2
+	    ? strtoul(splitLine[1], &remainderText, 10) : 0;
+    if (length < 2 || length > 3 || strlen(remainderText) != 0
+	    || !isdigit(splitLine[1][0])
+	    || (length == 3 && strcmp(splitLine[2], "z") != 0)) {
+	flockfile(outputClient);
+	fprintf(outputClient, ":invalid\n");
+	fflush(outputClient);
+	funlockfile(outputClient);
+	return;
+    }
+
+    char* payload;
+    size_t payloadLength;
+    FILE* entries = open_memstream(&payload, &payloadLength);
+    if (reader != -1) {
+	epoch_enter(&parameters->epoch, reader);
+	take_traced_lock(parameters->lock);
+    }
+    ItemView* view = publish_view(parameters);
+    unsigned long base = delta_base(parameters, view, since, entries);
+    if (reader != -1) {
+	release_traced_lock(parameters->lock);
+    }
+
+    double now = clock_ms(parameters);
+    for (int i = 0; i < view->numOfChunks; i++) {
+	ViewChunk* chunk = view->chunks[i];
+	for (int j = 0; j < chunk->numOfItems; j++) {
+	    ViewItem* item = &chunk->items[j];
+	    if (item->changed > base) {
+		fprintf(entries, "%s %d %d %d|", item->item, item->reserve,
+			item->highestBid, (int) (item->expiryTime - now));
+	    }
+	}
+    }
+    unsigned long version = view->version;
+    if (reader != -1) {
+	epoch_exit(&parameters->epoch, reader);
+    }
+    fclose(entries);
+    send_delta(outputClient, version, base, payload, payloadLength,
+	    length == 3);
+    free(payload);
+}
+
+/* delta_base()
+ * ------------
+ * Works out what a delta list is relative to, and writes the entries for
+ * 	the items which have closed since then. Must be called with the lock
+ * 	held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * view: the current view.
+ * since: the version the client last saw.
+ * payload: the stream the entries are written to.
+ *
+ * Returns: since, or 0 if the client must be sent every item.
+ */
+unsigned long delta_base(ProgramParameters* parameters, ItemView* view,
+	unsigned long since, FILE* payload) {
+    ClosedLog* log = &parameters->closed;
+    if (since < log->floor || since > view->version) {
+	return 0;
+    }
+    // The log is in version order, so the first entry needed is found by
+    // bisection.
+    int low = 0;
+    int high = log->numOfEntries;
+    while (low < high) {
+	int middle = (low + high) / 2;
+	if (log->entries[middle].version <= since) {
+	    low = middle + 1;
+	} else {
+	    high = middle;
+	}
+    }
+    for (int i = low; i < log->numOfEntries
+	    && log->entries[i].version <= view->version; i++) {
+	fprintf(payload, "%s|", log->entries[i].item);
+    }
+    return since;
+}
+
+/* send_delta()
+ * ------------
+ * Sends a delta list, compressed if asked for and worthwhile.
+ *
+ * outputClient: the output file descriptor of the client.
+ * version: the version of the items the delta brings the client up to.
+ * base: the version the delta is relative to, or 0.
+ * payload: the entries.
+ * length: the length of the entries.
+ * pack: whether the client asked for compression.
+ *
+ * Returns: void
+ */
+void send_delta(FILE* outputClient, unsigned long version,
+	unsigned long base, const char* payload, size_t length, bool pack) {
+    char* packed = pack && length >= MIN_PACKED_DELTA
+	    ? pack_text(payload, length) : NULL;
+    flockfile(outputClient);
+    if (packed && strlen(packed) < length) {
+	fprintf(outputClient, ":zdelta %lu %lu %zu %s\n", version, base,
+		length, packed);
+    } else {
+	fprintf(outputClient, ":delta %lu %lu %s\n", version, base, payload);
+    }
+    fflush(outputClient);
+    funlockfile(outputClient);
+    free(packed);
+}
+
+/* find_item()
+ * -----------
+ * Finds the index of the item in the bid input command.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * outputClient: the output file descriptor of the client.
+ *
+ * Returns: index of item in data struct, but returns -1 if not found.
+ */
+int find_item(char** splitLine, ProgramParameters* parameters,
+	FILE* outputClient) {
+    int itemId = find_item_index(parameters, splitLine[1]);
+    if (itemId == -1) {
+	fprintf(outputClient, ":rejected\n");
+    }
+    return itemId;
+}
+
+/* find_item_index()
+ * -----------------
+ * Finds the index of an item by name.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * item: the name of the item.
+ *
+ * Returns: index of item in data struct, but returns -1 if not found.
+ */
+int find_item_index(ProgramParameters* parameters, const char* item) {
+    if (parameters->indexCapacity == 0) {
+	return -1;
+    }
+    return index_slot(parameters, item)->item;
+}
+
+/* hash_name()
+ * -----------
+ * Hashes an item name for the name index (FNV-1a).
+ *
+ * item: the name of the item.
+ *
+ * Returns: the hash of the name.
+ */
+static unsigned int hash_name(const char* item) {
+    unsigned int hash = 2166136261u;
+    for (const char* c = item; *c != '\0'; c++) {
+	hash ^= (unsigned char) *c;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* index_slot()
+ * ------------
+ * Finds the slot of the name index holding an item, or the empty slot where
+ * 	it would go. The index is an open-addressing table with linear
+ * 	probing. Each slot keeps the hash of its name, so names are only
+ * 	compared when the hashes match.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * item: the name of the item.
+ *
+ * Returns: a pointer to the slot, whose item is -1 if the slot is empty.
+ */
+IndexSlot* index_slot(ProgramParameters* parameters, const char* item) {
+    IndexSlot* index = parameters->itemIndex;
+    unsigned int mask = parameters->indexCapacity - 1;
+    unsigned int hash = hash_name(item);
+    unsigned int slot = hash & mask;
+    while (index[slot].item != -1 && (index[slot].hash != hash
+	    || strcmp(item, parameters->items[index[slot].item].item) != 0)) {
+	slot = (slot + 1) & mask;
+    }
+    index[slot].hash = hash;
+    return &index[slot];
+}
+
+/* index_insert()
+ * --------------
+ * Adds an item to the name index, which must have room for it.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the items data struct.
+ *
+ * Returns: void
+ */
+void index_insert(ProgramParameters* parameters, int itemIndex) {
+    index_slot(parameters, parameters->items[itemIndex].item)->item =
+	    itemIndex;
+}
+
+/* reserve_items()
+ * ---------------
+ * Makes room for a number of items, so that adding them neither moves the
+ * 	items data struct or expiry heap nor rebuilds the name index. All grow
+ * 	by doubling, so listing n items one at a time copies them O(log n)
+ * 	times, and the index is kept at most half full. All are placed as
+ * 	--placement asks.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * numOfItems: the number of items to make room for.
+ *
+ * Returns: void
+ */
+void reserve_items(ProgramParameters* parameters, int numOfItems) {
+    if (numOfItems > parameters->itemCapacity) {
+	int capacity = parameters->itemCapacity
+		? parameters->itemCapacity : MIN_ITEM_CAPACITY;
+	while (numOfItems > capacity) {
+	    capacity *= 2;
+	}
+	parameters->items = placement_grow(parameters->items,
+		sizeof(ItemList) * parameters->itemCapacity,
+		sizeof(ItemList) * capacity);
+	parameters->expiries = placement_grow(parameters->expiries,
+		sizeof(ExpiryEntry) * parameters->itemCapacity,
+		sizeof(ExpiryEntry) * capacity);
+	parameters->itemCapacity = capacity;
+    }
+    if (numOfItems * 2 > parameters->indexCapacity) {
+	int capacity = parameters->indexCapacity
+		? parameters->indexCapacity : MIN_INDEX_CAPACITY;
+	while (numOfItems * 2 > capacity) {
+	    capacity *= 2;
+	}
+	IndexSlot* index = placement_alloc(sizeof(IndexSlot) * capacity);
+	for (int i = 0; i < capacity; i++) {
+	    index[i].item = -1;
+	}
+
+	// Move the items already listed, by the hashes kept in their slots.
+	unsigned int mask = capacity - 1;
+	for (int i = 0; i < parameters->indexCapacity; i++) {
+	    IndexSlot entry = parameters->itemIndex[i];
+	    if (entry.item != -1) {
+		unsigned int slot = entry.hash & mask;
+		while (index[slot].item != -1) {
+		    slot = (slot + 1) & mask;
+		}
+		index[slot] = entry;
+	    }
+	}
+	placement_free(parameters->itemIndex,
+		sizeof(IndexSlot) * parameters->indexCapacity);
+	parameters->itemIndex = index;
+	parameters->indexCapacity = capacity;
+    }
+}
+
+/* index_remove()
+ * --------------
+ * Removes an item from the name index. Later entries of the same probe run
+ * 	are shifted back so that lookups never need tombstones.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * item: the name of the item, which must still be in the items data struct.
+ *
+ * Returns: void
+ */
+void index_remove(ProgramParameters* parameters, const char* item) {
+    unsigned int mask = parameters->indexCapacity - 1;
+    IndexSlot* index = parameters->itemIndex;
+    unsigned int hole = index_slot(parameters, item) - index;
+    index[hole].item = -1;
+    for (unsigned int slot = (hole + 1) & mask; index[slot].item != -1;
+	    slot = (slot + 1) & mask) {
+	unsigned int home = index[slot].hash & mask;
+	// Move the entry into the hole unless its home lies cyclically in
+	// (hole, slot], in which case it is already reachable.
+	bool reachable = hole <= slot ? (home > hole && home <= slot)
+		: (home > hole || home <= slot);
+	if (!reachable) {
+	    index[hole] = index[slot];
+	    index[slot].item = -1;
+	    hole = slot;
+	}
+    }
+}
+
+/* expiry_swap()
+ * -------------
+ * Swaps two entries of the expiry heap, keeping their items' slots.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * first: the slot of one entry.
+ * second: the slot of the other.
+ *
+ * Returns: void
+ */
+static void expiry_swap(ProgramParameters* parameters, int first,
+	int second) {
+    ExpiryEntry* heap = parameters->expiries;
+    ExpiryEntry entry = heap[first];
+    heap[first] = heap[second];
+    heap[second] = entry;
+    parameters->items[heap[first].item].expirySlot = first;
+    parameters->items[heap[second].item].expirySlot = second;
+}
+
+/* expiry_sift()
+ * -------------
+ * Moves an entry of the expiry heap up or down until it is in order, which
+ * 	takes O(log n) swaps.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * slot: the slot of the entry.
+ * numOfEntries: the number of entries in the heap.
+ *
+ * Returns: void
+ */
+static void expiry_sift(ProgramParameters* parameters, int slot,
+	int numOfEntries) {
+    ExpiryEntry* heap = parameters->expiries;
+    while (slot > 0 && heap[slot].expiryTime
+	    < heap[(slot - 1) / 2].expiryTime) {
+	expiry_swap(parameters, slot, (slot - 1) / 2);
+	slot = (slot - 1) / 2;
+    }
+    while (1) {
+	int soonest = slot;
+	for (int child = 2 * slot + 1; child <= 2 * slot + 2
+		&& child < numOfEntries; child++) {
+	    if (heap[child].expiryTime < heap[soonest].expiryTime) {
+		soonest = child;
+	    }
+	}
+	if (soonest == slot) {
+	    return;
+	}
+	expiry_swap(parameters, slot, soonest);
+	slot = soonest;
+    }
+}
+
+/* expiry_insert()
+ * ---------------
+ * Adds an item to the expiry heap, which has room for it, as
+ * 	reserve_items() grows it with the items data struct.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item.
+ *
+ * Returns: void
+ */
+static void expiry_insert(ProgramParameters* parameters, int itemIndex) {
+    int slot = parameters->numOfExpiries++;
+    parameters->expiries[slot].expiryTime =
+	    parameters->items[itemIndex].expiryTime;
+    parameters->expiries[slot].item = itemIndex;
+    parameters->items[itemIndex].expirySlot = slot;
+    expiry_sift(parameters, slot, parameters->numOfExpiries);
+    wake_timer(parameters, parameters->items[itemIndex].expiryTime);
+}
+
+/* expiry_remove()
+ * ---------------
+ * Takes an item out of the expiry heap, filling its slot with the last
+ * 	entry. Called before the item is removed from the items data struct.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item.
+ *
+ * Returns: void
+ */
+static void expiry_remove(ProgramParameters* parameters, int itemIndex) {
+    int slot = parameters->items[itemIndex].expirySlot;
+    int last = --parameters->numOfExpiries;
+    if (slot != last) {
+	parameters->expiries[slot] = parameters->expiries[last];
+	parameters->items[parameters->expiries[slot].item].expirySlot = slot;
+	expiry_sift(parameters, slot, last);
+    }
+}
+
+/* set_expiry()
+ * ------------
+ * Changes when an item closes, re-keying its entry in the expiry heap in
+ * 	O(log n). Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item.
+ * expiryTime: when it is to close, by clock_ms().
+ *
+ * Returns: void
+ */
+void set_expiry(ProgramParameters* parameters, int itemIndex,
+	double expiryTime) {
+    ItemList* item = &parameters->items[itemIndex];
+    item->expiryTime = expiryTime;
+    parameters->expiries[item->expirySlot].expiryTime = expiryTime;
+    expiry_sift(parameters, item->expirySlot, parameters->numOfExpiries);
+    wake_timer(parameters, expiryTime);
+}
+
+/* next_expiry()
+ * -------------
+ * Gets when the next auction closes. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: its expiry time by clock_ms(), or -1 if there are no items.
+ */
+double next_expiry(ProgramParameters* parameters) {
+    return parameters->numOfExpiries ? parameters->expiries[0].expiryTime
+	    : -1;
+}
+
+/* wait_timer()
+ * ------------
+ * Sleeps the timer thread until it is woken or a time has passed, then
+ * 	clears any other wakes sent meanwhile, as one pass handles them all.
+ *
+ * wake: the semaphore the timer is woken by.
+ * waitMs: the most milliseconds to sleep.
+ *
+ * Returns: void
+ */
+void wait_timer(sem_t* wake, double waitMs) {
+    if (waitMs > 0) {
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	long nanoseconds = until.tv_nsec + (long) (waitMs * 1000000);
+	until.tv_sec += nanoseconds / 1000000000;
+	until.tv_nsec = nanoseconds % 1000000000;
+	while (sem_timedwait(wake, &until) == -1 && errno == EINTR) {
+	}
+    }
+    while (sem_trywait(wake) == 0) {
+    }
+}
+
+/* wake_timer()
+ * ------------
+ * Wakes the timer thread early if an item now closes before it was due to
+ * 	wake, so that closes are not left waiting for the next tick.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * expiryTime: when the item closes, by clock_ms().
+ *
+ * Returns: void
+ */
+static void wake_timer(ProgramParameters* parameters, double expiryTime) {
+    if (parameters->timerWake && expiryTime < parameters->timerDeadline) {
+	parameters->timerDeadline = expiryTime;
+	sem_post(parameters->timerWake);
+    }
+}
+
+/* soft_close()
+ * ------------
+ * Extends an auction with a soft close whose winning bid came within its
+ * 	last softWindow milliseconds, so that it ends softExtension
+ * 	milliseconds after the bid instead of being sniped. Must be called
+ * 	with the lock held, after the bid is accepted.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item.
+ *
+ * Returns: void
+ */
+void soft_close(ProgramParameters* parameters, int itemIndex) {
+    ItemList* item = &parameters->items[itemIndex];
+    double now = clock_ms(parameters);
+    if (item->softWindow == 0 || item->expiryTime - now > item->softWindow
+	    || now + item->softExtension <= item->expiryTime) {
+	return;
+    }
+    set_expiry(parameters, itemIndex, now + item->softExtension);
+    item_changed(parameters, itemIndex);
+    publish_event(parameters, EXTEND_EVENT, "%s %d", item->item,
+	    item->softExtension);
+}
+
+/* get_wall_time_ms()
+ * ------------------
+ * Gets the wall clock time, which unlike get_time_ms() is comparable
+ * 	between the primary and its replicas.
+ *
+ * Returns: milliseconds since the epoch.
+ */
+double get_wall_time_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/* publish_event()
+ * ---------------
+ * Ships an event to every replica, by queueing it for the replica's thread
+ * 	to write. Must be called with the lock held, which is what keeps the
+ * 	stream in the same order as the changes. A replica which cannot be
+ * 	written to, or has fallen MAX_QUEUED_EVENTS behind, is dropped.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * type: the record type, e.g. SELL_EVENT.
+ * format: printf format for the rest of the record, or NULL for none.
+ *
+ * Returns: void
+ */
+void publish_event(ProgramParameters* parameters, char type,
+	const char* format, ...) {
+    if (parameters->role != PRIMARY) {
+	return;
+    }
+    // Heartbeats only repeat the latest sequence number.
+    if (type != HEARTBEAT_EVENT) {
+	parameters->eventSeq++;
+    }
+    if (parameters->numOfReplicas == 0) {
+	return;
+    }
+
+    // Format the record once for every replica.
+    char* body = NULL;
+    if (format) {
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	body = malloc(length + 1);
+	va_start(args, format);
+	vsnprintf(body, length + 1, format, args);
+	va_end(args);
+    }
+    double now = get_wall_time_ms();
+    int length = snprintf(NULL, 0, "%c %lu %.0f%s%s\n", type,
+	    parameters->eventSeq, now, body ? " " : "", body ? body : "");
+    char* line = malloc(length + 1);
+    snprintf(line, length + 1, "%c %lu %.0f%s%s\n", type,
+	    parameters->eventSeq, now, body ? " " : "", body ? body : "");
+    for (int i = 0; i < parameters->numOfReplicas; i++) {
+	ReplicaLink* link = parameters->replicas[i];
+	if (__atomic_load_n(&link->failed, __ATOMIC_ACQUIRE)
+		|| __atomic_load_n(&link->numOfQueued, __ATOMIC_RELAXED)
+		>= MAX_QUEUED_EVENTS) {
+	    // The thread closes the stream once it has this.
+	    queue_event(link, NULL);
+	    parameters->replicas[i--] =
+		    parameters->replicas[--parameters->numOfReplicas];
+	} else {
+	    queue_event(link, strdup(line));
+	}
+    }
+    free(line);
+    free(body);
+}
+
+/* queue_event()
+ * -------------
+ * Adds a record to the queue of records waiting to be written to a replica.
+ *
+ * link: the replica's link.
+ * line: the record, including its newline, which the queue takes over, or
+ * 	NULL to have the replica's thread stop.
+ *
+ * Returns: void
+ */
+void queue_event(ReplicaLink* link, char* line) {
+    ReplicationEvent* event = malloc(sizeof(ReplicationEvent));
+    event->line = line;
+    event->next = NULL;
+    take_lock(&link->queueLock);
+    if (link->tail) {
+	link->tail->next = event;
+    } else {
+	link->head = event;
+    }
+    link->tail = event;
+    link->numOfQueued++;
+    release_lock(&link->queueLock);
+    sem_post(&link->queued);
+}
+
+/* send_snapshot()
+ * ---------------
+ * Sends every open item to a new replica as sell and bid records carrying
+ * 	the current sequence number. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * replica: the output stream of the new replica.
+ *
+ * Returns: void
+ */
+void send_snapshot(ProgramParameters* parameters, FILE* replica) {
+    double now = get_wall_time_ms();
+    for (int i = 0; i < parameters->numOfItems; i++) {
+	ItemList* item = &parameters->items[i];
+	int remaining = (int)(item->expiryTime - clock_ms(parameters));
+	fprintf(replica, "%c %lu %.0f %s %d %d\n", SELL_EVENT,
+		parameters->eventSeq, now, item->item, item->reserve,
+		remaining);
+	if (item->highestBidder) {
+	    fprintf(replica, "%c %lu %.0f %s %d\n", BID_EVENT,
+		    parameters->eventSeq, now, item->item, item->highestBid);
+	}
+	if (item->softWindow) {
+	    fprintf(replica, "%c %lu %.0f %s %d %d %d\n", EXTEND_EVENT,
+		    parameters->eventSeq, now, item->item, remaining,
+		    item->softWindow, item->softExtension);
+	}
+    }
+    fprintf(replica, "%c %lu %.0f\n", HEARTBEAT_EVENT, parameters->eventSeq,
+	    now);
+    fflush(replica);
+}
+
+/* apply_event()
+ * -------------
+ * Applies one sell, bid, extend or close record from the primary to the
+ * 	items. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * line: the record, which is split in place.
+ *
+ * Returns: void
+ */
+void apply_event(ProgramParameters* parameters, char* line) {
+    // Records are "type seq time item ...".
+    char** splitLine = split_by_char(line, ' ', 0);
+    int length = 0;
+    for (int i = 0; splitLine[i] != NULL; i++) {
+	length++;
+    }
+    if (length < 4) {
+	free(splitLine);
+	return;
+    }
+    char* item = splitLine[3];
+    int itemId = find_item_index(parameters, item);
+
+    if (splitLine[0][0] == SELL_EVENT && length == 6 && itemId == -1) {
+	// The seller is a client of the primary, not of this auctioneer.
+	Client seller;
+	memset(&seller, 0, sizeof(Client));
+	seller.id = -1;
+	itemId = add_item(parameters, seller, item, atoi(splitLine[4]),
+		atoi(splitLine[5]));
+	parameters->items[itemId].sellerActive = false;
+    } else if (splitLine[0][0] == BID_EVENT && length == 5 && itemId != -1) {
+	parameters->items[itemId].highestBid = atoi(splitLine[4]);
+	parameters->items[itemId].highestBidder = true;
+	parameters->items[itemId].bidderActive = false;
+	item_changed(parameters, itemId);
+    } else if (splitLine[0][0] == EXTEND_EVENT
+	    && (length == 5 || length == 7) && itemId != -1) {
+	// Extensions carry the time remaining, as sells do, and the first
+	// one the soft close rule.
+	set_expiry(parameters, itemId,
+		clock_ms(parameters) + atoi(splitLine[4]));
+	if (length == 7) {
+	    parameters->items[itemId].softWindow = atoi(splitLine[5]);
+	    parameters->items[itemId].softExtension = atoi(splitLine[6]);
+	}
+	item_changed(parameters, itemId);
+    } else if (splitLine[0][0] == CLOSE_EVENT && itemId != -1) {
+	archive_closed(parameters, itemId);
+	remove_item(parameters, itemId);
+    }
+    free(splitLine);
+}
+
+/* report_lag()
+ * ------------
+ * Replies to a lag command with how far this auctioneer is behind its
+ * 	primary, as ":lag events milliseconds". Events behind counts records
+ * 	received but not applied yet. Milliseconds behind is the age of the
+ * 	oldest such record, or of the last record received if the primary
+ * 	has gone quiet. A primary is never behind.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void report_lag(ProgramParameters* parameters, FILE* output) {
+    if (parameters->role != REPLICA) {
+	fprintf(output, ":lag 0 0\n");
+	return;
+    }
+    ReplicaState* replica = &parameters->replica;
+    take_lock(&replica->queueLock);
+    double now = get_wall_time_ms();
+    unsigned long eventsBehind = replica->receivedSeq - replica->appliedSeq;
+    double msBehind = 0;
+    if (replica->head && replica->head->line) {
+	msBehind = now - replica->head->sentTime;
+    } else if (now - replica->lastReceiveTime > REPLICA_STALE_MS) {
+	msBehind = now - replica->lastSentTime;
+    }
+    release_lock(&replica->queueLock);
+    fprintf(output, ":lag %lu %.0f\n", eventsBehind,
+	    msBehind > 0 ? msBehind : 0);
+}
+
+/* account_memory()
+ * ----------------
+ * Adds to (or, given a negative size, takes from) the memory the auctioneer
+ * 	is using for a kind of thing. Safe to call without the lock.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * kind: what the memory is used for, e.g. MEMORY_NAMES.
+ * bytes: how much more memory is used.
+ *
+ * Returns: void
+ */
+void account_memory(ProgramParameters* parameters, int kind, long bytes) {
+    __atomic_add_fetch(&parameters->memoryUsed[kind], bytes,
+	    __ATOMIC_RELAXED);
+}
+
+/* charge_connection()
+ * -------------------
+ * Charges memory to a client's connection against its allowance.
+ *
+ * charged: the memory charged to the connection so far, or NULL for a
+ * 	client without a connection.
+ * bytes: how much more memory the connection uses.
+ *
+ * Returns: void
+ */
+void charge_connection(long* charged, long bytes) {
+    if (charged) {
+	__atomic_add_fetch(charged, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/* over_allowance()
+ * ----------------
+ * Checks whether a connection may use more memory.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * charged: the memory charged to the connection so far, or NULL for a
+ * 	client without a connection, which has no allowance.
+ * bytes: how much more memory the connection would use.
+ *
+ * Returns: true if that would take the connection past its allowance,
+ * 	false otherwise.
+ */
+bool over_allowance(ProgramParameters* parameters, long* charged,
+	long bytes) {
+    long allowance = parameters->limits.connectionMemory;
+    return charged && allowance
+	    && __atomic_load_n(charged, __ATOMIC_RELAXED) + bytes > allowance;
+}
+
+/* memory_total()
+ * --------------
+ * Adds up the memory the auctioneer is using, as reported by stats. Safe to
+ * 	call without the lock, in which case it is approximate.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: the total in bytes.
+ */
+long memory_total(ProgramParameters* parameters) {
+    long total = (sizeof(ItemList) + sizeof(ExpiryEntry))
+	    * __atomic_load_n(&parameters->itemCapacity, __ATOMIC_RELAXED)
+	    + sizeof(IndexSlot)
+	    * __atomic_load_n(&parameters->indexCapacity, __ATOMIC_RELAXED)
+	    + trace_memory();
+    for (int i = 0; i < NUM_OF_MEMORY_KINDS; i++) {
+	total += __atomic_load_n(&parameters->memoryUsed[i], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/* report_stats()
+ * --------------
+ * Replies to a stats command with the memory in use by category, in bytes,
+ * 	e.g. ":stats connections=.. input=.. sessions=.. items=.. names=..
+ * 	views=.. batches=.. trace=.. total=.. budget=.. throttled=..
+ * 	reaped=.. closes=.. lateavg=.. latemax=..". Connections include their
+ * 	threads' stacks and stream buffers, input is what has been read but
+ * 	not handled, items are the item array, expiry heap and name index,
+ * 	and batches are the bid buffers of items sold by batch clearing.
+ * 	Throttled and reaped count the times connections were held back by
+ * 	the memory budget and hung up on for being idle. Closes counts the
+ * 	auctions closed, and lateavg and latemax how many milliseconds after
+ * 	their expiry times they closed, on average and at most.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void report_stats(ProgramParameters* parameters, FILE* output) {
+    long* used = parameters->memoryUsed;
+    long items = (sizeof(ItemList) + sizeof(ExpiryEntry))
+	    * parameters->itemCapacity
+	    + sizeof(IndexSlot) * parameters->indexCapacity;
+    CloseTiming* timing = &parameters->closeTiming;
+    fprintf(output, ":stats connections=%ld input=%ld sessions=%ld items=%ld "
+	    "names=%ld views=%ld batches=%ld trace=%ld total=%ld budget=%ld "
+	    "throttled=%lu reaped=%lu closes=%lu lateavg=%.1f latemax=%.1f\n",
+	    used[MEMORY_CONNECTIONS],
+	    used[MEMORY_INPUT], used[MEMORY_SESSIONS], items,
+	    used[MEMORY_NAMES], used[MEMORY_VIEWS], used[MEMORY_BATCHES],
+	    trace_memory(), memory_total(parameters),
+	    parameters->limits.memoryBudget,
+	    __atomic_load_n(&parameters->numOfThrottled, __ATOMIC_RELAXED),
+	    __atomic_load_n(&parameters->numOfReaped, __ATOMIC_RELAXED),
+	    timing->numOfCloses, timing->numOfCloses
+	    ? timing->totalLateMs / timing->numOfCloses : 0.0,
+	    timing->maxLateMs);
+}
+
+/* archive_closed()
+ * ----------------
+ * Queues an auction which is closing to be written to the archive, if
+ * 	there is one. Must be called with the lock held, before the item is
+ * 	removed.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ *
+ * Returns: void
+ */
+void archive_closed(ProgramParameters* parameters, int itemIndex) {
+    if (parameters->archive == NULL) {
+	return;
+    }
+    ItemList* item = &parameters->items[itemIndex];
+    ArchiveRecord record = {item->item, item->reserve, item->highestBid,
+	    item->seller.id, item->highestBidder ? item->topBidder.id : -1,
+	    item->openTime, get_wall_time_ms()};
+    archive_append(parameters->archive, &record);
+}
+
+/* report_history()
+ * ----------------
+ * Replies to "history [prefix [since]]" with the archived auctions whose
+ * 	names start with prefix and which closed at or after since, in
+ * 	milliseconds of the wall clock, as ":history name reserve finalBid
+ * 	seller winner openTime closeTime|...". Without a prefix, every
+ * 	archived auction is sent. Auctions are archived a little after they
+ * 	close. Reads the archive, not the items, so needs no lock.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * length: the number of words in the input command from client.
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: void
+ */
+void report_history(ProgramParameters* parameters, int length,
+	char** splitLine, FILE* output) {
+    char* remainderText = "";
+    double since = length == 3 ? strtod(splitLine[2], &remainderText) : 0;
+    flockfile(output);
+    if (length > 3 || strlen(remainderText) != 0 || since < 0) {
+	fprintf(output, ":invalid\n");
+    } else if (parameters->archive == NULL) {
+	fprintf(output, ":rejected\n");
+    } else {
+	fprintf(output, ":history ");
+	archive_query(parameters->archive, length >= 2 ? splitLine[1] : "",
+		since, output);
+	fprintf(output, "\n");
+    }
+    fflush(output);
+    funlockfile(output);
+}
+
+/* open_batch()
+ * ------------
+ * Makes an item just listed one which is sold by clearing, and publishes it
+ * 	to bidders which take no lock. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ * interval: the milliseconds between clearings.
+ *
+ * Returns: void
+ */
+void open_batch(ProgramParameters* parameters, int itemIndex,
+	int interval) {
+    ItemList* item = &parameters->items[itemIndex];
+    BidBatch* batch = batch_create(item->item, interval);
+    batch->nextClear = clock_ms(parameters) + interval;
+    item->batch = batch;
+    BatchTable* old = parameters->batches;
+    __atomic_store_n(&parameters->batches,
+	    batch_table_update(old, batch, NULL), __ATOMIC_SEQ_CST);
+    if (old) {
+	epoch_retire(&parameters->epoch, old, free);
+    }
+    account_memory(parameters, MEMORY_BATCHES, sizeof(BidBatch));
+    charge_connection(item->seller.charged, sizeof(BidBatch));
+}
+
+/* close_batch()
+ * -------------
+ * Stops selling an item by clearing as it closes. The batch is freed once
+ * 	no bidder can be adding to it. Bids which arrive after it was last
+ * 	cleared are dropped. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ *
+ * Returns: void
+ */
+void close_batch(ProgramParameters* parameters, int itemIndex) {
+    ItemList* item = &parameters->items[itemIndex];
+    BidBatch* batch = item->batch;
+    BatchTable* old = parameters->batches;
+    __atomic_store_n(&parameters->batches,
+	    batch_table_update(old, NULL, batch), __ATOMIC_SEQ_CST);
+    epoch_retire(&parameters->epoch, old, free);
+    epoch_retire(&parameters->epoch, batch, batch_destroy);
+    epoch_reclaim(&parameters->epoch);
+    item->batch = NULL;
+    account_memory(parameters, MEMORY_BATCHES, -(long) sizeof(BidBatch));
+    if (item->sellerActive) {
+	charge_connection(item->seller.charged, -(long) sizeof(BidBatch));
+    }
+}
+
+/* batch_bid()
+ * -----------
+ * Adds a bid on an item sold by clearing to its batch without the lock, and
+ * 	replies ":batched item". Other bids, and bids which need checking or
+ * 	do not fit, are left for place_bid() under the lock.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * reader: the calling thread's slot from epoch_register().
+ * clientIndex: the bidder's index in parameters->clients.
+ * command: the command, which is not changed.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: true if the bid was added, false otherwise.
+ */
+bool batch_bid(ProgramParameters* parameters, int reader, int clientIndex,
+	const char* command, FILE* output) {
+    if (strncmp(command, "bid ", strlen("bid ")) != 0) {
+	return false;
+    }
+    const char* item = command + strlen("bid ");
+    const char* amountText = strchr(item, ' ');
+    if (amountText == NULL || amountText == item
+	    || strchr(amountText + 1, ' ')) {
+	return false;
+    }
+    char* remainderText;
+    long amount = strtol(amountText + 1, &remainderText, 10);
+    if (remainderText == amountText + 1 || *remainderText != '\0'
+	    || amount < 1 || amount > INT_MAX) {
+	return false;
+    }
+
+    epoch_enter(&parameters->epoch, reader);
+    BidBatch* batch = batch_table_find(__atomic_load_n(&parameters->batches,
+	    __ATOMIC_SEQ_CST), item, amountText - item);
+    bool added = batch && batch_append(batch, clientIndex, amount);
+    epoch_exit(&parameters->epoch, reader);
+    if (added) {
+	flockfile(output);
+	fprintf(output, ":batched %.*s\n", (int) (amountText - item), item);
+	fflush(output);
+	funlockfile(output);
+    }
+    return added;
+}
+
+/* queue_bid()
+ * -----------
+ * Adds a bid on an item sold by clearing to its batch under the lock,
+ * 	clearing the batch first if it is full. Bids are only checked against
+ * 	the item when cleared.
+ *
+ * splitLine: an array of arrays of the input from client, split by ' '.
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ * clientIndex: the bidder's index in parameters->clients.
+ *
+ * Returns: void
+ */
+void queue_bid(char** splitLine, ProgramParameters* parameters,
+	int itemIndex, int clientIndex) {
+    FILE* outputClient = parameters->clients[clientIndex].output;
+    char* remainderText;
+    int bidAmount = strtol(splitLine[2], &remainderText, 10);
+    if (strlen(remainderText) != 0 || bidAmount < 1) {
+	fprintf(outputClient, ":invalid\n");
+	return;
+    }
+    BidBatch* batch = parameters->items[itemIndex].batch;
+    if (!batch_append(batch, clientIndex, bidAmount)) {
+	clear_batch(parameters, itemIndex);
+	batch_append(batch, clientIndex, bidAmount);
+    }
+    fprintf(outputClient, ":batched %s\n", splitLine[1]);
+}
+
+/* compare_batch_bids()
+ * --------------------
+ * qsort comparison function ordering bids by client.
+ */
+static int compare_batch_bids(const void* first, const void* second) {
+    return ((const BatchBid*) first)->client
+	    - ((const BatchBid*) second)->client;
+}
+
+/* clear_batches()
+ * ---------------
+ * Clears the batch items whose interval is up. Must be called with the lock
+ * 	held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * all: whether to clear every batch item now, whether due or not.
+ *
+ * Returns: void
+ */
+void clear_batches(ProgramParameters* parameters, bool all) {
+    BatchTable* table = parameters->batches;
+    if (table == NULL) {
+	return;
+    }
+    double now = clock_ms(parameters);
+    for (int i = 0; i < table->capacity; i++) {
+	BidBatch* batch = table->slots[i].batch;
+	if (batch && (all || now >= batch->nextClear)) {
+	    batch->nextClear = now + batch->interval;
+	    clear_batch(parameters, find_item_index(parameters, batch->item));
+	}
+    }
+}
+
+/* clear_batch()
+ * -------------
+ * Clears an item's batch of bids in one pass. The highest bid which beats
+ * 	the item's highest bid and reserve wins, the first placed if tied,
+ * 	and its bidder pays it. Bids by the seller or the current top bidder
+ * 	are ignored. Each bidder in the batch is then told the result once:
+ * 	":leading item price" if theirs won, ":outbid item price" if it was
+ * 	the top bidder and was displaced, as if bid on one by one, and
+ * 	":cleared item price" otherwise. Must be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * itemIndex: the index of the item in the item data struct.
+ *
+ * Returns: void
+ */
+void clear_batch(ProgramParameters* parameters, int itemIndex) {
+    ItemList* item = &parameters->items[itemIndex];
+    int numOfBids;
+    BidBuffer* buffer = batch_take(item->batch, &numOfBids);
+    if (numOfBids == 0) {
+	batch_reset(buffer, numOfBids);
+	return;
+    }
+    BatchBid* bids = buffer->bids;
+    int winner = -1;
+    for (int i = 0; i < numOfBids; i++) {
+	Client bidder = parameters->clients[bids[i].client];
+	if (bids[i].amount == 0 || bids[i].amount < item->reserve
+		|| bids[i].amount <= item->highestBid
+		|| (winner != -1 && bids[i].amount <= bids[winner].amount)
+		|| (item->sellerActive && same_client(bidder, item->seller))
+		|| (item->highestBidder && item->bidderActive
+		&& same_client(bidder, item->topBidder))) {
+	    continue;
+	}
+	winner = i;
+    }
+
+    int winningClient = -1;
+    int displacedClient = -1;
+    if (winner != -1) {
+	winningClient = bids[winner].client;
+	// A displaced top bidder is told once, whether it bid this time or
+	// not.
+	Client previous = item->topBidder;
+	if (item->highestBidder && item->bidderActive) {
+	    displacedClient = previous.id;
+	}
+	item->highestBid = bids[winner].amount;
+	item_changed(parameters, itemIndex);
+	item->highestBidder = true;
+	item->topBidder = parameters->clients[winningClient];
+	item->bidderActive = true;
+	publish_event(parameters, BID_EVENT, "%s %d", item->item,
+		item->highestBid);
+	soft_close(parameters, itemIndex);
+	trace_event(TRACE_BID_ACCEPTED, item->highestBid);
+	if (displacedClient != -1) {
+	    fprintf(previous.output, ":outbid %s %d\n", item->item,
+		    item->highestBid);
+	    fflush(previous.output);
+	    trace_event(TRACE_NOTIFY_FLUSHED, previous.session);
+	}
+    }
+
+    qsort(bids, numOfBids, sizeof(BatchBid), compare_batch_bids);
+    for (int i = 0; i < numOfBids; i++) {
+	if (bids[i].amount == 0 || bids[i].client == displacedClient
+		|| (i > 0 && bids[i].client == bids[i - 1].client)) {
+	    continue;
+	}
+	Client bidder = parameters->clients[bids[i].client];
+	fprintf(bidder.output, ":%s %s %d\n", bids[i].client == winningClient
+		? "leading" : "cleared", item->item, item->highestBid);
+	fflush(bidder.output);
+	trace_event(TRACE_NOTIFY_FLUSHED, bidder.session);
+    }
+    batch_reset(buffer, numOfBids);
+}
+
+/* drop_batched_bids()
+ * -------------------
+ * Drops the bids waiting to be cleared from a connection which is leaving,
+ * 	as its clients can no longer be told the result. Bids other threads
+ * 	are still adding are not its own, so are skipped. Must be called
+ * 	with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * tid: the thread serving the connection.
+ *
+ * Returns: void
+ */
+void drop_batched_bids(ProgramParameters* parameters, pthread_t tid) {
+    BatchTable* table = parameters->batches;
+    for (int i = 0; table && i < table->capacity; i++) {
+	BidBatch* batch = table->slots[i].batch;
+	if (batch == NULL) {
+	    continue;
+	}
+	BidBuffer* buffer = &batch->buffers[batch->active];
+	int claimed = __atomic_load_n(&buffer->numOfClaimed, __ATOMIC_ACQUIRE);
+	for (int j = 0; j < claimed && j < BATCH_CAPACITY; j++) {
+	    if (__atomic_load_n(&buffer->bids[j].ready, __ATOMIC_ACQUIRE)
+		    && pthread_equal(parameters->clients[
+		    buffer->bids[j].client].tid, tid)) {
+		buffer->bids[j].amount = 0;
+	    }
+	}
+    }
+}
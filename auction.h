@@ -0,0 +1,374 @@
+/*
+ * auction
+ * The auction itself: items, bids, expiry and the command set, kept apart
+ * 	from sockets and threads so it can be driven directly.
+ * Author: Hamza
+ */
+
+#ifndef AUCTION_H
+#define AUCTION_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "epoch.h"
+#include "archive.h"
+#include "batch.h"
+
+// Replication stream record types.
+#define SELL_EVENT 'S'
+#define BID_EVENT 'B'
+#define CLOSE_EVENT 'C'
+#define EXTEND_EVENT 'X'
+#define HEARTBEAT_EVENT 'H'
+
+// Starting sizes of the items array and of the name index (a power of two).
+#define MIN_ITEM_CAPACITY 16
+#define MIN_INDEX_CAPACITY 32
+
+// Items per chunk of a published view. A change to an item copies only its
+// chunk into the next view.
+#define VIEW_CHUNK_ITEMS 256
+
+// Names of closed items remembered for delta lists. Once full, the older
+// half is forgotten and clients further behind are sent everything.
+#define CLOSED_LOG_SIZE 4096
+
+// Delta lists asked to be compressed are only compressed past this size.
+#define MIN_PACKED_DELTA 1024
+
+// A replica which has heard nothing for this long reports itself as behind.
+#define REPLICA_STALE_MS 300
+
+// A replica with this many records still waiting to be written to it is
+// dropped, as it is not keeping up.
+#define MAX_QUEUED_EVENTS (1 << 20)
+
+// Rough cost of an item beyond its name: its place in the items array and
+// the expiry heap, and the two index slots kept for it at most half full.
+#define ITEM_MEMORY (sizeof(ItemList) + sizeof(ExpiryEntry) \
+	+ 2 * sizeof(IndexSlot))
+
+// What memory is accounted as, in the order stats reports it. Item arrays
+// and the flight recorder are measured when reported instead.
+enum MemoryKind {
+    MEMORY_CONNECTIONS,
+    MEMORY_INPUT,
+    MEMORY_SESSIONS,
+    MEMORY_NAMES,
+    MEMORY_VIEWS,
+    MEMORY_BATCHES,
+    NUM_OF_MEMORY_KINDS
+};
+
+// Outcome of listing one item, in the order of the sellbatch result words.
+enum ListingResult {
+    LISTING_LISTED,
+    LISTING_REJECTED,
+    LISTING_INVALID
+};
+
+// Replication role. A standalone auctioneer is a primary without replicas.
+enum Role {
+    PRIMARY,
+    REPLICA
+};
+
+// A client is identified by the thread serving its connection and, on a
+// multiplexed connection, by its session ID (0 on a plain connection).
+// Memory the client's connection uses is charged to charged, which is NULL
+// for clients without a connection of their own. Its ID is its index in
+// parameters->clients, as in captures, or -1 if it has none.
+typedef struct {
+    pthread_t tid;
+    int session;
+    int id;
+    long* charged;
+    int clientFd;
+    FILE* input;
+    FILE* output;
+} Client;
+
+// A slot of the name index: an item's position in the items array, or -1
+// for an empty slot, and the hash of its name.
+typedef struct {
+    unsigned int hash;
+    int item;
+} IndexSlot;
+
+// An entry of the expiry heap: when an item closes, and its position in the
+// items array. The heap is ordered by expiry time, soonest first.
+typedef struct {
+    double expiryTime;
+    int item;
+} ExpiryEntry;
+
+// An item on sale. Its expiry time is changed through set_expiry(), which
+// keeps its entry in the expiry heap, at expirySlot, in order. A soft close
+// extends the auction by softExtension milliseconds when a bid is accepted
+// in its last softWindow milliseconds; a window of 0 closes it on time.
+typedef struct {
+    Client seller;
+    bool sellerActive;
+    char* item;
+    int reserve;
+    int duration;
+    bool highestBidder;
+    int highestBid;
+    double expiryTime;
+    Client topBidder;
+    bool bidderActive;
+    unsigned long changed;
+    double openTime;
+    BidBatch* batch;
+    int expirySlot;
+    int softWindow;
+    int softExtension;
+} ItemList;
+
+// An event received from the primary which has not been applied yet. A
+// NULL line marks the end of the stream.
+typedef struct ReplicationEvent {
+    char* line;
+    unsigned long seq;
+    double sentTime;
+    struct ReplicationEvent* next;
+} ReplicationEvent;
+
+// What list shows of an item, as copied into a view, and the version of
+// the items it last changed at.
+typedef struct {
+    const char* item;
+    int reserve;
+    int highestBid;
+    double expiryTime;
+    unsigned long changed;
+} ViewItem;
+
+// A run of up to VIEW_CHUNK_ITEMS consecutive items in a view, with their
+// names, in a single allocation. Chunks are immutable, and one whose items
+// have not changed is shared by the next view.
+typedef struct {
+    size_t size;
+    int numOfItems;
+    ViewItem items[];
+} ViewChunk;
+
+// An immutable copy of the items being sold, published for readers which
+// take no lock. Names are copied too, as items may be removed meanwhile.
+typedef struct {
+    unsigned long version;
+    size_t size;
+    int numOfItems;
+    int numOfChunks;
+    ViewChunk* chunks[];
+} ItemView;
+
+// An item which has closed, and the version of the items it closed at.
+typedef struct {
+    char* item;
+    unsigned long version;
+} ClosedItem;
+
+// Items closed recently, oldest first. Clients whose last delta list is
+// older than floor cannot be told everything which has closed since.
+typedef struct {
+    ClosedItem* entries;
+    int numOfEntries;
+    unsigned long floor;
+} ClosedLog;
+
+// Primary side of replication for one replica: the records waiting for the
+// replica's own thread to write them, so that a slow replica holds up no
+// one else. A NULL line tells the thread to close the stream and stop, and
+// failed is set once the stream cannot be written to.
+typedef struct {
+    FILE* stream;
+    sem_t queueLock;
+    sem_t queued;
+    ReplicationEvent* head;
+    ReplicationEvent* tail;
+    int numOfQueued;
+    bool failed;
+} ReplicaLink;
+
+// Replica side of replication: a queue between the thread receiving the
+// primary's stream and the thread applying it, and what is needed to work
+// out how far behind the primary this replica is.
+typedef struct {
+    sem_t queueLock;
+    sem_t queued;
+    ReplicationEvent* head;
+    ReplicationEvent* tail;
+    unsigned long receivedSeq;
+    unsigned long appliedSeq;
+    double lastSentTime;
+    double lastReceiveTime;
+} ReplicaState;
+
+// A client connection and its thread, as the auctioneer defines it.
+struct Connection;
+
+// Hot restart: while a successor takes over, the thread accepting clients
+// and every connection's thread stop reading and wait, either for the
+// process to exit or for the handoff to be abandoned.
+typedef struct {
+    const char* path;
+    int listenFd;
+    bool active;
+    pthread_t acceptorTid;
+    bool acceptorParked;
+    int numOfConnections;
+    struct Connection** connections;
+    sem_t resume;
+} HandoffState;
+
+// How far closes have lagged behind their expiry times, for stats.
+typedef struct {
+    unsigned long numOfCloses;
+    double totalLateMs;
+    double maxLateMs;
+} CloseTiming;
+
+// Limits on what clients may use, from --limits. 0 is unlimited. Lines and
+// names are in bytes, as are the memory allowed for each connection and the
+// memory budget of the whole auctioneer, past which the heaviest
+// connections are not read from until memory is freed.
+typedef struct {
+    long maxLine;
+    long maxName;
+    long connectionMemory;
+    long memoryBudget;
+    long idleMs;
+} Limits;
+
+typedef struct {
+    sem_t* lock;
+    int numConnections;
+    const char* portNumber;
+    bool unixSocket;
+    int socketFd;
+    int numOfItems;
+    int itemCapacity;
+    ItemList* items;
+    ExpiryEntry* expiries;
+    int numOfExpiries;
+    int indexCapacity;
+    IndexSlot* itemIndex;
+    unsigned long itemsVersion;
+    ItemView* view;
+    bool viewWanted;
+    int viewChunkCapacity;
+    bool* viewChunkChanged;
+    int viewMovedFrom;
+    BatchTable* batches;
+    ClosedLog closed;
+    EpochDomain epoch;
+    int numOfClients;
+    int numOfActiveClients;
+    Client* clients;
+    int numOfExited;
+    pthread_t* exitedTids;
+    int role;
+    const char* primaryEndpoint;
+    const char* replicaOf;
+    int replicationFd;
+    int replicaListenFd;
+    int numOfReplicas;
+    ReplicaLink** replicas;
+    unsigned long eventSeq;
+    ReplicaState replica;
+    bool virtualClock;
+    double virtualTime;
+    double startTime;
+    sem_t* timerWake;
+    double timerDeadline;
+    CloseTiming closeTiming;
+    FILE* recording;
+    Archive* archive;
+    HandoffState handoff;
+    Limits limits;
+    long memoryUsed[NUM_OF_MEMORY_KINDS];
+    unsigned long numOfThrottled;
+    unsigned long numOfReaped;
+} ProgramParameters;
+
+void init_lock(sem_t* lock);
+void take_lock(sem_t* lock);
+void release_lock(sem_t* lock);
+void take_traced_lock(sem_t* lock);
+void release_traced_lock(sem_t* lock);
+double clock_ms(ProgramParameters* parameters);
+void expire_items(ProgramParameters* parameters);
+double next_expiry(ProgramParameters* parameters);
+void set_expiry(ProgramParameters* parameters, int itemIndex,
+	double expiryTime);
+void soft_close(ProgramParameters* parameters, int itemIndex);
+void wait_timer(sem_t* wake, double waitMs);
+void advance_clock(char** splitLine, ProgramParameters* parameters,
+	FILE* output);
+void check_input(int length, char** splitLine, ProgramParameters* parameters,
+	FILE* output, int clientIndex);
+void check_sell(char** splitLine, ProgramParameters* parameters,
+	Client client);
+bool same_client(Client first, Client second);
+bool validate_bid_input(char** splitLine, ProgramParameters* parameters,
+	Client client);
+int find_item(char** splitLine, ProgramParameters* parameters,
+	FILE* outputClient);
+void list_all_items(ProgramParameters* parameters, FILE* outputClient);
+void place_bid(char** splitLine, ProgramParameters* parameters,
+	Client client);
+void remove_item(ProgramParameters* parameters, int itemIndex);
+int add_item(ProgramParameters* parameters, Client seller, const char* item,
+	int reserve, int duration);
+int find_item_index(ProgramParameters* parameters, const char* item);
+void open_batch(ProgramParameters* parameters, int itemIndex,
+	int interval);
+bool batch_bid(ProgramParameters* parameters, int reader, int clientIndex,
+	const char* command, FILE* output);
+void queue_bid(char** splitLine, ProgramParameters* parameters,
+	int itemIndex, int clientIndex);
+void clear_batches(ProgramParameters* parameters, bool all);
+void clear_batch(ProgramParameters* parameters, int itemIndex);
+void drop_batched_bids(ProgramParameters* parameters, pthread_t tid);
+void close_batch(ProgramParameters* parameters, int itemIndex);
+void sell_batch(int length, char** splitLine, ProgramParameters* parameters,
+	Client client);
+int list_item(ProgramParameters* parameters, Client seller, const char* item,
+	const char* reserveText, const char* durationText);
+IndexSlot* index_slot(ProgramParameters* parameters, const char* item);
+void index_insert(ProgramParameters* parameters, int itemIndex);
+void index_remove(ProgramParameters* parameters, const char* item);
+void reserve_items(ProgramParameters* parameters, int numOfItems);
+void items_changed(ProgramParameters* parameters);
+void item_changed(ProgramParameters* parameters, int itemIndex);
+void log_closed(ProgramParameters* parameters, char* item);
+ItemView* publish_view(ProgramParameters* parameters);
+void refresh_view(ProgramParameters* parameters);
+void list_view(ProgramParameters* parameters, int reader, FILE* outputClient);
+void list_delta(ProgramParameters* parameters, int reader, int length,
+	char** splitLine, FILE* outputClient);
+unsigned long delta_base(ProgramParameters* parameters, ItemView* view,
+	unsigned long since, FILE* payload);
+void send_delta(FILE* outputClient, unsigned long version,
+	unsigned long base, const char* payload, size_t length, bool pack);
+double get_wall_time_ms(void);
+void publish_event(ProgramParameters* parameters, char type,
+	const char* format, ...);
+void queue_event(ReplicaLink* link, char* line);
+void send_snapshot(ProgramParameters* parameters, FILE* replica);
+void apply_event(ProgramParameters* parameters, char* line);
+void report_lag(ProgramParameters* parameters, FILE* output);
+void archive_closed(ProgramParameters* parameters, int itemIndex);
+void report_history(ProgramParameters* parameters, int length,
+	char** splitLine, FILE* output);
+void account_memory(ProgramParameters* parameters, int kind, long bytes);
+void charge_connection(long* charged, long bytes);
+bool over_allowance(ProgramParameters* parameters, long* charged,
+	long bytes);
+long memory_total(ProgramParameters* parameters);
+void report_stats(ProgramParameters* parameters, FILE* output);
+
+#endif
@@ -0,0 +1,1015 @@
+/*
+ * auctionbench
+ * Microbenchmarks for the auction data path, driving auction.c directly
+ * 	with in-memory output streams. Prints one JSON object per operation
+ * 	and catalog size so runs can be diffed between commits, then measures
+ * 	bids against concurrent list readers and bids on one hot item, placed
+ * 	one by one or cleared in batches, and bids extending soft close
+ * 	auctions picked across the whole expiry heap. Where perf counters
+ * 	can be read, each operation also reports its dTLB misses and loads
+ * 	served by another NUMA node, so runs with and without --placement
+ * 	can be compared.
+ * Author: Hamza
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "auction.h"
+#include "trace.h"
+#include "placement.h"
+
+// Catalog sizes run from MIN_ITEMS up to the limit by factors of ten.
+#define MIN_ITEMS 10
+#define DEFAULT_MAX_ITEMS 10000000
+
+// Each measurement runs for at least this long, within an iteration cap.
+#define MIN_BENCH_NS 50000000.0
+#define MAX_ITERATIONS 1000000
+
+// Listings per sellbatch command.
+#define BATCH_SIZE 1000
+
+// Bids are measured against up to this many concurrent list readers, for
+// catalogs up to CONTENTION_MAX_ITEMS.
+#define MAX_READERS 8
+#define CONTENTION_MAX_ITEMS 100000
+
+// Bids on one hot item are measured from up to this many bidder threads for
+// HOT_BENCH_NS each, with the item either bid on one by one or cleared
+// every HOT_CLEAR_MS.
+#define MAX_BIDDERS 8
+#define HOT_BENCH_NS 200000000.0
+#define HOT_CLEAR_MS 10
+
+// Soft close auctions are stressed with up to SOFT_MAX_ITEMS items, each
+// closing within SOFT_EXTENSION_MS unless bid on, for SOFT_BENCH_MS while
+// SOFT_BIDDERS threads bid on items at random across the whole heap. Every
+// item is always within its window, so every accepted bid extends it.
+#define SOFT_MAX_ITEMS 100000
+#define SOFT_BENCH_MS 1000
+#define SOFT_WINDOW_MS 1000
+#define SOFT_EXTENSION_MS 1000
+#define SOFT_BIDDERS 4
+
+// Long enough that nothing expires while benchmarking.
+#define BENCH_DURATION 600000
+#define MAX_NAME 32
+
+#define PLACEMENT "--placement"
+#define USAGE_ERR_MSG "Usage: auctionbench [--placement spec] [max-items]\n"
+
+enum ExitStatus {
+    USAGE_ERR = 2
+};
+
+// Hardware events counted for each operation, if perf counters are there.
+enum Counter {
+    COUNTER_DTLB_MISSES,
+    COUNTER_REMOTE_LOADS,
+    NUM_OF_COUNTERS
+};
+
+// Timing and allocation totals for one measurement, and event totals if
+// counting.
+typedef struct {
+    double startNs;
+    double totalNs;
+    unsigned long startAllocs;
+    unsigned long totalAllocs;
+    bool counting;
+    unsigned long startEvents[NUM_OF_COUNTERS];
+    unsigned long totalEvents[NUM_OF_COUNTERS];
+} Measurement;
+
+// Everything an operation needs: the item store, a seller and two bidders
+// writing to a discarding stream, and a random number state.
+typedef struct {
+    ProgramParameters* parameters;
+    Client seller;
+    Client bidders[2];
+    unsigned int seed;
+    long nextName;
+} BenchState;
+
+typedef struct {
+    const char* name;
+    void (*run)(BenchState* state, long iterations, Measurement* m);
+} BenchOp;
+
+// A thread listing the catalog over and over while bids are measured, either
+// under the lock or from the published view.
+typedef struct {
+    ProgramParameters* parameters;
+    bool lockFree;
+    int stop;
+    long numOfLists;
+    FILE* output;
+    pthread_t tid;
+} Reader;
+
+// Function prototypes
+void* malloc(size_t size);
+void* calloc(size_t count, size_t size);
+void* realloc(void* pointer, size_t size);
+void free(void* pointer);
+FILE* open_sink(void);
+double now_ns(void);
+void open_counters(void);
+unsigned long read_counter(int counter);
+void format_counter(char* text, size_t size, const Measurement* m,
+	int counter, long iterations);
+void start_measure(Measurement* m);
+void stop_measure(Measurement* m);
+void init_state(BenchState* state);
+void fill_items(BenchState* state, int numOfItems);
+int random_item(BenchState* state);
+void bench_find_item(BenchState* state, long iterations, Measurement* m);
+void bench_check_sell(BenchState* state, long iterations, Measurement* m);
+void bench_sell_batch(BenchState* state, long iterations, Measurement* m);
+void bench_place_bid(BenchState* state, long iterations, Measurement* m);
+void place_random_bid(BenchState* state);
+void bench_remove_item(BenchState* state, long iterations, Measurement* m);
+void bench_list_all_items(BenchState* state, long iterations,
+	Measurement* m);
+void bench_expire_items(BenchState* state, long iterations, Measurement* m);
+void bench_set_expiry(BenchState* state, long iterations, Measurement* m);
+void bench_trace_event(BenchState* state, long iterations, Measurement* m);
+void run_bench(BenchState* state, const BenchOp* op);
+void bench_contention(BenchState* state, bool lockFree, int numOfReaders);
+void* run_reader(void* reader);
+void bench_hot_item(BenchState* state, bool batched, int numOfBidders);
+void* run_bidder(void* bidder);
+void bench_soft_close(BenchState* state, int numOfItems);
+void* run_sniper(void* sniper);
+
+// glibc's own allocator, which the wrappers below count calls to.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void __libc_free(void* pointer);
+
+static unsigned long numOfAllocs = 0;
+
+// perf_event_open() descriptors of the main thread's counters, -1 for any
+// this machine or its permissions do not allow.
+static int counterFds[NUM_OF_COUNTERS] = {-1, -1};
+static const char* counterNames[NUM_OF_COUNTERS] = {
+    "dtlb_misses_per_op", "remote_loads_per_op"};
+static const char* placementSpec = "off";
+
+/* malloc(), calloc(), realloc(), free()
+ * -------------------------------------
+ * Replace the C library's allocator entry points for this program so that
+ * 	every allocation, including those inside strdup() and stdio, is
+ * 	counted.
+ */
+void* malloc(size_t size) {
+    __atomic_add_fetch(&numOfAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&numOfAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    __atomic_add_fetch(&numOfAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+
+// A thread bidding on the hot item as fast as it can, as its own client,
+// until stopped.
+typedef struct {
+    ProgramParameters* parameters;
+    bool batched;
+    int client;
+    int stop;
+    long numOfBids;
+    FILE* output;
+    pthread_t tid;
+} Bidder;
+
+// A thread bidding on soft close items at random until deadline, each bid
+// extending the item, and adding up the heap sizes it bid at.
+typedef struct {
+    ProgramParameters* parameters;
+    int client;
+    double deadline;
+    long numOfBids;
+    long numOfExtensions;
+    double heapSizes;
+    double bidNs;
+    pthread_t tid;
+} Sniper;
+
+static const BenchOp benchOps[] = {
+    {"find_item", bench_find_item},
+    {"check_sell", bench_check_sell},
+    {"sell_batch_1000", bench_sell_batch},
+    {"place_bid", bench_place_bid},
+    {"remove_item", bench_remove_item},
+    {"list_all_items", bench_list_all_items},
+    {"check_time_sweep", bench_expire_items},
+    {"set_expiry", bench_set_expiry},
+    {"trace_event", bench_trace_event}
+};
+
+int main(int argc, char** argv) {
+    long maxItems = DEFAULT_MAX_ITEMS;
+    if (argc > 1 && strcmp(argv[1], PLACEMENT) == 0) {
+	if (argc < 3 || !placement_init(argv[2])) {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+	placementSpec = argv[2];
+	placement_pin_service();
+	argc -= 2;
+	argv += 2;
+    }
+    if (argc > 2) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    if (argc == 2) {
+	char* remainderText;
+	maxItems = strtol(argv[1], &remainderText, 10);
+	if (strlen(remainderText) != 0 || maxItems < MIN_ITEMS) {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+    }
+
+    open_counters();
+    BenchState state;
+    init_state(&state);
+    for (long numOfItems = MIN_ITEMS; numOfItems <= maxItems;
+	    numOfItems *= 10) {
+	fill_items(&state, numOfItems);
+	for (int i = 0; i < sizeof(benchOps) / sizeof(BenchOp); i++) {
+	    run_bench(&state, &benchOps[i]);
+	}
+	if (numOfItems > CONTENTION_MAX_ITEMS) {
+	    continue;
+	}
+	for (int lockFree = 0; lockFree < 2; lockFree++) {
+	    for (int readers = 0; readers <= MAX_READERS;
+		    readers = readers ? readers * 2 : 1) {
+		bench_contention(&state, lockFree, readers);
+	    }
+	}
+    }
+    for (int batched = 0; batched < 2; batched++) {
+	for (int bidders = 1; bidders <= MAX_BIDDERS; bidders *= 2) {
+	    bench_hot_item(&state, batched, bidders);
+	}
+    }
+    for (int numOfItems = SOFT_MAX_ITEMS / 100; numOfItems <= SOFT_MAX_ITEMS;
+	    numOfItems *= 10) {
+	bench_soft_close(&state, numOfItems);
+    }
+    return 0;
+}
+
+/* bench_contention()
+ * ------------------
+ * Measures bids, each taken under the lock as the auctioneer does, while
+ * 	other threads list the catalog. Lists either hold the lock throughout
+ * 	or read the published view, which a bid publishes for the next list
+ * 	as the auctioneer's commands do. Prints the result as a line of JSON.
+ *
+ * state: the benchmark state.
+ * lockFree: whether the readers use the published view.
+ * numOfReaders: the number of list threads.
+ *
+ * Returns: void
+ */
+void bench_contention(BenchState* state, bool lockFree, int numOfReaders) {
+    ProgramParameters* parameters = state->parameters;
+    Reader readers[MAX_READERS];
+    for (int i = 0; i < numOfReaders; i++) {
+	readers[i].parameters = parameters;
+	readers[i].lockFree = lockFree;
+	readers[i].stop = 0;
+	readers[i].numOfLists = 0;
+	readers[i].output = open_sink();
+	pthread_create(&readers[i].tid, NULL, run_reader, &readers[i]);
+    }
+
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    long iterations = 0;
+    // Waiting for the lock counts towards each bid.
+    while (m.totalNs < MIN_BENCH_NS && iterations < MAX_ITERATIONS) {
+	start_measure(&m);
+	take_traced_lock(parameters->lock);
+	place_random_bid(state);
+	refresh_view(parameters);
+	release_traced_lock(parameters->lock);
+	stop_measure(&m);
+	iterations++;
+    }
+
+    long numOfLists = 0;
+    for (int i = 0; i < numOfReaders; i++) {
+	__atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELAXED);
+	pthread_join(readers[i].tid, NULL);
+	numOfLists += readers[i].numOfLists;
+	fclose(readers[i].output);
+    }
+    printf("{\"op\":\"place_bid_with_readers\",\"items\":%d,"
+	    "\"readers\":%d,\"list\":\"%s\",\"iterations\":%ld,"
+	    "\"ns_per_op\":%.1f,\"lists\":%ld}\n", parameters->numOfItems,
+	    numOfReaders, lockFree ? "epoch" : "locked", iterations,
+	    m.totalNs / iterations, numOfLists);
+    fflush(stdout);
+}
+
+/* bench_hot_item()
+ * ----------------
+ * Measures how many bids a hot item takes from a number of bidders. Bid on
+ * 	one by one, every bid takes the lock and outbids someone. Cleared in
+ * 	batches, bids are added without the lock and the main thread clears
+ * 	them every HOT_CLEAR_MS under it. Prints the result as a line of JSON.
+ *
+ * state: the benchmark state.
+ * batched: whether the item is sold by clearing.
+ * numOfBidders: the number of bidder threads.
+ *
+ * Returns: void
+ */
+void bench_hot_item(BenchState* state, bool batched, int numOfBidders) {
+    ProgramParameters* parameters = state->parameters;
+    take_traced_lock(parameters->lock);
+    int itemIndex = add_item(parameters, state->seller, "hot", 1,
+	    BENCH_DURATION);
+    if (batched) {
+	open_batch(parameters, itemIndex, HOT_CLEAR_MS);
+    }
+    release_traced_lock(parameters->lock);
+
+    Bidder bidders[MAX_BIDDERS];
+    for (int i = 0; i < numOfBidders; i++) {
+	bidders[i].parameters = parameters;
+	bidders[i].batched = batched;
+	bidders[i].client = i;
+	bidders[i].stop = 0;
+	bidders[i].numOfBids = 0;
+	bidders[i].output = open_sink();
+	pthread_create(&bidders[i].tid, NULL, run_bidder, &bidders[i]);
+    }
+    double start = now_ns();
+    long numOfClearings = 0;
+    while (now_ns() - start < HOT_BENCH_NS) {
+	usleep(HOT_CLEAR_MS * 1000);
+	if (batched) {
+	    take_traced_lock(parameters->lock);
+	    clear_batches(parameters, true);
+	    release_traced_lock(parameters->lock);
+	    numOfClearings++;
+	}
+    }
+    long numOfBids = 0;
+    for (int i = 0; i < numOfBidders; i++) {
+	__atomic_store_n(&bidders[i].stop, 1, __ATOMIC_RELAXED);
+	pthread_join(bidders[i].tid, NULL);
+	numOfBids += bidders[i].numOfBids;
+	fclose(bidders[i].output);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    take_traced_lock(parameters->lock);
+    remove_item(parameters, find_item_index(parameters, "hot"));
+    release_traced_lock(parameters->lock);
+    printf("{\"op\":\"hot_item_bids\",\"mode\":\"%s\",\"bidders\":%d,"
+	    "\"bids\":%ld,\"bids_per_sec\":%.0f,\"clearings\":%ld}\n",
+	    batched ? "batch" : "continuous", numOfBidders, numOfBids,
+	    numOfBids / seconds, numOfClearings);
+    fflush(stdout);
+}
+
+/* run_bidder()
+ * ------------
+ * A function for each bidder thread, which bids on the hot item, higher
+ * 	each time, until stopped. Bids go through the same paths as a
+ * 	client's: without the lock for a batch item if there is room, and
+ * 	under it otherwise.
+ *
+ * bidder: a null pointer to the bidder.
+ *
+ * Returns: empty null pointer
+ */
+void* run_bidder(void* arg) {
+    Bidder* bidder = (Bidder*) arg;
+    ProgramParameters* parameters = bidder->parameters;
+    int slot = epoch_register(&parameters->epoch);
+    char command[MAX_NAME];
+    char amount[MAX_NAME];
+    char* splitLine[] = {"bid", "hot", amount, NULL};
+    while (!__atomic_load_n(&bidder->stop, __ATOMIC_RELAXED)) {
+	int bid = bidder->numOfBids * MAX_BIDDERS + bidder->client + 1;
+	snprintf(command, sizeof(command), "bid hot %d", bid);
+	if (!bidder->batched || !batch_bid(parameters, slot, bidder->client,
+		command, bidder->output)) {
+	    snprintf(amount, sizeof(amount), "%d", bid);
+	    take_traced_lock(parameters->lock);
+	    place_bid(splitLine, parameters,
+		    parameters->clients[bidder->client]);
+	    release_traced_lock(parameters->lock);
+	}
+	bidder->numOfBids++;
+    }
+    epoch_unregister(&parameters->epoch, slot);
+    return NULL;
+}
+
+/* bench_soft_close()
+ * ------------------
+ * Stresses the expiry heap with soft close auctions on the real clock. The
+ * 	items close at random within SOFT_EXTENSION_MS, and for SOFT_BENCH_MS
+ * 	bidder threads bid on items anywhere in the heap, each bid extending
+ * 	one and moving it from wherever it was to the bottom of the heap.
+ * 	Items not bid on in time close meanwhile, and the rest once bidding
+ * 	stops. The main thread closes auctions as the timer thread does,
+ * 	sleeping until the next one is due. Prints the cost of each bid, the
+ * 	average heap size bids were placed at, the cost of each close and how
+ * 	late the closes were, as a line of JSON.
+ *
+ * state: the benchmark state, whose seller and hot item bidders are used.
+ * numOfItems: the number of items.
+ *
+ * Returns: void
+ */
+void bench_soft_close(BenchState* state, int numOfItems) {
+    ProgramParameters* parameters = calloc(1, sizeof(ProgramParameters));
+    parameters->role = PRIMARY;
+    parameters->lock = malloc(sizeof(sem_t));
+    init_lock(parameters->lock);
+    epoch_init(&parameters->epoch);
+    parameters->numOfClients = state->parameters->numOfClients;
+    parameters->clients = state->parameters->clients;
+    sem_t timerWake;
+    sem_init(&timerWake, 0, 0);
+    parameters->timerWake = &timerWake;
+
+    char name[MAX_NAME];
+    take_traced_lock(parameters->lock);
+    reserve_items(parameters, numOfItems);
+    for (int i = 0; i < numOfItems; i++) {
+	snprintf(name, sizeof(name), "soft%d", i);
+	int itemIndex = add_item(parameters, state->seller, name, 1,
+		1 + rand_r(&state->seed) % SOFT_EXTENSION_MS);
+	parameters->items[itemIndex].softWindow = SOFT_WINDOW_MS;
+	parameters->items[itemIndex].softExtension = SOFT_EXTENSION_MS;
+    }
+    release_traced_lock(parameters->lock);
+
+    Sniper snipers[SOFT_BIDDERS];
+    double start = now_ns();
+    for (int i = 0; i < SOFT_BIDDERS; i++) {
+	memset(&snipers[i], 0, sizeof(Sniper));
+	snipers[i].parameters = parameters;
+	snipers[i].client = i;
+	snipers[i].deadline = start + SOFT_BENCH_MS * 1e6;
+	pthread_create(&snipers[i].tid, NULL, run_sniper, &snipers[i]);
+    }
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    while (1) {
+	take_traced_lock(parameters->lock);
+	start_measure(&m);
+	expire_items(parameters);
+	stop_measure(&m);
+	double now = clock_ms(parameters);
+	double expiry = next_expiry(parameters);
+	parameters->timerDeadline = expiry;
+	release_traced_lock(parameters->lock);
+	if (expiry == -1) {
+	    break;
+	}
+	wait_timer(&timerWake, expiry - now);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    long numOfBids = 0;
+    long numOfExtensions = 0;
+    double heapSizes = 0;
+    double bidNs = 0;
+    for (int i = 0; i < SOFT_BIDDERS; i++) {
+	pthread_join(snipers[i].tid, NULL);
+	numOfBids += snipers[i].numOfBids;
+	numOfExtensions += snipers[i].numOfExtensions;
+	heapSizes += snipers[i].heapSizes;
+	bidNs += snipers[i].bidNs;
+    }
+    CloseTiming* timing = &parameters->closeTiming;
+    printf("{\"op\":\"soft_close_stress\",\"items\":%d,\"bidders\":%d,"
+	    "\"bids\":%ld,\"extensions\":%ld,\"heap_avg\":%.0f,"
+	    "\"ns_per_bid\":%.1f,\"ns_per_close\":%.1f,\"closes\":%lu,"
+	    "\"late_avg_ms\":%.3f,\"late_max_ms\":%.3f,\"seconds\":%.2f}\n",
+	    numOfItems, SOFT_BIDDERS, numOfBids, numOfExtensions,
+	    numOfBids ? heapSizes / numOfBids : 0.0,
+	    numOfBids ? bidNs / numOfBids : 0.0,
+	    timing->numOfCloses ? m.totalNs / timing->numOfCloses : 0.0,
+	    timing->numOfCloses, timing->numOfCloses
+	    ? timing->totalLateMs / timing->numOfCloses : 0.0,
+	    timing->maxLateMs, seconds);
+    fflush(stdout);
+    sem_destroy(&timerWake);
+}
+
+/* run_sniper()
+ * ------------
+ * A function for each soft close bidder thread, which outbids items
+ * 	picked at random from the whole heap until its deadline, or until
+ * 	every item has closed. Only place_bid(), which extends the item, is
+ * 	measured.
+ *
+ * sniper: a null pointer to the bidder.
+ *
+ * Returns: empty null pointer
+ */
+void* run_sniper(void* arg) {
+    Sniper* sniper = (Sniper*) arg;
+    ProgramParameters* parameters = sniper->parameters;
+    Client client = parameters->clients[sniper->client];
+    unsigned int seed = sniper->client + 1;
+    char amount[MAX_NAME];
+    char* splitLine[] = {"bid", NULL, amount, NULL};
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    while (now_ns() < sniper->deadline) {
+	take_traced_lock(parameters->lock);
+	int numOfItems = parameters->numOfItems;
+	if (numOfItems == 0) {
+	    release_traced_lock(parameters->lock);
+	    break;
+	}
+	ItemList* item = &parameters->items[parameters->expiries[
+		rand_r(&seed) % numOfItems].item];
+	// Items this bidder leads are left for the others to outbid.
+	if (!(item->highestBidder && same_client(item->topBidder, client))) {
+	    double expiryTime = item->expiryTime;
+	    splitLine[1] = item->item;
+	    snprintf(amount, sizeof(amount), "%d", item->highestBid + 1);
+	    start_measure(&m);
+	    place_bid(splitLine, parameters, client);
+	    stop_measure(&m);
+	    sniper->numOfBids++;
+	    sniper->numOfExtensions += item->expiryTime != expiryTime;
+	    sniper->heapSizes += numOfItems;
+	}
+	release_traced_lock(parameters->lock);
+    }
+    sniper->bidNs = m.totalNs;
+    return NULL;
+}
+
+/* run_reader()
+ * ------------
+ * A function for each list thread, which lists the catalog until stopped.
+ *
+ * reader: a null pointer to the reader.
+ *
+ * Returns: empty null pointer
+ */
+void* run_reader(void* arg) {
+    Reader* reader = (Reader*) arg;
+    ProgramParameters* parameters = reader->parameters;
+    int slot = epoch_register(&parameters->epoch);
+    while (!__atomic_load_n(&reader->stop, __ATOMIC_RELAXED)) {
+	if (reader->lockFree) {
+	    list_view(parameters, slot, reader->output);
+	} else {
+	    take_traced_lock(parameters->lock);
+	    list_all_items(parameters, reader->output);
+	    fflush(reader->output);
+	    release_traced_lock(parameters->lock);
+	}
+	reader->numOfLists++;
+    }
+    epoch_unregister(&parameters->epoch, slot);
+    return NULL;
+}
+
+/* run_bench()
+ * -----------
+ * Runs an operation against the current catalog until enough time has been
+ * 	measured, then prints the result as a line of JSON.
+ *
+ * state: the benchmark state.
+ * op: the operation to measure.
+ *
+ * Returns: void
+ */
+void run_bench(BenchState* state, const BenchOp* op) {
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    m.counting = true;
+    long iterations = 0;
+    long batch = 1;
+    while (m.totalNs < MIN_BENCH_NS && iterations < MAX_ITERATIONS) {
+	if (batch > MAX_ITERATIONS - iterations) {
+	    batch = MAX_ITERATIONS - iterations;
+	}
+	op->run(state, batch, &m);
+	iterations += batch;
+	batch *= 2;
+    }
+    char counters[NUM_OF_COUNTERS][64];
+    for (int i = 0; i < NUM_OF_COUNTERS; i++) {
+	format_counter(counters[i], sizeof(counters[i]), &m, i, iterations);
+    }
+    printf("{\"op\":\"%s\",\"items\":%d,\"iterations\":%ld,"
+	    "\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,%s,%s,"
+	    "\"placement\":\"%s\"}\n", op->name,
+	    state->parameters->numOfItems, iterations, m.totalNs / iterations,
+	    (double) m.totalAllocs / iterations, counters[0], counters[1],
+	    placementSpec);
+    fflush(stdout);
+}
+
+/* sink_write()
+ * ------------
+ * fopencookie write function which throws output away.
+ */
+static ssize_t sink_write(void* cookie, const char* buf, size_t size) {
+    return size;
+}
+
+/* open_sink()
+ * -----------
+ * Opens an in-memory stream for clients to write replies to. Output is
+ * 	discarded, so a large list costs its formatting but no memory.
+ *
+ * Returns: the stream.
+ */
+FILE* open_sink(void) {
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.write = sink_write;
+    return fopencookie(NULL, "w", functions);
+}
+
+/* now_ns()
+ * --------
+ * Gets a monotonic time for measuring.
+ *
+ * Returns: the time in nanoseconds.
+ */
+double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* start_measure()
+ * ---------------
+ * Starts timing and counting allocations for a measured section.
+ *
+ * m: the measurement to add to.
+ *
+ * Returns: void
+ */
+void start_measure(Measurement* m) {
+    for (int i = 0; m->counting && i < NUM_OF_COUNTERS; i++) {
+	m->startEvents[i] = read_counter(i);
+    }
+    m->startAllocs = numOfAllocs;
+    m->startNs = now_ns();
+}
+
+/* stop_measure()
+ * --------------
+ * Ends a measured section, adding its time and allocations to the totals.
+ *
+ * m: the measurement to add to.
+ *
+ * Returns: void
+ */
+void stop_measure(Measurement* m) {
+    m->totalNs += now_ns() - m->startNs;
+    m->totalAllocs += numOfAllocs - m->startAllocs;
+    for (int i = 0; m->counting && i < NUM_OF_COUNTERS; i++) {
+	m->totalEvents[i] += read_counter(i) - m->startEvents[i];
+    }
+}
+
+/* open_counters()
+ * ---------------
+ * Opens the hardware counters for the calling thread: dTLB load misses, and
+ * 	loads which missed the caches and were served by another NUMA node.
+ * 	Kernel events are left out. Counters which cannot be opened, as in
+ * 	most virtual machines or with a strict perf_event_paranoid, are
+ * 	reported as null.
+ *
+ * Returns: void
+ */
+void open_counters(void) {
+    unsigned long configs[NUM_OF_COUNTERS] = {
+	PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    for (int i = 0; i < NUM_OF_COUNTERS; i++) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = configs[i];
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counterFds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+/* read_counter()
+ * --------------
+ * Reads one of the counters opened by open_counters().
+ *
+ * counter: the counter.
+ *
+ * Returns: the events counted so far, or 0 if the counter is not open.
+ */
+unsigned long read_counter(int counter) {
+    unsigned long count = 0;
+    if (counterFds[counter] == -1
+	    || read(counterFds[counter], &count, sizeof(count))
+	    != sizeof(count)) {
+	return 0;
+    }
+    return count;
+}
+
+/* format_counter()
+ * ----------------
+ * Formats a counter's events per operation as a JSON member.
+ *
+ * text: where the member is written.
+ * size: the room in text.
+ * m: the measurement counted.
+ * counter: the counter.
+ * iterations: the number of operations measured.
+ *
+ * Returns: void
+ */
+void format_counter(char* text, size_t size, const Measurement* m,
+	int counter, long iterations) {
+    if (counterFds[counter] == -1) {
+	snprintf(text, size, "\"%s\":null", counterNames[counter]);
+    } else {
+	snprintf(text, size, "\"%s\":%.3f", counterNames[counter],
+		(double) m->totalEvents[counter] / iterations);
+    }
+}
+
+/* init_state()
+ * ------------
+ * Sets up an empty item store on a virtual clock, with a seller, two
+ * 	bidders and the hot item's bidders. Nothing in here uses sockets.
+ *
+ * state: the benchmark state to set up.
+ *
+ * Returns: void
+ */
+void init_state(BenchState* state) {
+    ProgramParameters* parameters = calloc(1, sizeof(ProgramParameters));
+    parameters->role = PRIMARY;
+    parameters->virtualClock = true;
+    parameters->items = NULL;
+    parameters->lock = malloc(sizeof(sem_t));
+    init_lock(parameters->lock);
+    epoch_init(&parameters->epoch);
+    state->parameters = parameters;
+
+    Client* clients[3] = {&state->seller, &state->bidders[0],
+	    &state->bidders[1]};
+    for (int i = 0; i < 3; i++) {
+	memset(clients[i], 0, sizeof(Client));
+	clients[i]->tid = (pthread_t) (i + 1);
+	clients[i]->output = open_sink();
+    }
+    state->seed = 1;
+    state->nextName = 0;
+
+    // Hot item bidders are clients by index, as connections are.
+    parameters->numOfClients = MAX_BIDDERS;
+    parameters->clients = calloc(MAX_BIDDERS, sizeof(Client));
+    for (int i = 0; i < MAX_BIDDERS; i++) {
+	parameters->clients[i].tid = (pthread_t) (i + 4);
+	parameters->clients[i].id = i;
+	parameters->clients[i].output = open_sink();
+    }
+}
+
+/* fill_items()
+ * ------------
+ * Grows the catalog to the given size without the duplicate check, which
+ * 	would make building large catalogs quadratic.
+ *
+ * state: the benchmark state.
+ * numOfItems: the size to grow to.
+ *
+ * Returns: void
+ */
+void fill_items(BenchState* state, int numOfItems) {
+    char name[MAX_NAME];
+    while (state->parameters->numOfItems < numOfItems) {
+	snprintf(name, sizeof(name), "item%ld", state->nextName++);
+	add_item(state->parameters, state->seller, name, 1, BENCH_DURATION);
+    }
+}
+
+/* random_item()
+ * -------------
+ * Picks an item uniformly at random.
+ *
+ * state: the benchmark state.
+ *
+ * Returns: the index of the item.
+ */
+int random_item(BenchState* state) {
+    return rand_r(&state->seed) % state->parameters->numOfItems;
+}
+
+/* bench_find_item()
+ * -----------------
+ * Looks up random items by name.
+ */
+void bench_find_item(BenchState* state, long iterations, Measurement* m) {
+    char* splitLine[] = {"bid", NULL, "1", NULL};
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	splitLine[1] = state->parameters->items[random_item(state)].item;
+	find_item(splitLine, state->parameters, state->seller.output);
+    }
+    stop_measure(m);
+}
+
+/* bench_trace_event()
+ * -------------------
+ * Records flight recorder events, as every command and lock does.
+ */
+void bench_trace_event(BenchState* state, long iterations, Measurement* m) {
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	trace_event(TRACE_BID_ACCEPTED, i);
+    }
+    stop_measure(m);
+}
+
+/* bench_check_sell()
+ * ------------------
+ * Sells new items one at a time, removing each again outside the
+ * 	measurement so the catalog size stays fixed.
+ */
+void bench_check_sell(BenchState* state, long iterations, Measurement* m) {
+    ProgramParameters* parameters = state->parameters;
+    char name[MAX_NAME];
+    char* splitLine[] = {"sell", name, "1", "600000", NULL};
+    for (long i = 0; i < iterations; i++) {
+	snprintf(name, sizeof(name), "new%ld", state->nextName++);
+	start_measure(m);
+	check_sell(splitLine, parameters, state->seller);
+	stop_measure(m);
+	remove_item(parameters, parameters->numOfItems - 1);
+    }
+}
+
+/* bench_sell_batch()
+ * ------------------
+ * Sells BATCH_SIZE new items with one sellbatch command, removing them again
+ * 	outside the measurement so the catalog size stays fixed.
+ */
+void bench_sell_batch(BenchState* state, long iterations, Measurement* m) {
+    ProgramParameters* parameters = state->parameters;
+    int length = 1 + 3 * BATCH_SIZE;
+    char** splitLine = malloc(sizeof(char*) * (length + 1));
+    char (*names)[MAX_NAME] = malloc(MAX_NAME * BATCH_SIZE);
+    splitLine[0] = "sellbatch";
+    splitLine[length] = NULL;
+    for (long i = 0; i < iterations; i++) {
+	for (int j = 0; j < BATCH_SIZE; j++) {
+	    snprintf(names[j], MAX_NAME, "new%ld", state->nextName++);
+	    splitLine[1 + 3 * j] = names[j];
+	    splitLine[2 + 3 * j] = "1";
+	    splitLine[3 + 3 * j] = "600000";
+	}
+	start_measure(m);
+	sell_batch(length, splitLine, parameters, state->seller);
+	stop_measure(m);
+	for (int j = 0; j < BATCH_SIZE; j++) {
+	    remove_item(parameters, parameters->numOfItems - 1);
+	}
+    }
+    free(names);
+    free(splitLine);
+}
+
+/* bench_place_bid()
+ * -----------------
+ * Places winning bids on random items, alternating bidders so that every
+ * 	bid is accepted and outbids someone.
+ */
+void bench_place_bid(BenchState* state, long iterations, Measurement* m) {
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	place_random_bid(state);
+    }
+    stop_measure(m);
+}
+
+/* place_random_bid()
+ * ------------------
+ * Places a winning bid on a random item, from whichever bidder is not
+ * 	already winning it.
+ *
+ * state: the benchmark state.
+ *
+ * Returns: void
+ */
+void place_random_bid(BenchState* state) {
+    char amount[MAX_NAME];
+    char* splitLine[] = {"bid", NULL, amount, NULL};
+    ItemList* item = &state->parameters->items[random_item(state)];
+    Client bidder = state->bidders[0];
+    if (item->highestBidder && item->topBidder.tid == bidder.tid) {
+	bidder = state->bidders[1];
+    }
+    splitLine[1] = item->item;
+    snprintf(amount, sizeof(amount), "%d", item->highestBid + 1);
+    place_bid(splitLine, state->parameters, bidder);
+}
+
+/* bench_remove_item()
+ * -------------------
+ * Removes random items, putting a new one back outside the measurement so
+ * 	the catalog size stays fixed.
+ */
+void bench_remove_item(BenchState* state, long iterations, Measurement* m) {
+    ProgramParameters* parameters = state->parameters;
+    int numOfItems = parameters->numOfItems;
+    for (long i = 0; i < iterations; i++) {
+	int itemIndex = random_item(state);
+	start_measure(m);
+	remove_item(parameters, itemIndex);
+	stop_measure(m);
+	fill_items(state, numOfItems);
+    }
+}
+
+/* bench_list_all_items()
+ * ----------------------
+ * Lists the whole catalog.
+ */
+void bench_list_all_items(BenchState* state, long iterations,
+	Measurement* m) {
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	list_all_items(state->parameters, state->seller.output);
+	fflush(state->seller.output);
+    }
+    stop_measure(m);
+}
+
+/* bench_expire_items()
+ * --------------------
+ * Runs the expiry check made by check_time() when nothing has expired,
+ * 	which only looks at the top of the expiry heap.
+ */
+void bench_expire_items(BenchState* state, long iterations, Measurement* m) {
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	expire_items(state->parameters);
+    }
+    stop_measure(m);
+}
+
+/* bench_set_expiry()
+ * ------------------
+ * Moves random items to random expiry times, as soft close extensions do,
+ * 	re-keying each in the expiry heap. Nothing is brought forward enough
+ * 	to expire.
+ */
+void bench_set_expiry(BenchState* state, long iterations, Measurement* m) {
+    ProgramParameters* parameters = state->parameters;
+    start_measure(m);
+    for (long i = 0; i < iterations; i++) {
+	set_expiry(parameters, random_item(state), BENCH_DURATION / 2
+		+ rand_r(&state->seed) % (BENCH_DURATION / 2));
+    }
+    stop_measure(m);
+}
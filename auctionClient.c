@@ -14,26 +14,47 @@
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
-
-#define NUM_OF_ARGS 2
+#include <semaphore.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "transport.h"
+
+#define SHM_FLAG "--shm"
+#define DELTA_FLAG "--delta"
+#define SCRIPT_FLAG "--script"
+
+// Most script commands sent ahead of their replies, and the size of the
+// buffer they are batched into before being written.
+#define SCRIPT_WINDOW 4096
+#define SCRIPT_BUFFER (1 << 16)
 
 #define AUCTION_PROGRESS_MSG "Auction in progress - unable to exit yet\n"
 
 // Valid output from auctioneer.
 #define LISTED ":listed"
+#define SELL_BATCH ":sellbatch"
+#define BATCH_LISTED "listed"
 #define UNSOLD ":unsold"
 #define SOLD ":sold"
 #define BID ":bid"
 #define OUTBID ":outbid"
 #define WON ":won"
+#define LEADING ":leading"
+#define CLEARED ":cleared"
 
 // Input from stdin to compare to.
 #define QUIT "quit"
+#define LIST "list"
 #define COMMENT '#'
 
 // Error messages
-#define USAGE_ERR_MSG "Usage: auctionclient portno\n"
+#define USAGE_ERR_MSG "Usage: auctionclient [--shm] [--delta] " \
+    "[--script file] " \
+    "portno|unix:path\n"
 #define CONNECT_ERR_MSG "auctionclient: unable to connect to port %s\n"
+#define SCRIPT_ERR_MSG "auctionclient: unable to read script %s\n"
 #define PIPE_ERR_MSG "auctionclient: server connection terminated\n"
 #define AUCTION_EXIT_MSG "Exiting with auction still in progress\n"
 
@@ -43,28 +64,97 @@ enum ExitStatus {
     USAGE_ERR = 2,
     CONNECT_ERR = 4,
     PIPE_ERR = 5,
+    SCRIPT_ERR = 6,
     AUCTION_EXIT = 14
 };
 
-// Program parameters used across the two threads
+// Kinds of reply counted in the summary of a script.
+enum ReplyKind {
+    REPLY_LISTED,
+    REPLY_BID,
+    REPLY_REJECTED,
+    REPLY_INVALID,
+    REPLY_OTHER,
+    NUM_OF_REPLY_KINDS
+};
+
+// A command file being sent, and what has come back for it so far. Replies
+// come in the order the commands were sent. The sender publishes each send
+// time through numOfSent, which the reader loads before using it.
+typedef struct {
+    char* text;
+    size_t size;
+    int numOfCommands;
+    double* sentTimes;
+    int numOfSent;
+    double* roundTrips;
+    sem_t window;
+    int numOfReplies;
+    int replyCounts[NUM_OF_REPLY_KINDS];
+    int numOfNotifications;
+    double startTime;
+} Script;
+
+// An item as last heard of in a delta list. Its expiry is by this client's
+// clock, so its remaining time can be worked out whenever it is shown.
+typedef struct {
+    char* name;
+    int reserve;
+    int highestBid;
+    double expiryTime;
+} LocalItem;
+
+// The items on sale, rebuilt from delta lists in the auctioneer's order, and
+// the version of the auctioneer's items they are up to. The index holds
+// each item's position by the hash of its name, or -1 (a power of two).
+typedef struct {
+    unsigned long version;
+    LocalItem* items;
+    int numOfItems;
+    int capacity;
+    int* index;
+    int indexCapacity;
+} LocalView;
+
+// Program parameters used across the two threads. The counters are updated
+// by the thread reading the auctioneer and read by the other, so are only
+// accessed atomically.
 typedef struct {
     struct addrinfo* ai;
-    int inputFd;
     FILE* input;
-    int outputFd;
     FILE* output;
     int numOfListed;
     int numOfBids;
+    bool useShm;
+    bool useDelta;
+    LocalView view;
+    const char* scriptFile;
+    const char* port;
+    Script* script;
 } ProgramParameters;
 
 // Function prototypes
-void check_args(int argc, char** argv);
+void check_args(int argc, char** argv, ProgramParameters* parameters);
 int connect_port(const char* port, struct addrinfo* ai,
 	struct addrinfo hints); 
+void open_streams(ProgramParameters* parameters, int fd, bool useShm,
+	const char* port);
 void pipe_error(int s);
 void* read_input(void* params);
 void get_auctioneer_output(ProgramParameters* parameters);
 void free_memory(ProgramParameters* parameters);
+bool count_output(ProgramParameters* parameters, const char* line);
+double now_ms(void);
+void open_script(ProgramParameters* parameters);
+void* send_script(void* params);
+void read_script_replies(ProgramParameters* parameters);
+int compare_times(const void* first, const void* second);
+void print_script_summary(ProgramParameters* parameters);
+bool apply_delta(LocalView* view, const char* line);
+void drop_closed(LocalView* view);
+int find_local(LocalView* view, const char* name, bool* found);
+void index_local(LocalView* view, int capacity);
+void print_view(LocalView* view);
 
 /* pipe_error()
  * -----------
@@ -80,8 +170,12 @@ void pipe_error(int s) {
 }
 
 int main(int argc, char** argv) {
-    check_args(argc, argv);
-    const char* port = argv[1];
+    ProgramParameters* parameters = malloc(sizeof(ProgramParameters));
+    check_args(argc, argv, parameters);
+    if (parameters->scriptFile) {
+	open_script(parameters);
+    }
+    const char* port = parameters->port;
     
     // Initialise struct for client
     struct addrinfo* ai = 0;
@@ -97,12 +191,19 @@ int main(int argc, char** argv) {
     int fd = connect_port(port, ai, hints);
 
     // Initialise struct with program parameters
-    ProgramParameters* parameters = malloc(sizeof(ProgramParameters));
-    parameters->inputFd = fd;
-    parameters->outputFd = dup(fd);
+    open_streams(parameters, fd, parameters->useShm, port);
     parameters->numOfListed = 0;
     parameters->numOfBids = 0;
 
+    if (parameters->script) {
+	// Send the script from another thread and collect replies here.
+	pthread_t tid;
+	pthread_create(&tid, 0, send_script, parameters);
+	read_script_replies(parameters);
+	print_script_summary(parameters);
+	exit(OK);
+    }
+
     // Create a thread to read stdin and send to auctioneer
     pthread_t tid;
     pthread_create(&tid, 0, read_input, parameters);
@@ -125,66 +226,137 @@ int main(int argc, char** argv) {
  * Returns: void
  */
 void get_auctioneer_output(ProgramParameters* parameters) {
-    FILE* input = fdopen(parameters->inputFd, "r");
+    FILE* input = parameters->input;
     char* outputLine;
     while ((outputLine = read_line(input))) {
-	// Send output from auctioneer to stdout
-	printf("%s\n", outputLine);
+	// Send output from auctioneer to stdout. Delta lists are shown as the
+	// whole list they bring the items up to.
+	if (parameters->useDelta
+		&& apply_delta(&parameters->view, outputLine)) {
+	    print_view(&parameters->view);
+	} else {
+	    printf("%s\n", outputLine);
+	}
 	fflush(stdout);
+	count_output(parameters, outputLine);
+	free(outputLine);
+    }
+    
+    if (outputLine == NULL) {
+	fprintf(stderr, PIPE_ERR_MSG);
+	exit(PIPE_ERR);
+    }
+}
 
-	char** splitOutput = split_by_char(outputLine, ' ', 0);
-	
-	// Check if user has put something for selling.
-	if (strcmp(splitOutput[0], LISTED) == 0) {
-	    ++(parameters->numOfListed);
-	}
+/* count_output()
+ * --------------
+ * Keeps count of the items the user has listed and is bidding on from a
+ * 	line sent by the auctioneer.
+ *
+ * parameters: a struct containing the number of items listed and bid on.
+ * line: the line from the auctioneer.
+ *
+ * Returns: true if the line is a notification rather than a reply.
+ */
+bool count_output(ProgramParameters* parameters, const char* line) {
+    // Only the first word matters, apart from sellbatch results.
+    size_t length = strcspn(line, " ");
 
-	// Check if the listed item is sold or unsold
-	if (strcmp(splitOutput[0], UNSOLD) == 0 ||
-		strcmp(splitOutput[0], SOLD) == 0) {
-	    --(parameters->numOfListed);
-	}
+    // Check if user has put something for selling.
+    if (length == strlen(LISTED) && strncmp(line, LISTED, length) == 0) {
+	__atomic_add_fetch(&parameters->numOfListed, 1, __ATOMIC_RELAXED);
+    }
 
-	// Check if user has bid on something
-	if (strcmp(splitOutput[0], BID) == 0) {
-	    parameters->numOfBids++;
+    // A sellbatch reply has one result per item.
+    if (length == strlen(SELL_BATCH)
+	    && strncmp(line, SELL_BATCH, length) == 0) {
+	for (const char* word = line + length; *word == ' '; ) {
+	    word++;
+	    size_t wordLength = strcspn(word, " ");
+	    if (wordLength == strlen(BATCH_LISTED)
+		    && strncmp(word, BATCH_LISTED, wordLength) == 0) {
+		__atomic_add_fetch(&parameters->numOfListed, 1,
+			__ATOMIC_RELAXED);
+	    }
+	    word += wordLength;
 	}
+    }
 
-	// Check if user has been outbid on item
-	if (strcmp(splitOutput[0], OUTBID) == 0 ||
-		strcmp(splitOutput[0], WON) == 0) {
-	    parameters->numOfBids--;
-	}
+    // Check if the listed item is sold or unsold
+    if ((length == strlen(UNSOLD) && strncmp(line, UNSOLD, length) == 0)
+	    || (length == strlen(SOLD) && strncmp(line, SOLD, length) == 0)) {
+	__atomic_sub_fetch(&parameters->numOfListed, 1, __ATOMIC_RELAXED);
+	return true;
     }
-    
-    if (outputLine == NULL) {
-	fprintf(stderr, PIPE_ERR_MSG);
-	exit(PIPE_ERR);
+
+    // Check if user has bid on something
+    if (length == strlen(BID) && strncmp(line, BID, length) == 0) {
+	__atomic_add_fetch(&parameters->numOfBids, 1, __ATOMIC_RELAXED);
+    }
+
+    // Bids on items sold by clearing count once they lead.
+    if (length == strlen(LEADING) && strncmp(line, LEADING, length) == 0) {
+	__atomic_add_fetch(&parameters->numOfBids, 1, __ATOMIC_RELAXED);
+	return true;
+    }
+    if (length == strlen(CLEARED) && strncmp(line, CLEARED, length) == 0) {
+	return true;
     }
+
+    // Check if user has been outbid on item
+    if ((length == strlen(OUTBID) && strncmp(line, OUTBID, length) == 0)
+	    || (length == strlen(WON) && strncmp(line, WON, length) == 0)) {
+	__atomic_sub_fetch(&parameters->numOfBids, 1, __ATOMIC_RELAXED);
+	return true;
+    }
+    return false;
 }
 
 /* check_args()
  * ------------
- * Checks if the correct number of command line arguments are given.
+ * Checks the command line arguments and stores them in parameters.
  *
  * argc: the number of command line arguments.
  * argv: an array of arrays of the command line arguments.
+ * parameters: the struct to store the arguments in.
  *
- * Errors: Exits with status 2 and usage error message if 2 arguments have
- * 	not been given.
+ * Errors: Exits with status 2 and usage error message if the arguments are
+ * 	not optional --shm, --delta and --script file flags followed by an
+ * 	endpoint, or
+ * 	if --shm is given without a unix endpoint.
  */
-void check_args(int argc, char** argv) {
-    if (argc != NUM_OF_ARGS) {
+void check_args(int argc, char** argv, ProgramParameters* parameters) {
+    parameters->useShm = false;
+    parameters->useDelta = false;
+    memset(&parameters->view, 0, sizeof(LocalView));
+    parameters->scriptFile = NULL;
+    parameters->script = NULL;
+    int i = 1;
+    for (; i < argc - 1; i++) {
+	if (strcmp(argv[i], SHM_FLAG) == 0 && !parameters->useShm) {
+	    parameters->useShm = true;
+	} else if (strcmp(argv[i], DELTA_FLAG) == 0 && !parameters->useDelta) {
+	    parameters->useDelta = true;
+	} else if (strcmp(argv[i], SCRIPT_FLAG) == 0 && i + 2 < argc
+		&& !parameters->scriptFile) {
+	    parameters->scriptFile = argv[++i];
+	} else {
+	    break;
+	}
+    }
+    if (i != argc - 1 || (parameters->useShm && !is_unix_endpoint(argv[i]))) {
 	fprintf(stderr, USAGE_ERR_MSG);
 	exit(USAGE_ERR);
     }
+    parameters->port = argv[i];
 }
 
 /* connect_port()
  * --------------
  * Creates a socket to connect to the auctioneer server.
  *
- * port: the port specified in the command line arguments.
+ * port: the port or unix:path endpoint specified in the command line
+ * 	arguments.
  * ai: a struct which helps connect to the socket.
  * hints: a struct which helps use TCP for the socket.
  *
@@ -194,6 +366,15 @@ void check_args(int argc, char** argv) {
  */
 int connect_port(const char* port, struct addrinfo* ai,
 	struct addrinfo hints) {
+    if (is_unix_endpoint(port)) {
+	int fd = connect_unix(unix_endpoint_path(port));
+	if (fd < 0) {
+	    fprintf(stderr, CONNECT_ERR_MSG, port);
+	    exit(CONNECT_ERR);
+	}
+	return fd;
+    }
+
     // Use IPv4
     hints.ai_family = AF_INET;
     
@@ -218,6 +399,32 @@ int connect_port(const char* port, struct addrinfo* ai,
     return fd;
 }
 
+/* open_streams()
+ * --------------
+ * Opens the streams used to talk to the auctioneer, either directly on the
+ * 	socket or over shared-memory rings negotiated on it.
+ *
+ * parameters: the struct to store the input and output streams in.
+ * fd: the file descriptor of the connected socket.
+ * useShm: true if the shared-memory ring transport was requested.
+ * port: the endpoint connected to, for error messages.
+ *
+ * Errors: Exits with status 4 and connect error message if the auctioneer
+ * 	refuses the shared-memory transport.
+ */
+void open_streams(ProgramParameters* parameters, int fd, bool useShm,
+	const char* port) {
+    if (!useShm) {
+	parameters->input = fdopen(fd, "r");
+	parameters->output = fdopen(dup(fd), "w");
+	return;
+    }
+    if (!shm_ring_accept(fd, &parameters->input, &parameters->output)) {
+	fprintf(stderr, CONNECT_ERR_MSG, port);
+	exit(CONNECT_ERR);
+    }
+}
+
 /* read_input()
  * ------------
  * Gets input from stdin and outputs it to the socket file descriptor.
@@ -231,8 +438,7 @@ int connect_port(const char* port, struct addrinfo* ai,
  */
 void* read_input(void* params) {
     ProgramParameters* parameters = (ProgramParameters*) params;
-    int outputFd = parameters->outputFd;
-    FILE* output = fdopen(outputFd, "w");
+    FILE* output = parameters->output;
     char* line;
     while ((line = read_line(stdin))) {
 	// Ignore line that starts with '#' or empty line
@@ -244,8 +450,9 @@ void* read_input(void* params) {
 	if (strcmp(line, QUIT) == 0) {
 	    free(line);
 	    // Ensure user is not active in any auctions before exiting
-	    if (parameters->numOfListed != 0 || 
-		    parameters->numOfBids != 0) {
+	    if (__atomic_load_n(&parameters->numOfListed, __ATOMIC_RELAXED)
+		    != 0 || __atomic_load_n(&parameters->numOfBids,
+		    __ATOMIC_RELAXED) != 0) {
 		printf(AUCTION_PROGRESS_MSG);
 		fflush(stdout);
 		continue;
@@ -253,13 +460,25 @@ void* read_input(void* params) {
 	    exit(0);
 	}
 
-	fprintf(output, "%s\n", line);
+	// Lists are asked for as what has changed since the last one.
+	if (parameters->useDelta && strcmp(line, LIST) == 0) {
+	    fprintf(output, "%s %lu z\n", DELTA_REQUEST,
+		    __atomic_load_n(&parameters->view.version,
+		    __ATOMIC_RELAXED));
+	} else {
+	    fprintf(output, "%s\n", line);
+	}
 	fflush(output);
+	free(line);
     }
-    fclose(output);
+    // Only flush: closing a shared-memory stream would hang up on the
+    // auctioneer before this thread gets to exit.
+    fflush(output);
 
     if (line == NULL) {
-	if (parameters->numOfListed != 0 || parameters->numOfBids != 0) {
+	if (__atomic_load_n(&parameters->numOfListed, __ATOMIC_RELAXED) != 0
+		|| __atomic_load_n(&parameters->numOfBids,
+		__ATOMIC_RELAXED) != 0) {
 	    fprintf(stderr, AUCTION_EXIT_MSG);
 	    exit(AUCTION_EXIT);
 	}
@@ -268,3 +487,414 @@ void* read_input(void* params) {
     return NULL;
 }
 
+
+/* now_ms()
+ * --------
+ * Gets a monotonic time for measuring round trips.
+ *
+ * Returns: the time in milliseconds.
+ */
+double now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/* is_script_command()
+ * -------------------
+ * Checks whether a line of a script is sent to the auctioneer. Comments and
+ * 	empty lines are skipped, as they are when typed.
+ *
+ * line: the start of the line.
+ * length: the length of the line, without newline.
+ *
+ * Returns: true if the line is a command.
+ */
+static bool is_script_command(const char* line, size_t length) {
+    return length != 0 && line[0] != COMMENT;
+}
+
+/* open_script()
+ * -------------
+ * Maps a script of commands into memory and counts the commands in it. A
+ * 	quit line ends the script.
+ *
+ * parameters: a struct containing the script file name, in which the
+ * 	script is stored.
+ *
+ * Errors: Exits with status 6 and script error message if the script cannot
+ * 	be read.
+ */
+void open_script(ProgramParameters* parameters) {
+    int fd = open(parameters->scriptFile, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	fprintf(stderr, SCRIPT_ERR_MSG, parameters->scriptFile);
+	exit(SCRIPT_ERR);
+    }
+    Script* script = calloc(1, sizeof(Script));
+    script->size = info.st_size;
+    script->text = NULL;
+    if (script->size > 0) {
+	script->text = mmap(NULL, script->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (script->text == MAP_FAILED) {
+	    fprintf(stderr, SCRIPT_ERR_MSG, parameters->scriptFile);
+	    exit(SCRIPT_ERR);
+	}
+    }
+    close(fd);
+
+    // Stop the script at a quit line, so only what is sent is counted.
+    char* end = script->text + script->size;
+    for (char* line = script->text; line < end; ) {
+	char* newline = memchr(line, '\n', end - line);
+	size_t length = (newline ? newline : end) - line;
+	if (length == strlen(QUIT) && strncmp(line, QUIT, length) == 0) {
+	    script->size = line - script->text;
+	    break;
+	}
+	if (is_script_command(line, length)) {
+	    script->numOfCommands++;
+	}
+	line += length + 1;
+    }
+    script->sentTimes = malloc(sizeof(double) * script->numOfCommands);
+    script->roundTrips = malloc(sizeof(double) * script->numOfCommands);
+    sem_init(&script->window, 0, SCRIPT_WINDOW);
+    parameters->script = script;
+}
+
+/* send_script()
+ * -------------
+ * Sends every command of a script without waiting for replies, at most
+ * 	SCRIPT_WINDOW ahead of them. Commands are written into a large buffer
+ * 	which is only flushed when full, or when the window is, so that many
+ * 	commands go out in each write.
+ *
+ * params: a struct containing the script and the auctioneer's streams.
+ *
+ * Returns: empty null pointer
+ */
+void* send_script(void* params) {
+    ProgramParameters* parameters = (ProgramParameters*) params;
+    Script* script = parameters->script;
+    FILE* output = parameters->output;
+    setvbuf(output, NULL, _IOFBF, SCRIPT_BUFFER);
+
+    script->startTime = now_ms();
+    char* end = script->text + script->size;
+    int command = 0;
+    for (char* line = script->text; line < end; ) {
+	char* newline = memchr(line, '\n', end - line);
+	size_t length = (newline ? newline : end) - line;
+	if (is_script_command(line, length)) {
+	    // Replies can only come back for what has actually been written.
+	    if (sem_trywait(&script->window) != 0) {
+		fflush(output);
+		sem_wait(&script->window);
+	    }
+	    script->sentTimes[command] = now_ms();
+	    __atomic_store_n(&script->numOfSent, ++command,
+		    __ATOMIC_RELEASE);
+	    fwrite(line, 1, length, output);
+	    fputc('\n', output);
+	}
+	line += length + 1;
+    }
+    fflush(output);
+    return NULL;
+}
+
+/* read_script_replies()
+ * ---------------------
+ * Reads from the auctioneer until every command of the script has had its
+ * 	reply, matching replies to commands in order and recording each round
+ * 	trip. Notifications are counted but are not replies.
+ *
+ * parameters: a struct containing the script and the auctioneer's streams.
+ *
+ * Errors: Exits with status 5 and pipe error message if the auctioneer hangs
+ * 	up before every reply has come back.
+ */
+void read_script_replies(ProgramParameters* parameters) {
+    Script* script = parameters->script;
+    const char* replyWords[REPLY_OTHER] = {LISTED, BID, ":rejected",
+	    ":invalid"};
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while (script->numOfReplies < script->numOfCommands
+	    && (length = getline(&line, &capacity, parameters->input)) > 0) {
+	if (line[length - 1] == '\n') {
+	    line[length - 1] = '\0';
+	}
+	if (count_output(parameters, line)) {
+	    script->numOfNotifications++;
+	    continue;
+	}
+
+	// Replies follow their commands, so the send time is there unless the
+	// auctioneer replies to something not yet sent.
+	int reply = script->numOfReplies++;
+	double sentTime = reply < __atomic_load_n(&script->numOfSent,
+		__ATOMIC_ACQUIRE) ? script->sentTimes[reply] : now_ms();
+	script->roundTrips[reply] = now_ms() - sentTime;
+	sem_post(&script->window);
+
+	size_t wordLength = strcspn(line, " ");
+	int kind = REPLY_LISTED;
+	while (kind < REPLY_OTHER && (wordLength != strlen(replyWords[kind])
+		|| strncmp(line, replyWords[kind], wordLength) != 0)) {
+	    kind++;
+	}
+	script->replyCounts[kind]++;
+    }
+    free(line);
+    if (script->numOfReplies < script->numOfCommands) {
+	fprintf(stderr, PIPE_ERR_MSG);
+	exit(PIPE_ERR);
+    }
+}
+
+/* compare_times()
+ * ---------------
+ * qsort comparison function for round trip times.
+ */
+int compare_times(const void* first, const void* second) {
+    double difference = *(const double*) first - *(const double*) second;
+    return (difference > 0) - (difference < 0);
+}
+
+/* print_script_summary()
+ * ----------------------
+ * Prints how quickly the script was answered, what the replies were, and
+ * 	the spread of round trip times, instead of every reply.
+ *
+ * parameters: a struct containing the script.
+ *
+ * Returns: void
+ */
+void print_script_summary(ProgramParameters* parameters) {
+    Script* script = parameters->script;
+    int numOfCommands = script->numOfCommands;
+    double elapsed = now_ms() - script->startTime;
+    printf("%d commands in %.1f ms", numOfCommands, elapsed);
+    if (elapsed > 0) {
+	printf(" (%.0f commands/s)", numOfCommands * 1000.0 / elapsed);
+    }
+    printf("\n");
+    printf("replies: %d listed, %d bid, %d rejected, %d invalid, %d other; "
+	    "%d notifications\n", script->replyCounts[REPLY_LISTED],
+	    script->replyCounts[REPLY_BID],
+	    script->replyCounts[REPLY_REJECTED],
+	    script->replyCounts[REPLY_INVALID],
+	    script->replyCounts[REPLY_OTHER], script->numOfNotifications);
+    if (numOfCommands > 0) {
+	double total = 0;
+	for (int i = 0; i < numOfCommands; i++) {
+	    total += script->roundTrips[i];
+	}
+	qsort(script->roundTrips, numOfCommands, sizeof(double),
+		compare_times);
+	printf("round trip ms: mean %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+		total / numOfCommands,
+		script->roundTrips[numOfCommands / 2],
+		script->roundTrips[(int) (numOfCommands * 0.99)],
+		script->roundTrips[numOfCommands - 1]);
+    }
+    printf("still listed %d, still bidding on %d\n",
+	    __atomic_load_n(&parameters->numOfListed, __ATOMIC_RELAXED),
+	    __atomic_load_n(&parameters->numOfBids, __ATOMIC_RELAXED));
+    fflush(stdout);
+}
+
+/* apply_delta()
+ * -------------
+ * Brings the local view of the items up to date from a delta list (see
+ * 	list_delta() in auction.c). Items which have closed come first, and
+ * 	are dropped before the rest are applied, so that one listed again
+ * 	goes to the end as it does at the auctioneer.
+ *
+ * view: the local view.
+ * line: a line from the auctioneer.
+ *
+ * Returns: true if the line was a delta list, false otherwise.
+ */
+bool apply_delta(LocalView* view, const char* line) {
+    unsigned long version;
+    unsigned long base;
+    size_t length;
+    int offset = 0;
+    char* entries = NULL;
+    if (strncmp(line, DELTA_REPLY " ", strlen(DELTA_REPLY) + 1) == 0
+	    && sscanf(line, DELTA_REPLY " %lu %lu %n", &version, &base,
+	    &offset) == 2 && offset) {
+	entries = strdup(line + offset);
+    } else if (strncmp(line, PACKED_DELTA_REPLY " ",
+	    strlen(PACKED_DELTA_REPLY) + 1) == 0
+	    && sscanf(line, PACKED_DELTA_REPLY " %lu %lu %zu %n", &version,
+	    &base, &length, &offset) == 3 && offset) {
+	entries = unpack_text(line + offset, length);
+    }
+    if (entries == NULL) {
+	return false;
+    }
+
+    if (view->index == NULL) {
+	index_local(view, 32);
+    }
+
+    // A base of 0 replaces every item.
+    if (base == 0) {
+	for (int i = 0; i < view->numOfItems; i++) {
+	    free(view->items[i].name);
+	    view->items[i].name = NULL;
+	}
+    }
+    double now = now_ms();
+    bool dropped = false;
+    char* rest;
+    for (char* entry = strtok_r(entries, "|", &rest); entry;
+	    entry = strtok_r(NULL, "|", &rest)) {
+	bool found;
+	char* fields = strchr(entry, ' ');
+	if (fields == NULL) {
+	    int position = find_local(view, entry, &found);
+	    if (found) {
+		free(view->items[position].name);
+		view->items[position].name = NULL;
+	    }
+	    continue;
+	}
+	if (!dropped) {
+	    drop_closed(view);
+	    dropped = true;
+	}
+	*fields++ = '\0';
+	LocalItem item = {NULL, 0, 0, 0};
+	int remaining;
+	if (sscanf(fields, "%d %d %d", &item.reserve, &item.highestBid,
+		&remaining) != 3) {
+	    continue;
+	}
+	item.expiryTime = now + remaining;
+	int position = find_local(view, entry, &found);
+	if (found) {
+	    item.name = view->items[position].name;
+	    view->items[position] = item;
+	    continue;
+	}
+	if (view->numOfItems == view->capacity) {
+	    view->capacity = view->capacity ? view->capacity * 2 : 16;
+	    view->items = realloc(view->items,
+		    sizeof(LocalItem) * view->capacity);
+	}
+	item.name = strdup(entry);
+	view->items[view->numOfItems] = item;
+	view->index[position] = view->numOfItems++;
+	if (view->numOfItems * 2 > view->indexCapacity) {
+	    index_local(view, view->indexCapacity * 2);
+	}
+    }
+    if (!dropped) {
+	drop_closed(view);
+    }
+    free(entries);
+    __atomic_store_n(&view->version, version, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* drop_closed()
+ * -------------
+ * Removes the items marked closed from the local view, keeping the order of
+ * 	the rest, and indexes what is left.
+ *
+ * view: the local view.
+ *
+ * Returns: void
+ */
+void drop_closed(LocalView* view) {
+    int kept = 0;
+    for (int i = 0; i < view->numOfItems; i++) {
+	if (view->items[i].name) {
+	    view->items[kept++] = view->items[i];
+	}
+    }
+    view->numOfItems = kept;
+    int capacity = 32;
+    while (capacity < view->numOfItems * 2) {
+	capacity *= 2;
+    }
+    index_local(view, capacity);
+}
+
+/* find_local()
+ * ------------
+ * Looks an item up in the local view by name (FNV-1a, linear probing).
+ *
+ * view: the local view, which must have an index.
+ * name: the name of the item.
+ * found: set to whether the item is in the view.
+ *
+ * Returns: the item's position if found, otherwise the empty index slot
+ * 	where it belongs.
+ */
+int find_local(LocalView* view, const char* name, bool* found) {
+    unsigned int hash = 2166136261u;
+    for (const char* c = name; *c; c++) {
+	hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    int mask = view->indexCapacity - 1;
+    for (int slot = hash & mask; ; slot = (slot + 1) & mask) {
+	int position = view->index[slot];
+	if (position == -1) {
+	    *found = false;
+	    return slot;
+	}
+	// Items marked closed keep their slots until the index is rebuilt.
+	if (view->items[position].name
+		&& strcmp(view->items[position].name, name) == 0) {
+	    *found = true;
+	    return position;
+	}
+    }
+}
+
+/* index_local()
+ * -------------
+ * Rebuilds the index of the local view.
+ *
+ * view: the local view.
+ * capacity: the number of index slots, a power of two more than twice the
+ * 	number of items.
+ *
+ * Returns: void
+ */
+void index_local(LocalView* view, int capacity) {
+    view->index = realloc(view->index, sizeof(int) * capacity);
+    memset(view->index, -1, sizeof(int) * capacity);
+    view->indexCapacity = capacity;
+    for (int i = 0; i < view->numOfItems; i++) {
+	bool found;
+	view->index[find_local(view, view->items[i].name, &found)] = i;
+    }
+}
+
+/* print_view()
+ * ------------
+ * Prints the local view as the auctioneer would reply to list.
+ *
+ * view: the local view.
+ *
+ * Returns: void
+ */
+void print_view(LocalView* view) {
+    double now = now_ms();
+    printf(":list ");
+    for (int i = 0; i < view->numOfItems; i++) {
+	LocalItem* item = &view->items[i];
+	printf("%s %d %d %d|", item->name, item->reserve, item->highestBid,
+		(int) (item->expiryTime - now));
+    }
+    printf("\n");
+}
@@ -0,0 +1,387 @@
+/*
+ * auctionreplay
+ * Feeds a capture made with auctioneer --record back to an auctioneer,
+ * 	either in real time or as fast as possible against a virtual clock.
+ * Author: Hamza
+ */
+
+#include <csse2310a4.h>
+#include <csse2310a3.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include "transport.h"
+#include "capture.h"
+
+#define FAST "--fast"
+
+// The command moving a virtual clock, which --fast sends itself.
+#define ADVANCE "advance"
+
+// Notifications the auctioneer may send at any time, as opposed to replies.
+#define NUM_OF_NOTIFICATIONS 6
+
+// Error messages
+#define USAGE_ERR_MSG "Usage: auctionreplay [--fast] capture-file " \
+    "portno|unix:path\n"
+#define FILE_ERR_MSG "auctionreplay: unable to read capture %s\n"
+#define CONNECT_ERR_MSG "auctionreplay: unable to connect to %s\n"
+#define RECORD_ERR_MSG "auctionreplay: bad record on line %d\n"
+#define PIPE_ERR_MSG "auctionreplay: server connection terminated\n"
+
+// Exit statuses for program
+enum ExitStatus {
+    USAGE_ERR = 2,
+    FILE_ERR = 3,
+    CONNECT_ERR = 4,
+    PIPE_ERR = 5
+};
+
+// A connection standing in for one client of the capture.
+typedef struct {
+    int fd;
+    FILE* input;
+    FILE* output;
+    pthread_t tid;
+    sem_t replyReady;
+    char* reply;
+    int numOfNotifications;
+} Connection;
+
+typedef struct {
+    bool fast;
+    const char* captureFile;
+    const char* endpoint;
+    int numOfConnections;
+    Connection** connections;
+    Connection* control;
+    int numOfCommands;
+    int numOfClients;
+    double totalLatency;
+    double maxLatency;
+} ProgramParameters;
+
+// Function prototypes
+void check_args(int argc, char** argv, ProgramParameters* parameters);
+Connection* open_connection(ProgramParameters* parameters);
+void close_connection(ProgramParameters* parameters, int client);
+void* read_replies(void* connection);
+bool is_notification(const char* line);
+char* send_command(Connection* connection, const char* line);
+void replay_record(ProgramParameters* parameters, CaptureRecord* record);
+void wait_until(ProgramParameters* parameters, double startTime,
+	double* clockTime, double recordTime);
+void print_summary(ProgramParameters* parameters, double elapsed);
+
+int main(int argc, char** argv) {
+    ProgramParameters* parameters = malloc(sizeof(ProgramParameters));
+    check_args(argc, argv, parameters);
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE* capture = fopen(parameters->captureFile, "r");
+    if (capture == NULL) {
+	fprintf(stderr, FILE_ERR_MSG, parameters->captureFile);
+	exit(FILE_ERR);
+    }
+
+    // Against a virtual clock, time is moved on over a connection of our own.
+    parameters->control = parameters->fast ? open_connection(parameters)
+	    : NULL;
+
+    double startTime = get_time_ms();
+    double clockTime = 0;
+    char* line;
+    int lineNum = 0;
+    while ((line = read_line(capture))) {
+	lineNum++;
+	CaptureRecord record;
+	if (!parse_capture_record(line, &record)) {
+	    fprintf(stderr, RECORD_ERR_MSG, lineNum);
+	    exit(FILE_ERR);
+	}
+	wait_until(parameters, startTime, &clockTime, record.time);
+	replay_record(parameters, &record);
+	free(record.line);
+	free(line);
+    }
+    fclose(capture);
+    double elapsed = get_time_ms() - startTime;
+
+    for (int i = 0; i < parameters->numOfConnections; i++) {
+	close_connection(parameters, i);
+    }
+    print_summary(parameters, elapsed);
+    return 0;
+}
+
+/* wait_until()
+ * ------------
+ * Brings time up to a record's timestamp: by sleeping in real time, or by
+ * 	advancing the auctioneer's virtual clock when replaying fast.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * startTime: the real time the replay started.
+ * clockTime: the capture time reached so far, updated.
+ * recordTime: the capture time of the next record.
+ *
+ * Returns: void
+ */
+void wait_until(ProgramParameters* parameters, double startTime,
+	double* clockTime, double recordTime) {
+    if (recordTime <= *clockTime) {
+	return;
+    }
+    if (parameters->fast) {
+	char advance[64];
+	snprintf(advance, sizeof(advance), "advance %.3f",
+		recordTime - *clockTime);
+	free(send_command(parameters->control, advance));
+    } else {
+	double delay = startTime + recordTime - get_time_ms();
+	if (delay > 0) {
+	    usleep(delay * 1000);
+	}
+    }
+    *clockTime = recordTime;
+}
+
+/* replay_record()
+ * ---------------
+ * Replays one capture record: opening a client's connection, sending one of
+ * 	its commands and waiting for the reply, or closing its connection.
+ * 	Recorded advances are skipped when replaying fast, as wait_until()
+ * 	has moved the clock to the record's time already.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * record: the record to replay.
+ *
+ * Returns: void
+ */
+void replay_record(ProgramParameters* parameters, CaptureRecord* record) {
+    int client = record->client;
+    if (client < 0) {
+	return;
+    }
+    if (client >= parameters->numOfConnections) {
+	parameters->connections = realloc(parameters->connections,
+		sizeof(Connection*) * (client + 1));
+	for (int i = parameters->numOfConnections; i <= client; i++) {
+	    parameters->connections[i] = NULL;
+	}
+	parameters->numOfConnections = client + 1;
+    }
+
+    if (strcmp(record->type, CAPTURE_CONNECT) == 0) {
+	close_connection(parameters, client);
+	parameters->connections[client] = open_connection(parameters);
+	parameters->numOfClients++;
+    } else if (strcmp(record->type, CAPTURE_COMMAND) == 0 && record->line) {
+	// A capture made on a virtual clock holds its advances, but their
+	// time is already in the records' timestamps, which --fast follows.
+	size_t length = strlen(ADVANCE);
+	if (parameters->fast && strncmp(record->line, ADVANCE, length) == 0
+		&& (record->line[length] == ' '
+		|| record->line[length] == '\0')) {
+	    return;
+	}
+	Connection* connection = parameters->connections[client];
+	if (connection == NULL) {
+	    // Capture started after this client connected.
+	    connection = open_connection(parameters);
+	    parameters->connections[client] = connection;
+	    parameters->numOfClients++;
+	}
+	double sent = get_time_ms();
+	free(send_command(connection, record->line));
+	double latency = get_time_ms() - sent;
+	parameters->numOfCommands++;
+	parameters->totalLatency += latency;
+	if (latency > parameters->maxLatency) {
+	    parameters->maxLatency = latency;
+	}
+    } else if (strcmp(record->type, CAPTURE_CLOSE) == 0) {
+	close_connection(parameters, client);
+    }
+}
+
+/* open_connection()
+ * -----------------
+ * Connects to the auctioneer and starts a thread reading its replies.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: the new connection.
+ * Errors: Exits with status 4 and connect error message if the auctioneer
+ * 	cannot be connected to.
+ */
+Connection* open_connection(ProgramParameters* parameters) {
+    int fd = connect_endpoint(parameters->endpoint);
+    if (fd < 0) {
+	fprintf(stderr, CONNECT_ERR_MSG, parameters->endpoint);
+	exit(CONNECT_ERR);
+    }
+    Connection* connection = malloc(sizeof(Connection));
+    connection->fd = fd;
+    connection->input = fdopen(fd, "r");
+    connection->output = fdopen(dup(fd), "w");
+    connection->reply = NULL;
+    connection->numOfNotifications = 0;
+    sem_init(&connection->replyReady, 0, 0);
+    pthread_create(&connection->tid, NULL, read_replies, connection);
+    return connection;
+}
+
+/* close_connection()
+ * ------------------
+ * Hangs up a client's connection, if open, and waits for its reader.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * client: the number of the client in the capture.
+ *
+ * Returns: void
+ */
+void close_connection(ProgramParameters* parameters, int client) {
+    Connection* connection = parameters->connections[client];
+    if (connection == NULL) {
+	return;
+    }
+    shutdown(connection->fd, SHUT_RDWR);
+    pthread_join(connection->tid, NULL);
+    fclose(connection->input);
+    fclose(connection->output);
+    sem_destroy(&connection->replyReady);
+    free(connection);
+    parameters->connections[client] = NULL;
+}
+
+/* read_replies()
+ * --------------
+ * A function for the thread reading each connection. Notifications are
+ * 	counted and replies are handed to the thread waiting for them.
+ *
+ * connection: a null pointer to the connection to read.
+ *
+ * Returns: empty null pointer
+ */
+void* read_replies(void* arg) {
+    Connection* connection = (Connection*) arg;
+    char* line;
+    while ((line = read_line(connection->input))) {
+	if (is_notification(line)) {
+	    connection->numOfNotifications++;
+	    free(line);
+	} else {
+	    connection->reply = line;
+	    sem_post(&connection->replyReady);
+	}
+    }
+    connection->reply = NULL;
+    sem_post(&connection->replyReady);
+    return NULL;
+}
+
+/* is_notification()
+ * -----------------
+ * Checks whether a line from the auctioneer is an unsolicited notification.
+ *
+ * line: the line from the auctioneer.
+ *
+ * Returns: true for :outbid, :won, :sold and :unsold lines, and the
+ * 	:leading and :cleared lines sent when a batch item is cleared.
+ */
+bool is_notification(const char* line) {
+    const char* notifications[NUM_OF_NOTIFICATIONS] =
+	    {":outbid ", ":won ", ":sold ", ":unsold ", ":leading ",
+	    ":cleared "};
+    for (int i = 0; i < NUM_OF_NOTIFICATIONS; i++) {
+	if (strncmp(line, notifications[i], strlen(notifications[i])) == 0) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* send_command()
+ * --------------
+ * Sends a command and waits for its reply, so the auctioneer sees commands
+ * 	in the same order as the capture.
+ *
+ * connection: the connection to send on.
+ * line: the command to send.
+ *
+ * Returns: the reply, which the caller must free.
+ * Errors: Exits with status 5 and pipe error message if the auctioneer hangs
+ * 	up.
+ */
+char* send_command(Connection* connection, const char* line) {
+    fprintf(connection->output, "%s\n", line);
+    fflush(connection->output);
+    sem_wait(&connection->replyReady);
+    char* reply = connection->reply;
+    connection->reply = NULL;
+    if (reply == NULL) {
+	fprintf(stderr, PIPE_ERR_MSG);
+	exit(PIPE_ERR);
+    }
+    return reply;
+}
+
+/* print_summary()
+ * ---------------
+ * Prints how long the replay took and how quickly commands were answered.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * elapsed: the real time taken by the replay in milliseconds.
+ *
+ * Returns: void
+ */
+void print_summary(ProgramParameters* parameters, double elapsed) {
+    int numOfCommands = parameters->numOfCommands;
+    printf("replayed %d commands from %d clients in %.1f ms\n",
+	    numOfCommands, parameters->numOfClients, elapsed);
+    if (numOfCommands > 0 && elapsed > 0) {
+	printf("%.0f commands/s, mean latency %.3f ms, max latency %.3f ms\n",
+		numOfCommands * 1000.0 / elapsed,
+		parameters->totalLatency / numOfCommands,
+		parameters->maxLatency);
+    }
+    fflush(stdout);
+}
+
+/* check_args()
+ * ------------
+ * Checks the command line arguments and stores them in parameters.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 2 and usage error message if the arguments are
+ * 	not an optional --fast, a capture file and an endpoint.
+ */
+void check_args(int argc, char** argv, ProgramParameters* parameters) {
+    int first = 1;
+    parameters->fast = false;
+    if (argc > 1 && strcmp(argv[1], FAST) == 0) {
+	parameters->fast = true;
+	first++;
+    }
+    if (argc - first != 2) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    parameters->captureFile = argv[first];
+    parameters->endpoint = argv[first + 1];
+    parameters->numOfConnections = 0;
+    parameters->connections = NULL;
+    parameters->numOfCommands = 0;
+    parameters->numOfClients = 0;
+    parameters->totalLatency = 0;
+    parameters->maxLatency = 0;
+}
@@ -0,0 +1,665 @@
+/*
+ * auctionrouter
+ * Front-end which spreads the item namespace across several auctioneer
+ * 	backends while speaking the ordinary client protocol.
+ * Author: Hamza
+ */
+
+#include <csse2310a4.h>
+#include <csse2310a3.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "transport.h"
+
+#define LISTENON "--listenon"
+#define BACKEND "--backend"
+
+#define DEFAULT_PORT "0"
+#define MIN_PORT 1024
+#define MAX_PORT 65535
+
+// Notifications a backend may send at any time, as opposed to replies.
+#define NUM_OF_NOTIFICATIONS 6
+#define LIST_REPLY ":list "
+#define HISTORY_REPLY ":history "
+#define SELL_BATCH_REPLY ":sellbatch"
+
+// Error messages
+#define USAGE_ERR_MSG "Usage: auctionrouter " \
+    "[--listenon portnumber|unix:path] " \
+    "--backend endpoint [--backend endpoint ...]\n"
+#define PORT_CONNECT_ERR_MSG "auctionrouter: unable to listen on port\n"
+#define BACKEND_ERR_MSG "auctionrouter: unable to connect to backend %s\n"
+
+// Exit codes for program
+enum ExitCodes {
+    USAGE_ERR = 10,
+    PORT_CONNECT_ERR = 17,
+    BACKEND_ERR = 18
+};
+
+typedef struct {
+    const char* portNumber;
+    int socketFd;
+    int numOfBackends;
+    const char** backends;
+} ProgramParameters;
+
+typedef struct Session Session;
+
+// One connection from a session to a backend auctioneer. Once the backend
+// has hung up it is gone, and commands for it are not sent.
+typedef struct {
+    Session* session;
+    int fd;
+    FILE* input;
+    FILE* output;
+    pthread_t tid;
+    sem_t replyReady;
+    char* reply;
+    bool gone;
+} Backend;
+
+// A client of the router, with its own connection to every backend so the
+// backends see it as a distinct client.
+struct Session {
+    ProgramParameters* parameters;
+    int clientFd;
+    FILE* input;
+    FILE* output;
+    sem_t outputLock;
+    Backend* backends;
+};
+
+// Function prototypes
+void check_args(int argc, char** argv, ProgramParameters* parameters);
+int create_socket(const char* portNumber);
+void print_port_and_listen(ProgramParameters* parameters);
+void init_lock(sem_t* lock);
+void take_lock(sem_t* lock);
+void release_lock(sem_t* lock);
+void* route_client(void* session);
+bool open_backends(Session* session);
+void close_backends(Session* session);
+void* read_backend(void* backend);
+bool is_notification(const char* line);
+unsigned int hash_item(const char* item);
+void route_command(Session* session, char* line);
+void route_sell_batch(Session* session, int length, char** splitLine);
+void route_to_all(Session* session, const char* line, const char* reply);
+char* forward_command(Backend* backend, const char* line);
+void send_to_client(Session* session, const char* line);
+
+/* init_lock()
+ * -----------
+ * Initialises the semaphore lock.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void init_lock(sem_t* lock) {
+    sem_init(lock, 0, 1);
+}
+
+/* take_lock()
+ * -----------
+ * Locks other threads from accessing shared data struct.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void take_lock(sem_t* lock) {
+    sem_wait(lock);
+}
+
+/* release_lock()
+ * -----------
+ * Allows other threads to access shared data struct.
+ *
+ * lock: a pointer to the semaphore lock variable.
+ *
+ * Returns: void
+ */
+void release_lock(sem_t* lock) {
+    sem_post(lock);
+}
+
+int main(int argc, char** argv) {
+    ProgramParameters* parameters = malloc(sizeof(ProgramParameters));
+    check_args(argc, argv, parameters);
+
+    // A backend going away must not take the router down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Make sure every backend is reachable before accepting clients.
+    for (int i = 0; i < parameters->numOfBackends; i++) {
+	int fd = connect_endpoint(parameters->backends[i]);
+	if (fd < 0) {
+	    fprintf(stderr, BACKEND_ERR_MSG, parameters->backends[i]);
+	    exit(BACKEND_ERR);
+	}
+	close(fd);
+    }
+
+    parameters->socketFd = create_socket(parameters->portNumber);
+    print_port_and_listen(parameters);
+
+    // Accept connections from clients.
+    while (1) {
+	int clientFd = accept(parameters->socketFd, NULL, NULL);
+	if (clientFd < 0) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	Session* session = malloc(sizeof(Session));
+	session->parameters = parameters;
+	session->clientFd = clientFd;
+
+	pthread_t clientTid;
+	pthread_create(&clientTid, NULL, route_client, session);
+	pthread_detach(clientTid);
+    }
+    return 0;
+}
+
+/* route_client()
+ * --------------
+ * A function for the thread for each client, which connects to every backend
+ * 	and routes the client's commands to them until the client leaves.
+ *
+ * session: a null pointer to the client's session.
+ *
+ * Returns: empty null pointer
+ */
+void* route_client(void* arg) {
+    Session* session = (Session*) arg;
+    session->input = fdopen(session->clientFd, "r");
+    session->output = fdopen(dup(session->clientFd), "w");
+    init_lock(&session->outputLock);
+
+    if (open_backends(session)) {
+	char* line;
+	while ((line = read_line(session->input))) {
+	    route_command(session, line);
+	    free(line);
+	}
+	close_backends(session);
+    }
+
+    fclose(session->input);
+    fclose(session->output);
+    sem_destroy(&session->outputLock);
+    free(session);
+    return NULL;
+}
+
+/* open_backends()
+ * ---------------
+ * Connects a session to every backend and starts a thread reading each one.
+ *
+ * session: the session to connect.
+ *
+ * Returns: true if every backend was connected, false otherwise, in which
+ * 	case no connection is left open.
+ */
+bool open_backends(Session* session) {
+    ProgramParameters* parameters = session->parameters;
+    session->backends = malloc(sizeof(Backend) * parameters->numOfBackends);
+    for (int i = 0; i < parameters->numOfBackends; i++) {
+	session->backends[i].fd = connect_endpoint(parameters->backends[i]);
+	if (session->backends[i].fd < 0) {
+	    for (int j = 0; j < i; j++) {
+		close(session->backends[j].fd);
+	    }
+	    free(session->backends);
+	    return false;
+	}
+    }
+    for (int i = 0; i < parameters->numOfBackends; i++) {
+	Backend* backend = &session->backends[i];
+	backend->session = session;
+	backend->input = fdopen(backend->fd, "r");
+	backend->output = fdopen(dup(backend->fd), "w");
+	backend->reply = NULL;
+	backend->gone = false;
+	sem_init(&backend->replyReady, 0, 0);
+	pthread_create(&backend->tid, NULL, read_backend, backend);
+    }
+    return true;
+}
+
+/* close_backends()
+ * ----------------
+ * Disconnects a session from every backend and waits for the threads reading
+ * 	them to finish.
+ *
+ * session: the session to disconnect.
+ *
+ * Returns: void
+ */
+void close_backends(Session* session) {
+    for (int i = 0; i < session->parameters->numOfBackends; i++) {
+	shutdown(session->backends[i].fd, SHUT_RDWR);
+    }
+    for (int i = 0; i < session->parameters->numOfBackends; i++) {
+	Backend* backend = &session->backends[i];
+	pthread_join(backend->tid, NULL);
+	fclose(backend->input);
+	fclose(backend->output);
+	sem_destroy(&backend->replyReady);
+    }
+    free(session->backends);
+}
+
+/* read_backend()
+ * --------------
+ * A function for the thread reading each backend connection. Notifications
+ * 	are passed straight on to the client and replies are handed to the
+ * 	session's thread, which is waiting for them.
+ *
+ * backend: a null pointer to the backend connection to read.
+ *
+ * Returns: empty null pointer
+ */
+void* read_backend(void* arg) {
+    Backend* backend = (Backend*) arg;
+    char* line;
+    while ((line = read_line(backend->input))) {
+	if (is_notification(line)) {
+	    send_to_client(backend->session, line);
+	    free(line);
+	} else {
+	    backend->reply = line;
+	    sem_post(&backend->replyReady);
+	}
+    }
+    // Backend has gone: wake any waiting command, stop later ones from
+    // waiting, and hang up on the client.
+    backend->reply = NULL;
+    __atomic_store_n(&backend->gone, true, __ATOMIC_RELEASE);
+    sem_post(&backend->replyReady);
+    shutdown(backend->session->clientFd, SHUT_RD);
+    return NULL;
+}
+
+/* is_notification()
+ * -----------------
+ * Checks whether a line from a backend is an unsolicited notification.
+ *
+ * line: the line from the backend.
+ *
+ * Returns: true for :outbid, :won, :sold and :unsold lines, and the
+ * 	:leading and :cleared lines sent when a batch item is cleared.
+ */
+bool is_notification(const char* line) {
+    const char* notifications[NUM_OF_NOTIFICATIONS] =
+	    {":outbid ", ":won ", ":sold ", ":unsold ", ":leading ",
+	    ":cleared "};
+    for (int i = 0; i < NUM_OF_NOTIFICATIONS; i++) {
+	if (strncmp(line, notifications[i], strlen(notifications[i])) == 0) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* hash_item()
+ * -----------
+ * Hashes an item name to pick the backend which owns it (FNV-1a).
+ *
+ * item: the item name.
+ *
+ * Returns: the hash of the name.
+ */
+unsigned int hash_item(const char* item) {
+    unsigned int hash = 2166136261u;
+    for (const char* c = item; *c != '\0'; c++) {
+	hash ^= (unsigned char) *c;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* route_command()
+ * ---------------
+ * Sends a client command to the backend owning its item and relays the
+ * 	reply. A list or history is sent to every backend and the replies
+ * 	merged, and a sellbatch is split between the backends owning its
+ * 	items. A delta
+ * 	list is rejected with more than one backend, as each backend numbers
+ * 	its own versions. Anything else goes to the first backend, which
+ * 	validates it as usual.
+ *
+ * session: the client's session.
+ * line: the command from the client.
+ *
+ * Returns: void
+ */
+void route_command(Session* session, char* line) {
+    int numOfBackends = session->parameters->numOfBackends;
+    char* copy = strdup(line);
+    char** splitLine = split_by_char(copy, ' ', 0);
+    int length = 0;
+    for (int i = 0; splitLine[i] != NULL; i++) {
+	length++;
+    }
+
+    if (strcmp(splitLine[0], "list") == 0 && length == 1) {
+	route_to_all(session, line, LIST_REPLY);
+    } else if (strcmp(splitLine[0], "history") == 0) {
+	route_to_all(session, line, HISTORY_REPLY);
+    } else if (strcmp(splitLine[0], "sellbatch") == 0 && length >= 4
+	    && (length - 1) % 3 == 0) {
+	route_sell_batch(session, length, splitLine);
+    } else if (strcmp(splitLine[0], "delta") == 0 && numOfBackends > 1) {
+	send_to_client(session, ":rejected");
+    } else {
+	int backendId = 0;
+	if ((strcmp(splitLine[0], "sell") == 0
+		|| strcmp(splitLine[0], "bid") == 0) && length > 1) {
+	    backendId = hash_item(splitLine[1]) % numOfBackends;
+	}
+	char* reply = forward_command(&session->backends[backendId], line);
+	if (reply != NULL) {
+	    send_to_client(session, reply);
+	    free(reply);
+	}
+    }
+    free(splitLine);
+    free(copy);
+}
+
+/* route_to_all()
+ * --------------
+ * Sends a command to every backend, then merges the entries of their
+ * 	replies into one reply, in backend order. If no backend gives the
+ * 	expected reply, e.g. as the command is invalid, the first backend's
+ * 	reply is passed on instead.
+ *
+ * session: the client's session.
+ * line: the command from the client.
+ * reply: the start of the expected reply, which the entries follow.
+ *
+ * Returns: void
+ */
+void route_to_all(Session* session, const char* line, const char* reply) {
+    int numOfBackends = session->parameters->numOfBackends;
+    char* merged = strdup(reply);
+    char* other = NULL;
+    bool matched = false;
+    for (int i = 0; i < numOfBackends; i++) {
+	char* backendReply = forward_command(&session->backends[i], line);
+	if (backendReply == NULL) {
+	    continue;
+	}
+	if (strncmp(backendReply, reply, strlen(reply)) == 0) {
+	    const char* entries = backendReply + strlen(reply);
+	    merged = realloc(merged, strlen(merged) + strlen(entries) + 1);
+	    strcat(merged, entries);
+	    matched = true;
+	    free(backendReply);
+	} else if (other == NULL) {
+	    other = backendReply;
+	} else {
+	    free(backendReply);
+	}
+    }
+    send_to_client(session, matched || other == NULL ? merged : other);
+    free(merged);
+    free(other);
+}
+
+/* route_sell_batch()
+ * ------------------
+ * Splits the listings of a sellbatch command between the backends owning
+ * 	their items, then puts the results back in the order they were given.
+ *
+ * session: the client's session.
+ * length: the number of words in the command.
+ * splitLine: the words of the command, holding a name, reserve and duration
+ * 	for each listing.
+ *
+ * Returns: void
+ */
+void route_sell_batch(Session* session, int length, char** splitLine) {
+    int numOfBackends = session->parameters->numOfBackends;
+    int numOfListings = (length - 1) / 3;
+    int* owners = malloc(sizeof(int) * numOfListings);
+    const char** results = malloc(sizeof(char*) * numOfListings);
+    for (int i = 0; i < numOfListings; i++) {
+	owners[i] = hash_item(splitLine[1 + 3 * i]) % numOfBackends;
+	results[i] = "rejected";
+    }
+
+    char** replies = calloc(numOfBackends, sizeof(char*));
+    for (int b = 0; b < numOfBackends; b++) {
+	// Build this backend's share of the batch.
+	size_t size = strlen("sellbatch") + 1;
+	for (int i = 0; i < numOfListings; i++) {
+	    for (int j = 1; j <= 3 && owners[i] == b; j++) {
+		size += strlen(splitLine[3 * i + j]) + 1;
+	    }
+	}
+	char* command = malloc(size);
+	char* end = stpcpy(command, "sellbatch");
+	bool owned = false;
+	for (int i = 0; i < numOfListings; i++) {
+	    for (int j = 1; j <= 3 && owners[i] == b; j++) {
+		end = stpcpy(stpcpy(end, " "), splitLine[3 * i + j]);
+		owned = true;
+	    }
+	}
+	if (owned) {
+	    replies[b] = forward_command(&session->backends[b], command);
+	}
+	free(command);
+	if (replies[b] == NULL || strncmp(replies[b], SELL_BATCH_REPLY,
+		strlen(SELL_BATCH_REPLY)) != 0) {
+	    continue;
+	}
+
+	// Hand out the backend's results to its listings in order.
+	char** words = split_by_char(replies[b], ' ', 0);
+	int word = 1;
+	for (int i = 0; i < numOfListings && words[word]; i++) {
+	    if (owners[i] == b) {
+		results[i] = words[word++];
+	    }
+	}
+	free(words);
+    }
+
+    size_t size = strlen(SELL_BATCH_REPLY) + 1;
+    for (int i = 0; i < numOfListings; i++) {
+	size += strlen(results[i]) + 1;
+    }
+    char* merged = malloc(size);
+    char* end = stpcpy(merged, SELL_BATCH_REPLY);
+    for (int i = 0; i < numOfListings; i++) {
+	end = stpcpy(stpcpy(end, " "), results[i]);
+    }
+    send_to_client(session, merged);
+
+    free(merged);
+    for (int b = 0; b < numOfBackends; b++) {
+	free(replies[b]);
+    }
+    free(replies);
+    free(results);
+    free(owners);
+}
+
+/* forward_command()
+ * -----------------
+ * Sends a command to a backend and waits for its reply.
+ *
+ * backend: the backend connection to use.
+ * line: the command to send.
+ *
+ * Returns: the reply, which the caller must free, or NULL if the backend has
+ * 	gone.
+ */
+char* forward_command(Backend* backend, const char* line) {
+    // Only one waiting command is woken when the backend goes, so any
+    // after it must not wait.
+    if (__atomic_load_n(&backend->gone, __ATOMIC_ACQUIRE)) {
+	return NULL;
+    }
+    fprintf(backend->output, "%s\n", line);
+    fflush(backend->output);
+    sem_wait(&backend->replyReady);
+    char* reply = backend->reply;
+    backend->reply = NULL;
+    return reply;
+}
+
+/* send_to_client()
+ * ----------------
+ * Writes a line to the client. Replies and notifications come from different
+ * 	threads, so writes are serialised.
+ *
+ * session: the client's session.
+ * line: the line to send, without newline.
+ *
+ * Returns: void
+ */
+void send_to_client(Session* session, const char* line) {
+    take_lock(&session->outputLock);
+    fprintf(session->output, "%s\n", line);
+    fflush(session->output);
+    release_lock(&session->outputLock);
+}
+
+/* check_args()
+ * ------------
+ * Checks the command line arguments and stores them in parameters.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 10 and usage error message if an argument is
+ * 	unknown, missing its value, or repeated (other than --backend), if the
+ * 	port is invalid, or if no backend is given.
+ */
+void check_args(int argc, char** argv, ProgramParameters* parameters) {
+    parameters->portNumber = NULL;
+    parameters->numOfBackends = 0;
+    parameters->backends = malloc(sizeof(char*) * argc);
+    if (argc % 2 == 0) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    for (int i = 1; i < argc; i += 2) {
+	if (strcmp(argv[i], BACKEND) == 0) {
+	    parameters->backends[parameters->numOfBackends++] = argv[i + 1];
+	} else if (strcmp(argv[i], LISTENON) == 0
+		&& parameters->portNumber == NULL) {
+	    parameters->portNumber = argv[i + 1];
+	} else {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+    }
+    if (parameters->numOfBackends == 0) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    if (parameters->portNumber == NULL) {
+	parameters->portNumber = DEFAULT_PORT;
+    } else if (!is_unix_endpoint(parameters->portNumber)) {
+	// Check if port number is a valid number.
+	char* remainderText;
+	int portNumber = strtol(parameters->portNumber, &remainderText, 10);
+	if (strlen(remainderText) != 0 || ((portNumber < MIN_PORT
+		|| portNumber > MAX_PORT) && portNumber != 0)) {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+    }
+}
+
+/* create_socket()
+ * ---------------
+ * Creates a socket with the specified port number and makes a file descriptor
+ * 	for it.
+ *
+ * portNumber: the portnumber specified in the command line, ephemeral port
+ * 	number, or a unix:path endpoint.
+ *
+ * Returns: the file descriptor of the socket.
+ * Errors: Exits with status 17 and connect error message if it cannot connect
+ * 	to the port.
+ */
+int create_socket(const char* portNumber) {
+    if (is_unix_endpoint(portNumber)) {
+	int fd = create_unix_listener(unix_endpoint_path(portNumber));
+	if (fd < 0) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	return fd;
+    }
+
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET; // IPv4
+    hints.ai_socktype = SOCK_STREAM; // TCP
+    hints.ai_flags = AI_PASSIVE; // Bind with all interfaces
+
+    if (getaddrinfo("localhost", portNumber, &hints, &ai)) {
+	fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	exit(PORT_CONNECT_ERR);
+    }
+
+    // Create socket, make port reusable and bind to it.
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, ai->ai_addr, sizeof(struct sockaddr))) {
+	fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	exit(PORT_CONNECT_ERR);
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* print_port_and_listen()
+ * -----------------------
+ * Prints the port number (or unix socket path) and starts listening for
+ * 	connections from clients.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 17 and connect error message if it cannot listen.
+ */
+void print_port_and_listen(ProgramParameters* parameters) {
+    if (is_unix_endpoint(parameters->portNumber)) {
+	fprintf(stderr, "%s\n", unix_endpoint_path(parameters->portNumber));
+    } else {
+	struct sockaddr_in ad;
+	memset(&ad, 0, sizeof(struct sockaddr_in));
+	socklen_t len = sizeof(struct sockaddr_in);
+	if (getsockname(parameters->socketFd, (struct sockaddr*) &ad, &len)) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	fprintf(stderr, "%d\n", ntohs(ad.sin_port));
+    }
+    fflush(stderr);
+
+    if (listen(parameters->socketFd, SOMAXCONN)) {
+	fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	exit(PORT_CONNECT_ERR);
+    }
+}
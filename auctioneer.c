@@ -4,21 +4,101 @@
  * Author: Hamza
  */
 
+#define _GNU_SOURCE
+
 #include <csse2310a4.h>
 #include <csse2310a3.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
-
-#define MAX_ARGS 5
-#define NUM_OF_VALID_ARGS 2
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <errno.h>
+#include "transport.h"
+#include "capture.h"
+#include "auction.h"
+#include "trace.h"
+#include "placement.h"
+
+#define MAX_ARGS 23
+#define NUM_OF_VALID_ARGS 12
 #define MAXCONN "--maxconn"
 #define LISTENON "--listenon"
+#define PRIMARY_ENDPOINT "--primary"
+#define REPLICA_OF "--replicaof"
+#define CLOCK "--clock"
+#define RECORD "--record"
+#define PRELOAD "--preload"
+#define HANDOFF "--handoff"
+#define TAKEOVER "--takeover"
+#define LIMITS "--limits"
+#define ARCHIVE "--archive"
+#define PLACEMENT "--placement"
+
+// Values for --clock.
+#define REAL_CLOCK "real"
+#define VIRTUAL_CLOCK "virtual"
+
+// Stack each client thread is started with, which is plenty for the
+// commands and keeps thousands of connections affordable.
+#define CLIENT_STACK_SIZE (256 << 10)
+
+// Memory accounted for each connection and each session, beyond what they
+// have read: the thread, its streams and its entries in the tables, and a
+// session's client, stream and the partial line it buffers.
+#define CONNECTION_MEMORY (CLIENT_STACK_SIZE + sizeof(Connection) \
+	+ sizeof(Client) + sizeof(FILE) + BUFSIZ)
+#define SESSION_MEMORY 512
+
+// Shared memory of a connection moved onto the ring transport.
+#define SHM_MEMORY (2 * SHM_RING_SIZE)
+
+// How long a connection held back by the memory budget waits before
+// checking again.
+#define THROTTLE_US 10000
+
+// How often the timer thread does its periodic work when no auction closes
+// sooner.
+#define TIMER_TICK_MS 100
+
+// How often closed auctions are appended to the archive.
+#define ARCHIVE_FLUSH_US 100000
+
+// Item versions start at the wall clock in milliseconds shifted up by this.
+#define VERSIONS_PER_MS_BITS 20
+
+// Sessions a multiplexed connection has room for before its table grows.
+#define MIN_SESSION_CAPACITY 16
+
+// Bytes read from a client socket at a time.
+#define READ_CHUNK 4096
+
+// Hot restart: the signal which interrupts threads waiting for input, how
+// often the handing over thread checks that they have all stopped, and the
+// first line the predecessor sends and the line the successor replies with.
+#define HANDOFF_SIGNAL SIGUSR2
+#define HANDOFF_POLL_US 1000
+#define HANDOFF_HEADER "handoff"
+#define HANDOFF_DONE "ok"
+
+// Words in an item line of a handoff, which has grown over time: the first
+// form, then with when the item opened, its batch clearing interval, and its
+// soft close window and extension (both words were added at once).
+#define ITEM_WORDS 11
+#define ITEM_WORDS_OPEN_TIME 12
+#define ITEM_WORDS_BATCH 13
+#define ITEM_WORDS_SOFT_CLOSE 15
 
 #define DEFAULT_PORT "0"
 #define MIN_PORT 1024
@@ -26,150 +106,204 @@
 
 // Error messages
 #define USAGE_ERR_MSG "Usage: auctioneer [--maxconn num-connections] " \
-    "[--listenon portnumber]\n"
+    "[--listenon portnumber|unix:path] " \
+    "[--primary endpoint] [--replicaof endpoint] [--clock real|virtual] " \
+    "[--record capture-file] [--preload catalog-file] " \
+    "[--handoff path] [--takeover path] " \
+    "[--limits line=N,name=N,conn=N,memory=N,idle=ms] " \
+    "[--archive archive-file] " \
+    "[--placement cpus=list,node=N,huge=thp|explicit|off]\n"
 #define PORT_CONNECT_ERR_MSG "auctioneer: unable to listen on port\n"
+#define PRIMARY_CONNECT_ERR_MSG "auctioneer: unable to connect to primary\n"
+#define PRELOAD_ERR_MSG "auctioneer: unable to preload catalog %s\n"
+#define CATALOG_LINE_ERR_MSG "auctioneer: bad catalog line %d\n"
+#define TRACE_ERR_MSG "auctioneer: unable to write trace %s\n"
+#define TAKEOVER_ERR_MSG "auctioneer: unable to take over from %s\n"
+#define ARCHIVE_ERR_MSG "auctioneer: unable to write archive %s\n"
+
+// Where the flight recorder is dumped, by process ID.
+#define TRACE_FILE_FORMAT "auctioneer-%d.trace.json"
 
 // Exit codes for program
 enum ExitCodes {
     USAGE_ERR = 10,
-    PORT_CONNECT_ERR = 17
+    PORT_CONNECT_ERR = 17,
+    PRIMARY_CONNECT_ERR = 18,
+    PRELOAD_ERR = 19,
+    TAKEOVER_ERR = 20
 };
 
+// A logical client on a multiplexed connection.
 typedef struct {
-    pthread_t tid;
-    int clientFd;
-    FILE* input;
+    int clientIndex;
     FILE* output;
-} Client;
+} Session;
 
+// The sessions seen so far on a multiplexed connection, by session ID. A
+// session which has not been seen has no output.
 typedef struct {
-    Client seller;
-    bool sellerActive;
-    char* item;
-    int reserve;
-    int duration;
-    bool highestBidder;
-    int highestBid;
-    double expiryTime;
-    Client topBidder;
-    bool bidderActive;
-} ItemList;
-
-typedef struct {
-    sem_t* lock;
-    int numConnections;
-    const char* portNumber;
-    int socketFd;
-    int numOfItems;
-    ItemList* items;
-    int numOfClients;
-    int numOfActiveClients;
-    Client* clients;
-    int numOfExited;
-    pthread_t* exitedTids;
-} ProgramParameters;
+    Session* sessions;
+    int capacity;
+} SessionTable;
+
+// A client connection, which its thread is started with. Input is read into
+// pending, where lines from start up to length have arrived but not been
+// handled; while discarding, the rest of a line which was too long is
+// dropped as it arrives. Connections are listed in parameters->handoff, at
+// slot, while their socket can be handed to a successor, and slot is -1
+// after. Memory the connection's clients use is charged to charged, and
+// lastActive is when it last sent a line.
+struct Connection {
+    ProgramParameters* parameters;
+    int clientIndex;
+    int slot;
+    int fd;
+    pthread_t tid;
+    bool restored;
+    bool shm;
+    bool multiplexed;
+    bool parked;
+    SessionTable table;
+    char* pending;
+    size_t start;
+    size_t length;
+    size_t capacity;
+    bool discarding;
+    long charged;
+    long lastActive;
+    bool reaped;
+};
+typedef struct Connection Connection;
 
 // Function prototypes
 void check_argc(int argc); 
 void check_valid_args(int argc, char** argv); 
 int get_num_connections(int argc, char** argv);
 const char* get_port_number(int argc, char** argv);
+const char* get_endpoint(int argc, char** argv, const char* option);
+const char* get_arg(int argc, char** argv, const char* option);
+void init_clock(int argc, char** argv, ProgramParameters* parameters);
+void init_limits(int argc, char** argv, ProgramParameters* parameters);
+void init_archive(int argc, char** argv, ProgramParameters* parameters);
+void init_placement(int argc, char** argv);
+void* write_archive(void* params);
+bool parse_limit(const char* value, long* limit);
 void init_params(int argc, char** argv, ProgramParameters* parameters);
+void preload_catalog(int argc, char** argv, ProgramParameters* parameters);
+bool preload_line(ProgramParameters* parameters, char* line);
 void init_client(ProgramParameters* parameters, int clientFd);
-void init_lock(sem_t* lock);
-void take_lock(sem_t* lock);
-void release_lock(sem_t* lock);
+Connection* add_connection(ProgramParameters* parameters, int clientFd);
+void remove_connection(ProgramParameters* parameters,
+	Connection* connection);
 int create_socket(const char* portNumber); 
 void print_port_and_listen(ProgramParameters* parameters);
 void* check_time(void* params);
-void* auction_client(void* fd);
-void check_input(int length, char** splitLine, ProgramParameters* parameters,
-	FILE* output, int clientIndex);
-void check_sell(char** splitLine, ProgramParameters* parameters,
-	Client client);
-bool validate_bid_input(char** splitLine, ProgramParameters* parameters,
-	Client client);
-int find_item(char** splitLine, ProgramParameters* parameters,
-	FILE* outputClient);
-void list_all_items(ProgramParameters* parameters, FILE* outputClient);
-void place_bid(char** splitLine, ProgramParameters* parameters,
-	Client client);
-void remove_item(ProgramParameters* parameters, int itemIndex);
-
-/* init_lock()
- * -----------
- * Initialises the semaphore lock.
- *
- * lock: a pointer to the semaphore lock variable.
- *
- * Returns: void
- */
-void init_lock(sem_t* lock) {
-    sem_init(lock, 0, 1);
-}
-
-/* take_lock()
- * -----------
- * Locks other threads from accessing shared data struct.
- *
- * lock: a pointer to the semaphore lock variable.
- *
- * Returns: void
- */
-void take_lock(sem_t* lock) {
-    sem_wait(lock);
-}
-
-/* release_lock()
- * -----------
- * Allows other threads to access shared data struct.
- *
- * lock: a pointer to the semaphore lock variable.
- *
- * Returns: void
- */
-void release_lock(sem_t* lock) {
-    sem_post(lock);
-}
+void reap_idle(ProgramParameters* parameters);
+void request_trace(int signal);
+void record_command(ProgramParameters* parameters, const char* type,
+	int clientIndex, const char* line);
+void* auction_client(void* thread);
+bool serve_unlocked(ProgramParameters* parameters, int reader,
+	int clientIndex, char* command, FILE* output);
+char* read_command(Connection* connection, FILE* input);
+char* read_bounded_line(FILE* input, long maxLine);
+void resize_input(Connection* connection, size_t capacity);
+void throttle_input(Connection* connection);
+bool wait_for_input(ProgramParameters* parameters, int fd);
+bool park_for_handoff(ProgramParameters* parameters, bool* parked);
+void handoff_interrupt(int signal);
+Session* find_session(ProgramParameters* parameters, Connection* connection,
+	FILE* output, int session);
+Session* add_session(ProgramParameters* parameters, Connection* connection,
+	FILE* output, int session);
+void close_sessions(ProgramParameters* parameters, SessionTable* table);
+int session_capacity(SessionTable* table, int session);
+void upgrade_to_shm(ProgramParameters* parameters, Connection* connection,
+	FILE** input, FILE** output);
+void init_handoff(int argc, char** argv, ProgramParameters* parameters);
+void* accept_successor(void* params);
+void hand_over(ProgramParameters* parameters, int fd);
+bool send_state(ProgramParameters* parameters, int fd);
+int handed_client(ProgramParameters* parameters, int* connectionOfFd,
+	int maxFd, Client client, bool active);
+bool take_over(ProgramParameters* parameters, const char* path);
+void adopt_listener(ProgramParameters* parameters);
+Connection* restore_connection(ProgramParameters* parameters, FILE* state,
+	int clientFd);
+bool restore_item(ProgramParameters* parameters, Connection** connections,
+	int numOfConnections, char* line);
+bool restored_client(ProgramParameters* parameters, Connection** connections,
+	int numOfConnections, int index, int session, Client* client);
+void init_replication(ProgramParameters* parameters);
+bool start_accepting_replicas(ProgramParameters* parameters);
+void* accept_replicas(void* params);
+void* ship_events(void* link);
+void* follow_primary(void* params);
+bool parse_event_header(const char* line, ReplicationEvent* event);
+void* apply_events(void* params);
 
 int main(int argc, char** argv) {
     check_argc(argc);
     check_valid_args(argc, argv);
     ProgramParameters* parameters = malloc(sizeof(ProgramParameters));
     init_params(argc, argv, parameters);
-    print_port_and_listen(parameters);
+
+    // A client or replica hanging up must not take the auctioneer down.
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1 dumps the flight recorder.
+    static char tracePath[64];
+    snprintf(tracePath, sizeof(tracePath), TRACE_FILE_FORMAT, getpid());
+    trace_init(tracePath);
+    signal(SIGUSR1, request_trace);
 
     sem_t lock;
     init_lock(&lock);
     parameters->lock = &lock;
+    init_handoff(argc, argv, parameters);
+    init_archive(argc, argv, parameters);
+    print_port_and_listen(parameters);
+    init_replication(parameters);
 
     // Start thread for checking time expiry.
+    sem_t timerWake;
+    sem_init(&timerWake, 0, 0);
+    parameters->timerWake = &timerWake;
     pthread_t timeTid;
     pthread_create(&timeTid, NULL, check_time, parameters);
 
     // Accept connections from clients.
     int clientFd;
-    struct sockaddr_in fromAddr;
+    struct sockaddr_storage fromAddr;
     socklen_t fromAddrSize;
     while (1) {
 	if (parameters->numConnections != -1) {
-	    while (1) {
-		take_lock(parameters->lock);
+	    while (!__atomic_load_n(&parameters->handoff.active,
+		    __ATOMIC_ACQUIRE)) {
+		take_traced_lock(parameters->lock);
 		if (parameters->numOfActiveClients 
 			< parameters->numConnections) {
-		    release_lock(parameters->lock);
+		    release_traced_lock(parameters->lock);
 		    break;
 		}
-		release_lock(parameters->lock);
+		release_traced_lock(parameters->lock);
 		usleep(100000);
 	    }
 	}
 
-	fromAddrSize = sizeof(struct sockaddr_in);
+	// Stop accepting while a successor takes over.
+	if (!wait_for_input(parameters, parameters->socketFd)) {
+	    park_for_handoff(parameters, &parameters->handoff.acceptorParked);
+	    continue;
+	}
+	fromAddrSize = sizeof(struct sockaddr_storage);
 	
 	// Wait for new connection.
 	clientFd = accept(parameters->socketFd, (struct sockaddr*) &fromAddr,
 		&fromAddrSize);
+	if (clientFd < 0 && errno == EINTR) {
+	    continue;
+	}
 	if (clientFd < 0) {
 	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
 	    exit(PORT_CONNECT_ERR);
@@ -195,15 +329,380 @@ int main(int argc, char** argv) {
 void init_params(int argc, char** argv, ProgramParameters* parameters) {
     parameters->numConnections = get_num_connections(argc, argv);
     parameters->portNumber = get_port_number(argc, argv);
-    parameters->socketFd = create_socket(parameters->portNumber);
+    parameters->unixSocket = is_unix_endpoint(parameters->portNumber);
+    // A successor is given its predecessor's socket instead.
+    parameters->socketFd = get_arg(argc, argv, TAKEOVER) ? -1
+	    : create_socket(parameters->portNumber);
     parameters->numOfItems = 0;
-    parameters->items = malloc(sizeof(ItemList) * parameters->numOfItems);
+    parameters->itemCapacity = 0;
+    parameters->items = NULL;
+    parameters->expiries = NULL;
+    parameters->numOfExpiries = 0;
+    parameters->indexCapacity = 0;
+    parameters->itemIndex = NULL;
+    // Versions carry on from the wall clock, so that one a client saw
+    // before a restart cannot be mistaken for a current one.
+    parameters->itemsVersion = (unsigned long) get_wall_time_ms()
+	    << VERSIONS_PER_MS_BITS;
+    parameters->view = NULL;
+    parameters->viewWanted = false;
+    parameters->viewChunkCapacity = 0;
+    parameters->viewChunkChanged = NULL;
+    parameters->viewMovedFrom = 0;
+    parameters->batches = NULL;
+    parameters->closed.entries = NULL;
+    parameters->closed.numOfEntries = 0;
+    parameters->closed.floor = parameters->itemsVersion;
+    epoch_init(&parameters->epoch);
     parameters->numOfClients = 0;
     parameters->numOfActiveClients = 0;
     parameters->clients = malloc(sizeof(Client) * parameters->numOfClients);
     parameters->numOfExited = 0;
     parameters->exitedTids = malloc(sizeof(pthread_t) *
 	    parameters->numOfExited);
+    parameters->primaryEndpoint = get_endpoint(argc, argv, PRIMARY_ENDPOINT);
+    parameters->replicaOf = get_endpoint(argc, argv, REPLICA_OF);
+    parameters->role = parameters->replicaOf ? REPLICA : PRIMARY;
+    parameters->replicationFd = -1;
+    parameters->replicaListenFd = -1;
+    parameters->numOfReplicas = 0;
+    parameters->replicas = NULL;
+    parameters->eventSeq = 0;
+    parameters->handoff.path = get_arg(argc, argv, HANDOFF);
+    parameters->handoff.listenFd = -1;
+    parameters->handoff.numOfConnections = 0;
+    parameters->handoff.connections = NULL;
+    init_clock(argc, argv, parameters);
+    init_limits(argc, argv, parameters);
+    init_placement(argc, argv);
+    preload_catalog(argc, argv, parameters);
+}
+
+/* init_clock()
+ * ------------
+ * Sets up the clock used for auction times and, if asked for, the file
+ * 	that inbound commands are recorded to.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 10 and usage error message if the clock is not
+ * 	real or virtual, or if the capture file cannot be opened.
+ */
+void init_clock(int argc, char** argv, ProgramParameters* parameters) {
+    const char* clock = get_arg(argc, argv, CLOCK);
+    if (clock && strcmp(clock, REAL_CLOCK) != 0
+	    && strcmp(clock, VIRTUAL_CLOCK) != 0) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    // A virtual clock starts at zero and only moves on an advance command.
+    parameters->virtualClock = clock && strcmp(clock, VIRTUAL_CLOCK) == 0;
+    parameters->virtualTime = 0;
+    parameters->startTime = clock_ms(parameters);
+    // The timer is only woken early once it is running.
+    parameters->timerWake = NULL;
+    parameters->timerDeadline = 0;
+    memset(&parameters->closeTiming, 0, sizeof(CloseTiming));
+
+    parameters->recording = NULL;
+    parameters->archive = NULL;
+    const char* recordFile = get_arg(argc, argv, RECORD);
+    if (recordFile) {
+	parameters->recording = fopen(recordFile, "w");
+	if (parameters->recording == NULL) {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+    }
+}
+
+/* init_archive()
+ * --------------
+ * Opens the archive of closed auctions given with --archive, if any, and
+ * 	starts the thread which writes to it. A successor only opens it once
+ * 	its predecessor has finished writing.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 10 and usage error message if the archive
+ * 	cannot be opened or is not an archive.
+ */
+void init_archive(int argc, char** argv, ProgramParameters* parameters) {
+    const char* path = get_arg(argc, argv, ARCHIVE);
+    if (path == NULL) {
+	return;
+    }
+    Archive* archive = archive_open(path);
+    if (archive == NULL) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    // Items are only closed under the lock, which this cannot be waiting
+    // for, as no other thread has started.
+    parameters->archive = archive;
+    pthread_t tid;
+    pthread_create(&tid, NULL, write_archive, parameters);
+    pthread_detach(tid);
+}
+
+/* write_archive()
+ * ---------------
+ * Function for the thread which appends closed auctions to the archive in
+ * 	batches, so that neither the timer nor the lock waits on the disk.
+ *
+ * params: a null pointer to the struct containing all of program's data.
+ *
+ * Returns: an empty null pointer.
+ */
+void* write_archive(void* params) {
+    ProgramParameters* parameters = (ProgramParameters*) params;
+    trace_name_thread("archive", 0);
+    while (1) {
+	usleep(ARCHIVE_FLUSH_US);
+	if (!archive_flush(parameters->archive)) {
+	    fprintf(stderr, ARCHIVE_ERR_MSG, parameters->archive->path);
+	}
+    }
+    return NULL;
+}
+
+/* init_placement()
+ * ----------------
+ * Sets up where threads run and large arrays live from --placement, if
+ * 	given, and pins the main thread, so that every thread it starts
+ * 	begins on the first CPU given. Must be called before any thread starts
+ * 	and before any items are listed.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ *
+ * Errors: Exits with status 10 and usage error message if the placement is
+ * 	not valid or names CPUs or a node this machine does not have.
+ */
+void init_placement(int argc, char** argv) {
+    const char* spec = get_arg(argc, argv, PLACEMENT);
+    if (spec == NULL) {
+	return;
+    }
+    if (!placement_init(spec)) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+    placement_pin_service();
+}
+
+/* init_limits()
+ * -------------
+ * Sets the limits on what clients may use from --limits, given as
+ * 	comma-separated key=value pairs, e.g.
+ * 	"line=4096,memory=64m,idle=60000". Lines (line) and names (name) are
+ * 	limited in bytes, as are each
+ * 	connection's allowance (conn) and the whole auctioneer's budget
+ * 	(memory), which may be given in k, m or g. Idle connections are hung
+ * 	up on after idle milliseconds. A value of 0 is unlimited, and so is
+ * 	anything not given.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 10 and usage error message if a key is unknown
+ * 	or a value is not a non-negative number.
+ */
+void init_limits(int argc, char** argv, ProgramParameters* parameters) {
+    Limits* limits = &parameters->limits;
+    limits->maxLine = 0;
+    limits->maxName = 0;
+    limits->connectionMemory = 0;
+    limits->memoryBudget = 0;
+    limits->idleMs = 0;
+    memset(parameters->memoryUsed, 0, sizeof(parameters->memoryUsed));
+    parameters->numOfThrottled = 0;
+    parameters->numOfReaped = 0;
+
+    const char* given = get_arg(argc, argv, LIMITS);
+    if (given == NULL) {
+	return;
+    }
+    char* text = strdup(given);
+    for (char* pair = strtok(text, ","); pair; pair = strtok(NULL, ",")) {
+	char* value = strchr(pair, '=');
+	long* limit = NULL;
+	if (value) {
+	    *value++ = '\0';
+	    const char* keys[] = {"line", "name", "conn", "memory", "idle"};
+	    long* fields[] = {&limits->maxLine, &limits->maxName,
+		    &limits->connectionMemory, &limits->memoryBudget,
+		    &limits->idleMs};
+	    for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (strcmp(pair, keys[i]) == 0) {
+		    limit = fields[i];
+		}
+	    }
+	}
+	if (limit == NULL || !parse_limit(value, limit)) {
+	    fprintf(stderr, USAGE_ERR_MSG);
+	    exit(USAGE_ERR);
+	}
+    }
+    free(text);
+}
+
+/* parse_limit()
+ * -------------
+ * Reads the value of one limit, with an optional k, m or g suffix.
+ *
+ * value: the value as given on the command line.
+ * limit: set to the value read.
+ *
+ * Returns: true if the value is a non-negative number, false otherwise.
+ */
+bool parse_limit(const char* value, long* limit) {
+    char* remainderText;
+    long number = strtol(value, &remainderText, 10);
+    const char* suffixes = "kmg";
+    const char* suffix = *remainderText ? strchr(suffixes, *remainderText)
+	    : NULL;
+    if (suffix && remainderText[1] == '\0') {
+	number <<= 10 * (suffix - suffixes + 1);
+    } else if (*remainderText) {
+	return false;
+    }
+    if (remainderText == value || number < 0) {
+	return false;
+    }
+    *limit = number;
+    return true;
+}
+
+/* preload_catalog()
+ * -----------------
+ * Lists every item of a catalog file before any client connects. The file
+ * 	has one "name reserve duration" listing per line and is mapped rather
+ * 	than read, so each line is split in place without copying.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 19 and preload error message if the catalog
+ * 	cannot be read, or has a line which is not a valid new listing.
+ */
+void preload_catalog(int argc, char** argv, ProgramParameters* parameters) {
+    const char* catalog = get_arg(argc, argv, PRELOAD);
+    if (catalog == NULL) {
+	return;
+    }
+    int fd = open(catalog, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	fprintf(stderr, PRELOAD_ERR_MSG, catalog);
+	exit(PRELOAD_ERR);
+    }
+    if (info.st_size == 0) {
+	close(fd);
+	return;
+    }
+    // A private mapping lets lines be cut up without touching the file.
+    char* text = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+	fprintf(stderr, PRELOAD_ERR_MSG, catalog);
+	exit(PRELOAD_ERR);
+    }
+
+    // Size the item store for every line up front.
+    char* end = text + info.st_size;
+    int numOfLines = 1;
+    for (char* c = text; (c = memchr(c, '\n', end - c)); c++) {
+	numOfLines++;
+    }
+    reserve_items(parameters, parameters->numOfItems + numOfLines);
+
+    int lineNum = 0;
+    for (char* line = text; line < end; ) {
+	lineNum++;
+	char* newline = memchr(line, '\n', end - line);
+	bool listed;
+	if (newline) {
+	    *newline = '\0';
+	    listed = preload_line(parameters, line);
+	} else {
+	    // The last line has no newline to terminate it in place.
+	    char* last = strndup(line, end - line);
+	    listed = preload_line(parameters, last);
+	    free(last);
+	}
+	if (!listed) {
+	    fprintf(stderr, CATALOG_LINE_ERR_MSG, lineNum);
+	    exit(PRELOAD_ERR);
+	}
+	line = newline ? newline + 1 : end;
+    }
+    munmap(text, info.st_size);
+}
+
+/* preload_line()
+ * --------------
+ * Lists the item on one line of a catalog file. Preloaded items have no
+ * 	seller to tell when they close.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * line: the line, which is split up in place.
+ *
+ * Returns: true if the line is blank or was listed, false otherwise.
+ */
+bool preload_line(ProgramParameters* parameters, char* line) {
+    char* words[4];
+    int length = 0;
+    for (char* word = strtok(line, " \r"); word; word = strtok(NULL, " \r")) {
+	if (length == 3) {
+	    return false;
+	}
+	words[length++] = word;
+    }
+    if (length == 0) {
+	return true;
+    }
+    if (length != 3) {
+	return false;
+    }
+    Client seller;
+    memset(&seller, 0, sizeof(Client));
+    seller.id = -1;
+    if (list_item(parameters, seller, words[0], words[1], words[2])
+	    != LISTING_LISTED) {
+	return false;
+    }
+    parameters->items[parameters->numOfItems - 1].sellerActive = false;
+    return true;
+}
+
+/* record_command()
+ * ----------------
+ * Appends a record of a client's activity to the capture file, if
+ * 	recording. Must be called with the lock held so records are in the
+ * 	order they were handled.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * type: the kind of record, e.g. CAPTURE_COMMAND.
+ * clientIndex: index of client in the array of client struct.
+ * line: the command for a command record, or NULL.
+ *
+ * Returns: void
+ */
+void record_command(ProgramParameters* parameters, const char* type,
+	int clientIndex, const char* line) {
+    if (parameters->recording) {
+	write_capture_record(parameters->recording, type,
+		clock_ms(parameters) - parameters->startTime, clientIndex,
+		line);
+    }
 }
 
 /* init_client()
@@ -217,20 +716,92 @@ void init_params(int argc, char** argv, ProgramParameters* parameters) {
  * Returns void
  */
 void init_client(ProgramParameters* parameters, int clientFd) {
+    // Client threads use the array, so it may only move under the lock.
+    take_traced_lock(parameters->lock);
+    add_connection(parameters, clientFd);
+    release_traced_lock(parameters->lock);
+}
+
+/* add_connection()
+ * ----------------
+ * Adds a client for a new connection, opens its output stream, and starts
+ * 	its thread. Must be called with the lock held, which the thread waits
+ * 	for before it starts reading.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * clientFd: the file descriptor of the client to read and write to.
+ *
+ * Returns: the connection.
+ */
+Connection* add_connection(ProgramParameters* parameters, int clientFd) {
     parameters->clients = realloc(parameters->clients, sizeof(Client)
 	    * ++(parameters->numOfClients));
-    parameters->clients[parameters->numOfClients - 1].clientFd = clientFd;
+    int clientIndex = parameters->numOfClients - 1;
+    Client* client = &parameters->clients[clientIndex];
+    memset(client, 0, sizeof(Client));
+    client->id = clientIndex;
+    client->clientFd = clientFd;
+    client->output = fdopen(dup(clientFd), "w");
     parameters->numOfActiveClients++;
-    
-    pthread_t clientTid;
-    pthread_create(&clientTid, NULL, auction_client, parameters);
-    pthread_detach(clientTid);
+
+    // The thread is told its index, as more clients may arrive before it
+    // starts.
+    Connection* connection = calloc(1, sizeof(Connection));
+    connection->parameters = parameters;
+    connection->clientIndex = clientIndex;
+    connection->fd = clientFd;
+    connection->lastActive = get_time_ms();
+    client->charged = &connection->charged;
+    account_memory(parameters, MEMORY_CONNECTIONS, CONNECTION_MEMORY);
+    HandoffState* handoff = &parameters->handoff;
+    handoff->connections = realloc(handoff->connections,
+	    sizeof(Connection*) * ++handoff->numOfConnections);
+    connection->slot = handoff->numOfConnections - 1;
+    handoff->connections[connection->slot] = connection;
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, CLIENT_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_create(&connection->tid, &attributes, auction_client,
+	    connection);
+    pthread_attr_destroy(&attributes);
+    client->tid = connection->tid;
+    return connection;
+}
+
+/* remove_connection()
+ * -------------------
+ * Forgets a connection whose client has hung up, or whose socket can no
+ * 	longer be handed over, by moving the last connection into its slot.
+ * 	Does nothing if it has already been forgotten. Must be called with
+ * 	the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * connection: the connection.
+ *
+ * Returns: void
+ */
+void remove_connection(ProgramParameters* parameters,
+	Connection* connection) {
+    HandoffState* handoff = &parameters->handoff;
+    if (connection->slot == -1) {
+	return;
+    }
+    Connection* last = handoff->connections[--handoff->numOfConnections];
+    handoff->connections[connection->slot] = last;
+    last->slot = connection->slot;
+    connection->slot = -1;
 }
 
 /* check_time()
  * ------------
- * Function for dedicated time thread which checks expiry time for every item
- * 	and sends corresponding message to clients if necessary.
+ * Function for dedicated time thread which closes auctions as they expire
+ * 	and sends corresponding message to clients if necessary. It sleeps
+ * 	until the next auction closes, or the next tick if that is sooner,
+ * 	and is woken early when an auction is listed or extended to close
+ * 	before then. Recordings are flushed, idle connections reaped and
+ * 	heartbeats sent once a tick.
  *
  * params: a null pointer to the struct containing all of program's data.
  *
@@ -238,358 +809,1169 @@ void init_client(ProgramParameters* parameters, int clientFd) {
  */
 void* check_time(void* params) {
     ProgramParameters* parameters = (ProgramParameters*) params;
+    trace_name_thread("timer", 0);
+    long nextTick = get_time_ms();
     while (1) {
-	// Check expiry times for every item.
-	take_lock(parameters->lock);
-	for (int i = 0; i < parameters->numOfItems; i++) {
-	    if (get_time_ms() >= parameters->items[i].expiryTime) {
-		ItemList item = parameters->items[i];	
-
-		// Send sold or unsold message to seller.
-		FILE* sellerOutput = item.seller.output;
-		if (item.highestBidder == false) {
-		    if (item.sellerActive) {
-			fprintf(sellerOutput, ":unsold %s\n", item.item);
-			fflush(sellerOutput);
-		    }
-		} else {
-		    if (item.sellerActive) {
-			fprintf(sellerOutput, ":sold %s %d\n", item.item,
-				item.highestBid);
-			fflush(sellerOutput);
-		    }
-		    
-		    // Send won message to highest bidder.
-		    Client highestBidder = item.topBidder;
-		    if (item.bidderActive) {
-			FILE* bidderOutput = highestBidder.output;
-			fprintf(bidderOutput, ":won %s %d\n", item.item,
-				item.highestBid);
-			fflush(bidderOutput);
-		    }
-		}
-		// Remove item from array.
-		remove_item(parameters, i);
-		parameters->numOfItems--;
+	// Dumps are written here so that neither the signal handler nor the
+	// lock holder has to.
+	if (trace_dump_requested() && !trace_dump()) {
+	    fprintf(stderr, TRACE_ERR_MSG, trace_path());
+	}
+	take_traced_lock(parameters->lock);
+	if (get_time_ms() >= nextTick) {
+	    nextTick = get_time_ms() + TIMER_TICK_MS;
+	    if (parameters->recording) {
+		fflush(parameters->recording);
+	    }
+	    if (parameters->limits.idleMs) {
+		reap_idle(parameters);
+	    }
+	    if (parameters->role != REPLICA) {
+		publish_event(parameters, HEARTBEAT_EVENT, NULL);
 	    }
 	}
-	release_lock(parameters->lock);
-	usleep(100000);
+
+	// A replica leaves closing auctions to its primary, and a virtual
+	// clock only moves on an advance command.
+	bool closing = parameters->role != REPLICA
+		&& !parameters->virtualClock;
+	double wait = nextTick - get_time_ms();
+	parameters->timerDeadline = 0;
+	if (closing) {
+	    expire_items(parameters);
+	    refresh_view(parameters);
+	    double now = clock_ms(parameters);
+	    double expiry = next_expiry(parameters);
+	    if (expiry != -1 && expiry - now < wait) {
+		wait = expiry - now;
+	    }
+	    parameters->timerDeadline = now + wait;
+	}
+	release_traced_lock(parameters->lock);
+	wait_timer(parameters->timerWake, wait);
     }
     return NULL;
 }
 
-/* remove_item()
- * -------------
- * Removes an item and all of its corresponding data from items data struct.
+/* reap_idle()
+ * -----------
+ * Hangs up on connections which have sent nothing for longer than the idle
+ * 	limit. Their threads see the hangup and clean up as if the client had
+ * 	left. Connections on shared-memory rings are not reaped, and nothing
+ * 	is while a successor takes over. Must be called with the lock held.
  *
  * parameters: a data struct containing all the data for the program.
- * itemIndex: the index of the item to remove in the item data struct.
  *
  * Returns: void
  */
-void remove_item(ProgramParameters* parameters, int itemIndex) {
-    // Remove item from item data struct.
-    for (int i = itemIndex; i < parameters->numOfItems - 1; i++) {
-	parameters->items[i].seller = parameters->items[i + 1].seller;
-	parameters->items[i].item = strdup(parameters->items[i + 1].item);
-	free(parameters->items[i + 1].item);
-	parameters->items[i].reserve = parameters->items[i + 1].reserve;
-	parameters->items[i].duration = parameters->items[i + 1].duration;
-	parameters->items[i].highestBidder =
-	        parameters->items[i + 1].highestBidder;
-	parameters->items[i].highestBid = parameters->items[i + 1].highestBid;
-	parameters->items[i].expiryTime = parameters->items[i + 1].expiryTime;
-	parameters->items[i].topBidder = parameters->items[i + 1].topBidder;
+void reap_idle(ProgramParameters* parameters) {
+    HandoffState* handoff = &parameters->handoff;
+    if (__atomic_load_n(&handoff->active, __ATOMIC_ACQUIRE)) {
+	return;
+    }
+    long now = get_time_ms();
+    for (int i = 0; i < handoff->numOfConnections; i++) {
+	Connection* connection = handoff->connections[i];
+	long lastActive = __atomic_load_n(&connection->lastActive,
+		__ATOMIC_RELAXED);
+	if (!connection->reaped
+		&& now - lastActive > parameters->limits.idleMs) {
+	    connection->reaped = true;
+	    shutdown(connection->fd, SHUT_RDWR);
+	    parameters->numOfReaped++;
+	}
     }
 }
 
+/* request_trace()
+ * ---------------
+ * Signal handler for SIGUSR1, which has the timer thread dump the flight
+ * 	recorder.
+ *
+ * signal: the signal received.
+ *
+ * Returns: void
+ */
+void request_trace(int signal) {
+    trace_request_dump();
+}
+
 /* auction_client()
  * ----------------
  * A function for the thread for each client, which accepts client input
  * 	and executes command accordingly.
  *
+ * thread: a null pointer to the Connection the thread was started with.
+ *
+ * Returns: empty null pointer
+ */
+void* auction_client(void* thread) {
+    Connection* connection = (Connection*) thread;
+    ProgramParameters* parameters = connection->parameters;
+    int clientIndex = connection->clientIndex;
+    placement_pin_worker();
+    take_traced_lock(parameters->lock);
+    FILE* input = NULL;
+    FILE* output = parameters->clients[clientIndex].output;
+    record_command(parameters, CAPTURE_CONNECT, clientIndex, NULL);
+    release_traced_lock(parameters->lock);
+    int reader = epoch_register(&parameters->epoch);
+    trace_name_thread("client %d", clientIndex);
+
+    // Read from client. A connection handed over by a predecessor has
+    // already been through negotiation.
+    char* line;
+    bool firstLine = !connection->restored;
+    bool negotiating = !connection->restored;
+    while (1) {
+	line = read_command(connection, input);
+	if (line == NULL) {
+	    if (connection->shm || !park_for_handoff(parameters,
+		    &connection->parked)) {
+		break;
+	    }
+	    continue;
+	}
+
+	// Local clients may switch to shared-memory rings before anything
+	// else, in which case nothing more is read from the socket itself.
+	if (firstLine && parameters->unixSocket
+		&& strcmp(line, SHM_REQUEST) == 0) {
+	    firstLine = false;
+	    free(line);
+	    upgrade_to_shm(parameters, connection, &input, &output);
+	    continue;
+	}
+	firstLine = false;
+
+	// Clients may then ask to carry many sessions on the connection, each
+	// a separate bidder and seller.
+	if (negotiating && strcmp(line, MUX_REQUEST) == 0) {
+	    negotiating = false;
+	    connection->multiplexed = true;
+	    free(line);
+	    fprintf(output, "%s\n", MUX_REPLY);
+	    fflush(output);
+	    continue;
+	}
+	negotiating = false;
+
+	int lineClient = clientIndex;
+	FILE* lineOutput = output;
+	char* command = line;
+	if (connection->multiplexed) {
+	    int session;
+	    command = parse_session_frame(line, &session);
+	    if (command == NULL) {
+		// Other sessions may be writing to the connection meanwhile.
+		flockfile(output);
+		fprintf(output, ":invalid\n");
+		fflush(output);
+		funlockfile(output);
+		free(line);
+		continue;
+	    }
+	    Session* found = find_session(parameters, connection, output,
+		    session);
+	    if (found == NULL) {
+		flockfile(output);
+		fprintf(output, "@%d :rejected\n", session);
+		fflush(output);
+		funlockfile(output);
+		free(line);
+		continue;
+	    }
+	    lineClient = found->clientIndex;
+	    lineOutput = found->output;
+	}
+	trace_event(TRACE_COMMAND_RECEIVED, lineClient);
+
+	// Some commands need no lock, unless they must be recorded in order
+	// with everything else.
+	if (reader != -1 && !parameters->recording
+		&& serve_unlocked(parameters, reader, lineClient, command,
+		lineOutput)) {
+	    free(line);
+	    continue;
+	}
+	take_traced_lock(parameters->lock);
+	record_command(parameters, CAPTURE_COMMAND, lineClient, command);
+
+	char** splitLine = split_by_char(command, ' ', 0);
+
+	// Get number of words in text message from client.
+	int length = 0;
+	for (int i = 0; splitLine[i] != NULL; i++) {
+	    length++;
+	}
+
+	// Check if input is valid.
+	check_input(length, splitLine, parameters, lineOutput, lineClient);
+	refresh_view(parameters);
+
+	// Release lock after line has been processed.
+	release_traced_lock(parameters->lock);
+    }
+    if (reader != -1) {
+	epoch_unregister(&parameters->epoch, reader);
+    }
+
+    // Update that seller or bidder has left for each item. Every session of
+    // the connection shares its thread, so all of them leave together.
+    take_traced_lock(parameters->lock);
+    drop_batched_bids(parameters, parameters->clients[clientIndex].tid);
+    for (int i = 0; i < parameters->numOfItems; i++) {
+	if (parameters->items[i].seller.tid == 
+		parameters->clients[clientIndex].tid) {
+	    parameters->items[i].sellerActive = false;
+	}
+	if (parameters->items[i].highestBidder 
+		&& parameters->items[i].topBidder.tid ==
+		parameters->clients[clientIndex].tid) {
+	    parameters->items[i].bidderActive = false;
+	}
+    }
+    --parameters->numOfActiveClients;
+    record_command(parameters, CAPTURE_CLOSE, clientIndex, NULL);
+    remove_connection(parameters, connection);
+    release_traced_lock(parameters->lock);
+    close_sessions(parameters, &connection->table);
+    if (input) {
+	fclose(input);
+    } else {
+	close(connection->fd);
+    }
+    fclose(output);
+    resize_input(connection, 0);
+    account_memory(parameters, MEMORY_CONNECTIONS,
+	    -(long) (CONNECTION_MEMORY + (connection->shm ? SHM_MEMORY : 0)));
+    free(connection);
+    return NULL;
+}
+
+/* serve_unlocked()
+ * ----------------
+ * Handles a command which needs no lock: list and delta, which are read
+ * 	from the published view, history, which is read from the archive,
+ * 	and bids on items sold by clearing, which are added to their batch.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * reader: the calling thread's slot from epoch_register().
+ * clientIndex: the index of the client in parameters->clients.
+ * command: the command, which is split up in place if it is handled.
+ * output: the output file descriptor of the client.
+ *
+ * Returns: true if the command was handled, false if it needs the lock.
+ */
+bool serve_unlocked(ProgramParameters* parameters, int reader,
+	int clientIndex, char* command, FILE* output) {
+    if (strcmp(command, "list") == 0) {
+	list_view(parameters, reader, output);
+	return true;
+    }
+    if (batch_bid(parameters, reader, clientIndex, command, output)) {
+	return true;
+    }
+    bool delta = strncmp(command, DELTA_REQUEST " ",
+	    strlen(DELTA_REQUEST) + 1) == 0;
+    size_t historyLength = strlen("history");
+    bool history = strncmp(command, "history", historyLength) == 0
+	    && (command[historyLength] == ' '
+	    || command[historyLength] == '\0');
+    if (!delta && !history) {
+	return false;
+    }
+    char** splitLine = split_by_char(command, ' ', 0);
+    int length = 0;
+    while (splitLine[length] != NULL) {
+	length++;
+    }
+    if (delta) {
+	list_delta(parameters, reader, length, splitLine, output);
+    } else {
+	report_history(parameters, length, splitLine, output);
+    }
+    free(splitLine);
+    return true;
+}
+
+/* read_command()
+ * --------------
+ * Reads the next line a client sends. A socket is read into the
+ * 	connection's own buffer rather than a stream's, so that whatever has
+ * 	arrived but not been handled yet can be handed to a successor. The
+ * 	thread only waits in wait_for_input(), where a handoff can stop it.
+ * 	A line longer than the limit is not kept, and is read as an empty
+ * 	line, which is invalid.
+ *
+ * connection: the client's connection.
+ * input: the stream to read from once the connection has moved to
+ * 	shared-memory rings, NULL until then.
+ *
+ * Returns: the line, which the caller must free, or NULL if the client has
+ * 	hung up or a handoff has begun.
+ */
+char* read_command(Connection* connection, FILE* input) {
+    long maxLine = connection->parameters->limits.maxLine;
+    if (connection->shm) {
+	return read_bounded_line(input, maxLine);
+    }
+    size_t scanned = connection->start;
+    while (1) {
+	char* pending = connection->pending;
+	char* newline = memchr(pending + scanned, '\n',
+		connection->length - scanned);
+	if (newline) {
+	    char* line = connection->discarding ? strdup("")
+		    : strndup(pending + connection->start,
+		    newline - pending - connection->start);
+	    connection->discarding = false;
+	    connection->start = newline + 1 - pending;
+	    __atomic_store_n(&connection->lastActive, (long) get_time_ms(),
+		    __ATOMIC_RELAXED);
+	    return line;
+	}
+	if (maxLine && connection->length - connection->start > maxLine) {
+	    connection->discarding = true;
+	    connection->length = connection->start;
+	}
+	scanned = connection->length;
+	throttle_input(connection);
+	if (!wait_for_input(connection->parameters, connection->fd)) {
+	    return NULL;
+	}
+
+	// Handled lines are dropped before reading more, and the buffer
+	// shrinks again after a long line.
+	connection->length -= connection->start;
+	scanned -= connection->start;
+	memmove(pending, pending + connection->start, connection->length);
+	connection->start = 0;
+	if (connection->capacity - connection->length < READ_CHUNK
+		|| connection->capacity > connection->length
+		+ 2 * READ_CHUNK) {
+	    resize_input(connection, connection->length + READ_CHUNK);
+	}
+	ssize_t count = read(connection->fd,
+		connection->pending + connection->length,
+		connection->capacity - connection->length);
+	if (count < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (count <= 0) {
+	    return NULL;
+	}
+	connection->length += count;
+    }
+}
+
+/* read_bounded_line()
+ * -------------------
+ * Reads a line from a stream like read_line(), but without keeping more
+ * 	than the limit of it.
+ *
+ * input: the stream to read from.
+ * maxLine: the longest line kept, or 0 for no limit.
+ *
+ * Returns: the line, or an empty line if it was too long, which the caller
+ * 	must free, or NULL at the end of the stream.
+ */
+char* read_bounded_line(FILE* input, long maxLine) {
+    size_t length = 0;
+    size_t capacity = 64;
+    char* line = malloc(capacity);
+    bool tooLong = false;
+    int c;
+    while ((c = getc(input)) != EOF && c != '\n') {
+	if (maxLine && length >= maxLine) {
+	    tooLong = true;
+	    continue;
+	}
+	if (length + 1 == capacity) {
+	    capacity *= 2;
+	    line = realloc(line, capacity);
+	}
+	line[length++] = c;
+    }
+    if (c == EOF && length == 0 && !tooLong) {
+	free(line);
+	return NULL;
+    }
+    line[tooLong ? 0 : length] = '\0';
+    return line;
+}
+
+/* resize_input()
+ * --------------
+ * Resizes a connection's input buffer, accounting for the change.
+ *
+ * connection: the client's connection.
+ * capacity: the new size of the buffer, which must hold what is in it, or
+ * 	0 to free it.
+ *
+ * Returns: void
+ */
+void resize_input(Connection* connection, size_t capacity) {
+    long change = (long) capacity - (long) connection->capacity;
+    if (capacity) {
+	connection->pending = realloc(connection->pending, capacity);
+    } else {
+	free(connection->pending);
+	connection->pending = NULL;
+    }
+    connection->capacity = capacity;
+    account_memory(connection->parameters, MEMORY_INPUT, change);
+    charge_connection(&connection->charged, change);
+}
+
+/* throttle_input()
+ * ----------------
+ * Holds off reading from a connection while the auctioneer is over its
+ * 	memory budget and the connection uses more than its share of it, so
+ * 	that the clients using the most wait for memory to be freed rather
+ * 	than the auctioneer growing without bound.
+ *
+ * connection: the client's connection.
+ *
+ * Returns: void
+ */
+void throttle_input(Connection* connection) {
+    ProgramParameters* parameters = connection->parameters;
+    long budget = parameters->limits.memoryBudget;
+    bool throttled = false;
+    while (budget && memory_total(parameters) > budget
+	    && !__atomic_load_n(&parameters->handoff.active,
+	    __ATOMIC_ACQUIRE)) {
+	int numOfActive = __atomic_load_n(&parameters->numOfActiveClients,
+		__ATOMIC_RELAXED);
+	if (__atomic_load_n(&connection->charged, __ATOMIC_RELAXED)
+		<= budget / (numOfActive > 0 ? numOfActive : 1)) {
+	    break;
+	}
+	if (!throttled) {
+	    throttled = true;
+	    __atomic_add_fetch(&parameters->numOfThrottled, 1,
+		    __ATOMIC_RELAXED);
+	}
+	usleep(THROTTLE_US);
+    }
+}
+
+/* wait_for_input()
+ * ----------------
+ * Waits until a socket can be read, unless a handoff begins first. The
+ * 	handoff signal is blocked everywhere but here, so it cannot be missed
+ * 	between checking for a handoff and starting to wait.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * fd: the socket to wait on.
+ *
+ * Returns: true once the socket can be read (or has failed), false if a
+ * 	handoff has begun.
+ */
+bool wait_for_input(ProgramParameters* parameters, int fd) {
+    sigset_t unblocked;
+    sigemptyset(&unblocked);
+    struct pollfd poller = {.fd = fd, .events = POLLIN};
+    while (!__atomic_load_n(&parameters->handoff.active, __ATOMIC_ACQUIRE)) {
+	if (ppoll(&poller, 1, NULL, &unblocked) >= 0 || errno != EINTR) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* park_for_handoff()
+ * ------------------
+ * Stops the calling thread while a successor takes over. Once every thread
+ * 	has parked the process exits, so this only returns if the handoff is
+ * 	abandoned.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * parked: the thread's parked flag, which the handoff waits on.
+ *
+ * Returns: true if the thread parked and may carry on, false if there is no
+ * 	handoff, i.e. the client hung up.
+ */
+bool park_for_handoff(ProgramParameters* parameters, bool* parked) {
+    if (!__atomic_load_n(&parameters->handoff.active, __ATOMIC_ACQUIRE)) {
+	return false;
+    }
+    take_traced_lock(parameters->lock);
+    *parked = true;
+    release_traced_lock(parameters->lock);
+    while (sem_wait(&parameters->handoff.resume) == -1 && errno == EINTR) {
+    }
+    return true;
+}
+
+/* handoff_interrupt()
+ * -------------------
+ * Signal handler for the handoff signal, which only needs to interrupt the
+ * 	wait in wait_for_input().
+ *
+ * signal: the signal received.
+ *
+ * Returns: void
+ */
+void handoff_interrupt(int signal) {
+}
+
+/* find_session()
+ * --------------
+ * Finds the client a session on a multiplexed connection stands for, adding
+ * 	one the first time the session is seen.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * connection: the multiplexed connection.
+ * output: the connection's output stream.
+ * session: the session ID.
+ *
+ * Returns: the session, or NULL if it is new and the connection has no
+ * 	memory left for it.
+ */
+Session* find_session(ProgramParameters* parameters, Connection* connection,
+	FILE* output, int session) {
+    SessionTable* table = &connection->table;
+    if (session < table->capacity && table->sessions[session].output) {
+	return &table->sessions[session];
+    }
+    // The table is indexed by ID, so a large ID costs the whole table.
+    int capacity = session_capacity(table, session);
+    if (over_allowance(parameters, &connection->charged, SESSION_MEMORY
+	    + sizeof(Session) * (long) (capacity - table->capacity))) {
+	return NULL;
+    }
+    take_traced_lock(parameters->lock);
+    Session* found = add_session(parameters, connection, output, session);
+    release_traced_lock(parameters->lock);
+    return found;
+}
+
+/* add_session()
+ * -------------
+ * Adds the client for a session on a multiplexed connection. It is served by
+ * 	the connection's thread but is a bidder and seller of its own, and is
+ * 	sent its replies and notifications tagged with its session ID. Must be
+ * 	called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * connection: the multiplexed connection, whose table is grown if need be.
+ * output: the connection's output stream.
+ * session: the session ID, which must not have been added yet.
+ *
+ * Returns: the session.
+ */
+Session* add_session(ProgramParameters* parameters, Connection* connection,
+	FILE* output, int session) {
+    SessionTable* table = &connection->table;
+    int capacity = session_capacity(table, session);
+    if (capacity > table->capacity) {
+	long growth = sizeof(Session) * (long) (capacity - table->capacity);
+	table->sessions = realloc(table->sessions, sizeof(Session) * capacity);
+	memset(table->sessions + table->capacity, 0, growth);
+	table->capacity = capacity;
+	account_memory(parameters, MEMORY_SESSIONS, growth);
+	charge_connection(&connection->charged, growth);
+    }
+    Session* found = &table->sessions[session];
+    found->output = open_session_stream(output, session);
+    parameters->clients = realloc(parameters->clients, sizeof(Client)
+	    * ++(parameters->numOfClients));
+    found->clientIndex = parameters->numOfClients - 1;
+    Client* client = &parameters->clients[found->clientIndex];
+    *client = parameters->clients[connection->clientIndex];
+    client->session = session;
+    client->id = found->clientIndex;
+    client->output = found->output;
+    record_command(parameters, CAPTURE_CONNECT, found->clientIndex, NULL);
+    account_memory(parameters, MEMORY_SESSIONS, SESSION_MEMORY);
+    charge_connection(&connection->charged, SESSION_MEMORY);
+    return found;
+}
+
+/* close_sessions()
+ * ----------------
+ * Closes the sessions of a connection once it has hung up. Their items must
+ * 	already have been marked as left.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * table: the connection's sessions.
+ *
+ * Returns: void
+ */
+void close_sessions(ProgramParameters* parameters, SessionTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+	if (table->sessions[i].output == NULL) {
+	    continue;
+	}
+	take_traced_lock(parameters->lock);
+	record_command(parameters, CAPTURE_CLOSE,
+		table->sessions[i].clientIndex, NULL);
+	parameters->clients[table->sessions[i].clientIndex].output = NULL;
+	account_memory(parameters, MEMORY_SESSIONS, -SESSION_MEMORY);
+	release_traced_lock(parameters->lock);
+	fclose(table->sessions[i].output);
+    }
+    account_memory(parameters, MEMORY_SESSIONS,
+	    -(long) sizeof(Session) * table->capacity);
+    free(table->sessions);
+}
+
+/* session_capacity()
+ * ------------------
+ * Works out how large a session table must be to hold a session.
+ *
+ * table: the sessions of a multiplexed connection.
+ * session: the session ID.
+ *
+ * Returns: the table's capacity once it holds the session, which is its
+ * 	current capacity if it already has room.
+ */
+int session_capacity(SessionTable* table, int session) {
+    int capacity = table->capacity ? table->capacity : MIN_SESSION_CAPACITY;
+    while (capacity <= session) {
+	capacity *= 2;
+    }
+    return capacity;
+}
+
+/* upgrade_to_shm()
+ * ----------------
+ * Moves a unix socket client onto the shared-memory ring transport. The
+ * 	client's streams are swapped for ones backed by the rings, which is
+ * 	safe because no item refers to the client before its first command.
+ * 	Such a connection cannot be handed to a successor.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * connection: the client's connection.
+ * input: set to the client's input stream on success.
+ * output: the client's output stream, replaced on success.
+ *
+ * Returns: void
+ */
+void upgrade_to_shm(ProgramParameters* parameters, Connection* connection,
+	FILE** input, FILE** output) {
+    // The rings keep their own handle on the socket to notice hangups.
+    int sockFd = dup(connection->fd);
+    FILE* ringInput;
+    FILE* ringOutput;
+    if (!shm_ring_offer(sockFd, &ringInput, &ringOutput)) {
+	close(sockFd);
+	fprintf(*output, ":invalid\n");
+	fflush(*output);
+	return;
+    }
+    fclose(*output);
+    *input = ringInput;
+    *output = ringOutput;
+
+    take_traced_lock(parameters->lock);
+    close(connection->fd);
+    connection->shm = true;
+    account_memory(parameters, MEMORY_CONNECTIONS, SHM_MEMORY);
+    remove_connection(parameters, connection);
+    parameters->clients[connection->clientIndex].input = ringInput;
+    parameters->clients[connection->clientIndex].output = ringOutput;
+    release_traced_lock(parameters->lock);
+}
+
+/* init_handoff()
+ * --------------
+ * Sets up hot restart: listens for a successor on --handoff, and takes over
+ * 	from a predecessor on --takeover. Must be called before any other
+ * 	thread is started.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 20 and takeover error message if the
+ * 	predecessor cannot be taken over from, or with status 17 and connect
+ * 	error message if it cannot listen for a successor.
+ */
+void init_handoff(int argc, char** argv, ProgramParameters* parameters) {
+    HandoffState* handoff = &parameters->handoff;
+    handoff->active = false;
+    handoff->acceptorTid = pthread_self();
+    handoff->acceptorParked = false;
+    sem_init(&handoff->resume, 0, 0);
+
+    // Every thread inherits the handoff signal blocked, and unblocks it only
+    // while waiting for input.
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, HANDOFF_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+    signal(HANDOFF_SIGNAL, handoff_interrupt);
+
+    const char* takeoverPath = get_arg(argc, argv, TAKEOVER);
+    if (takeoverPath && !take_over(parameters, takeoverPath)) {
+	fprintf(stderr, TAKEOVER_ERR_MSG, takeoverPath);
+	exit(TAKEOVER_ERR);
+    }
+    if (handoff->path) {
+	// The predecessor has removed its own socket by now.
+	handoff->listenFd = create_unix_listener(handoff->path);
+	if (handoff->listenFd < 0 || listen(handoff->listenFd, 1)) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	pthread_t tid;
+	pthread_create(&tid, NULL, accept_successor, parameters);
+	pthread_detach(tid);
+    }
+}
+
+/* accept_successor()
+ * ------------------
+ * Function for the thread waiting for a new auctioneer to hand over to.
+ *
  * params: a null pointer to the struct containing all of program's data.
  *
- * Returns: empty null pointer
+ * Returns: an empty null pointer, if it can no longer listen.
  */
-void* auction_client(void* params) {
+void* accept_successor(void* params) {
     ProgramParameters* parameters = (ProgramParameters*) params;
-    int clientIndex = parameters->numOfClients - 1;
-    int clientFd = parameters->clients[clientIndex].clientFd;
-    FILE* input = fdopen(clientFd, "r");
-    FILE* output = fdopen(dup(clientFd), "w");
-    parameters->clients[clientIndex].tid = pthread_self();
-    parameters->clients[clientIndex].input = input;
-    parameters->clients[clientIndex].output = output;
-
-    // Read from client.
-    char* line;
-    while ((line = read_line(input))) {
-	take_lock(parameters->lock);
-
-	char** splitLine = split_by_char(line, ' ', 0);
-
-	// Get number of words in text message from client.
-	int length = 0;
-	for (int i = 0; splitLine[i] != NULL; i++) {
-	    length++;
-	}
-
-	// Check if input is valid.
-	check_input(length, splitLine, parameters, output, clientIndex);
-
-	// Release lock after line has been processed.
-	release_lock(parameters->lock);
-    }
-    // Update that seller or bidder has left for each item.
-    take_lock(parameters->lock);
-    for (int i = 0; i < parameters->numOfItems; i++) {
-	if (parameters->items[i].seller.tid == 
-		parameters->clients[clientIndex].tid) {
-	    parameters->items[i].sellerActive = false;
+    HandoffState* handoff = &parameters->handoff;
+    while (handoff->listenFd >= 0) {
+	int fd = accept(handoff->listenFd, NULL, NULL);
+	if (fd < 0) {
+	    continue;
 	}
-	if (parameters->items[i].highestBidder 
-		&& parameters->items[i].topBidder.tid ==
-		parameters->clients[clientIndex].tid) {
-	    parameters->items[i].bidderActive = false;
+	// Only one successor is taken at a time.
+	close(handoff->listenFd);
+	unlink(handoff->path);
+	hand_over(parameters, fd);
+	close(fd);
+
+	// The handoff was abandoned, so wait for another successor.
+	handoff->listenFd = create_unix_listener(handoff->path);
+	if (handoff->listenFd >= 0 && listen(handoff->listenFd, 1)) {
+	    close(handoff->listenFd);
+	    handoff->listenFd = -1;
 	}
     }
-    --parameters->numOfActiveClients;
-    release_lock(parameters->lock);
-    fclose(input);
-    fclose(output);
-    close(clientFd);
+    fprintf(stderr, PORT_CONNECT_ERR_MSG);
     return NULL;
 }
 
-/* check_input()
- * -------------
- * Checks the input from client, validates it, and executes it.
+/* hand_over()
+ * -----------
+ * Hands the auctioneer to a successor which has connected: stops every
+ * 	thread from reading, sends the listening socket, every connection and
+ * 	the items, and exits once the successor has taken them on. Connections
+ * 	on shared-memory rings cannot be passed on and are dropped.
  *
- * length: the number of words in the input command from client.
- * splitLine: an array of arrays of the input from client, split by ' '.
  * parameters: a data struct containing all the data for the program.
- * output: the output file descriptor of the client.
- * clientIndex: index of client in the array of client struct.
- * 
- * Returns: void
+ * fd: the unix socket connected to the successor.
+ *
+ * Returns: void, only if the successor failed and the handoff was abandoned.
  */
-void check_input(int length, char** splitLine, ProgramParameters* parameters,
-	FILE* output, int clientIndex) {
-    if (strcmp(splitLine[0], "sell") == 0) {
-	if (length != 4) {
-	    fprintf(output, ":invalid\n");
-	} else {
-	    // Validate item to sell
-	    check_sell(splitLine, parameters,
-		    parameters->clients[clientIndex]);
+void hand_over(ProgramParameters* parameters, int fd) {
+    HandoffState* handoff = &parameters->handoff;
+    __atomic_store_n(&handoff->active, true, __ATOMIC_RELEASE);
+
+    // Interrupt every reader until all have parked. Once the acceptor has,
+    // no connection can be added.
+    while (1) {
+	take_traced_lock(parameters->lock);
+	bool settled = handoff->acceptorParked;
+	if (!handoff->acceptorParked) {
+	    pthread_kill(handoff->acceptorTid, HANDOFF_SIGNAL);
 	}
-    } else if (strcmp(splitLine[0], "bid") == 0) {
-	if (length != 3) {
-	    fprintf(output, ":invalid\n");
-	} else {
-	    // Validate item to bid
-	    place_bid(splitLine, parameters,
-		    parameters->clients[clientIndex]);
+	for (int i = 0; i < handoff->numOfConnections; i++) {
+	    if (!handoff->connections[i]->parked) {
+		settled = false;
+		pthread_kill(handoff->connections[i]->tid, HANDOFF_SIGNAL);
+	    }
 	}
-    } else if (strcmp(splitLine[0], "list") == 0) {
-	if (length != 1) {
-	    fprintf(output, ":invalid\n");
-	} else {
-	    // List all items
-	    list_all_items(parameters, output);
+	if (settled) {
+	    break;
 	}
-    } else {
-	fprintf(output, ":invalid\n");
+	release_traced_lock(parameters->lock);
+	usleep(HANDOFF_POLL_US);
     }
 
-    fflush(output);
+    // The lock is kept from here, so nothing changes while state is sent.
+    // Nothing more can close either, so the archive is finished with before
+    // the successor opens it. Bids waiting in batches are cleared rather
+    // than handed over.
+    if (parameters->archive) {
+	archive_flush(parameters->archive);
+    }
+    clear_batches(parameters, true);
+    FILE* reply = fdopen(dup(fd), "r");
+    char* line = NULL;
+    if (send_state(parameters, fd)) {
+	line = read_line(reply);
+    }
+    fclose(reply);
+    if (line && strcmp(line, HANDOFF_DONE) == 0) {
+	if (parameters->recording) {
+	    fflush(parameters->recording);
+	}
+	// Nothing else may be written to the connections, so stdio is not
+	// flushed on the way out.
+	_exit(0);
+    }
+    free(line);
+
+    // Let every parked thread carry on.
+    __atomic_store_n(&handoff->active, false, __ATOMIC_RELEASE);
+    int numOfParked = 0;
+    for (int i = 0; i < handoff->numOfConnections; i++) {
+	numOfParked += handoff->connections[i]->parked;
+	handoff->connections[i]->parked = false;
+    }
+    numOfParked += handoff->acceptorParked;
+    handoff->acceptorParked = false;
+    release_traced_lock(parameters->lock);
+    for (int i = 0; i < numOfParked; i++) {
+	sem_post(&handoff->resume);
+    }
 }
 
-/* check_sell()
+/* send_state()
  * ------------
- * Checks if sell command is valid and places item for sale in corresponding
- * 	struct.
+ * Sends a successor everything it needs to carry on: a header line, the
+ * 	listening socket followed by every connection's socket, then each
+ * 	connection's unhandled input and sessions and each item, as lines
+ * 	ending with "end". Items refer to their seller and top bidder by
+ * 	connection number and session, and keep their remaining time, when
+ * 	they opened, their clearing interval (0 if bid on one by one) and
+ * 	their soft close window and extension (0 if none). Must be called with
+ * 	the lock held, every connection parked and every batch cleared.
  *
- * splitLine: an array of arrays of the input from client, split by ' '.
  * parameters: a data struct containing all the data for the program.
- * client: a struct containing the client tid and output file descriptor.
+ * fd: the unix socket connected to the successor.
  *
- * Returns: void
+ * Returns: true if everything was sent, false otherwise.
  */
-void check_sell(char** splitLine, ProgramParameters* parameters,
-	Client client) {
-    FILE* outputClient = client.output;
-
-    // Check if given reserve is valid.
-    char* remainderText;
-    int reserve = strtol(splitLine[2], &remainderText, 10);
-    if (strlen(remainderText) != 0 || reserve < 0) {
-	fprintf(outputClient, ":invalid\n");
-	return;
+bool send_state(ProgramParameters* parameters, int fd) {
+    HandoffState* handoff = &parameters->handoff;
+    int numOfConnections = handoff->numOfConnections;
+    char header[64];
+    snprintf(header, sizeof(header), "%s %d\n", HANDOFF_HEADER,
+	    numOfConnections);
+    if (write(fd, header, strlen(header)) != strlen(header)) {
+	return false;
     }
 
-    // Check if given duration is valid.
-    int duration = strtol(splitLine[3], &remainderText, 10);
-    if (strlen(remainderText) != 0 || duration < 1) {
-	fprintf(outputClient, ":invalid\n");
-	return;
+    // Sockets are numbered as sent, and found again from items by
+    // descriptor.
+    int* fds = malloc(sizeof(int) * (numOfConnections + 1));
+    fds[0] = parameters->socketFd;
+    int maxFd = 0;
+    for (int i = 0; i < numOfConnections; i++) {
+	fds[i + 1] = handoff->connections[i]->fd;
+	maxFd = fds[i + 1] > maxFd ? fds[i + 1] : maxFd;
+    }
+    bool sent = send_descriptors(fd, fds, numOfConnections + 1);
+    free(fds);
+    if (!sent) {
+	return false;
+    }
+    int* connectionOfFd = malloc(sizeof(int) * (maxFd + 1));
+    memset(connectionOfFd, -1, sizeof(int) * (maxFd + 1));
+    for (int i = 0; i < numOfConnections; i++) {
+	connectionOfFd[handoff->connections[i]->fd] = i;
     }
 
-    // Check if item is already on sale.
-    char* item = splitLine[1];
-    for (int i = 0; i < parameters->numOfItems; i++) {
-	if (strcmp(parameters->items[i].item, item) == 0) {
-	    fprintf(outputClient, ":rejected\n");
-	    return;
+    FILE* state = fdopen(dup(fd), "w");
+    for (int i = 0; i < numOfConnections; i++) {
+	Connection* connection = handoff->connections[i];
+	int numOfSessions = 0;
+	for (int j = 0; j < connection->table.capacity; j++) {
+	    numOfSessions += connection->table.sessions[j].output != NULL;
+	}
+	size_t length = connection->length - connection->start;
+	fprintf(state, "connection %d %d %zu\n", connection->multiplexed,
+		numOfSessions, length);
+	fwrite(connection->pending + connection->start, 1, length, state);
+	fputc('\n', state);
+	for (int j = 0; j < connection->table.capacity; j++) {
+	    if (connection->table.sessions[j].output) {
+		fprintf(state, "session %d\n", j);
+	    }
 	}
     }
 
-    // Add item to list of items being sold.
-    parameters->items = realloc(parameters->items, sizeof(ItemList)
-	    * ++(parameters->numOfItems));
-    int itemNum = parameters->numOfItems - 1;
-    parameters->items[itemNum].seller = client;
-    parameters->items[itemNum].sellerActive = true;
-    parameters->items[itemNum].item = strdup(item);
-    parameters->items[itemNum].reserve = reserve;
-    parameters->items[itemNum].duration = duration;
-    parameters->items[itemNum].highestBidder = false;
-    parameters->items[itemNum].highestBid = 0;
-    parameters->items[itemNum].expiryTime = get_time_ms() + duration;
-    fprintf(outputClient, ":listed %s\n", parameters->items[itemNum].item);
+    double now = clock_ms(parameters);
+    for (int i = 0; i < parameters->numOfItems; i++) {
+	ItemList* item = &parameters->items[i];
+	int seller = handed_client(parameters, connectionOfFd, maxFd,
+		item->seller, item->sellerActive);
+	int bidder = handed_client(parameters, connectionOfFd, maxFd,
+		item->topBidder, item->highestBidder && item->bidderActive);
+	fprintf(state, "item %s %d %d %.3f %d %d %d %d %d %d %.0f %d %d %d\n",
+		item->item, item->reserve, item->duration,
+		item->expiryTime - now, item->highestBidder, item->highestBid,
+		seller, item->seller.session, bidder, item->topBidder.session,
+		item->openTime, item->batch ? item->batch->interval : 0,
+		item->softWindow, item->softExtension);
+    }
+    fprintf(state, "end\n");
+    sent = fflush(state) != EOF;
+    fclose(state);
+    free(connectionOfFd);
+    return sent;
 }
 
-/* list_all_items()
- * ----------------
- * Lists all the items available to bid.
+/* handed_client()
+ * ---------------
+ * Finds which of the connections being handed over serves a client.
  *
  * parameters: a data struct containing all the data for the program.
- * outputClient: the output file descriptor for the client to list the items
- * 	for.
+ * connectionOfFd: the number of the connection for each descriptor, or -1.
+ * maxFd: the highest descriptor in connectionOfFd.
+ * client: the client, e.g. an item's seller.
+ * active: whether the client is still connected.
  *
- * Returns: void
+ * Returns: the number of the connection, or -1 if the client has left or its
+ * 	connection is not being handed over.
  */
-void list_all_items(ProgramParameters* parameters, FILE* outputClient) {
-    fprintf(outputClient, ":list ");
-    for (int i = 0; i < parameters->numOfItems; i++) {
-	ItemList* items = parameters->items;
-	int remainingDuration = (int)(items[i].expiryTime - get_time_ms());
-	fprintf(outputClient, "%s %d %d %d|", items[i].item, items[i].reserve,
-		items[i].highestBid, remainingDuration);
+int handed_client(ProgramParameters* parameters, int* connectionOfFd,
+	int maxFd, Client client, bool active) {
+    if (!active || client.clientFd < 0 || client.clientFd > maxFd) {
+	return -1;
+    }
+    int index = connectionOfFd[client.clientFd];
+    if (index == -1
+	    || parameters->handoff.connections[index]->tid != client.tid) {
+	return -1;
     }
-    fprintf(outputClient, "\n");
+    return index;
 }
 
-/* place_bid()
+/* take_over()
  * -----------
- * Checks if bid command is correct and places bid on specified item.
+ * Takes over from a running auctioneer with --handoff: receives its
+ * 	listening socket, connections and items, starts a thread for every
+ * 	connection, and tells it to exit. Clients stay connected throughout.
  *
- * splitLine: an array of arrays of the input from client, split by ' '.
  * parameters: a data struct containing all the data for the program.
- * client: a struct containing the client tid and output file descriptor.
+ * path: the predecessor's handoff socket.
  *
- * Returns: void
+ * Returns: true if the predecessor was taken over from, false otherwise.
  */
-void place_bid(char** splitLine, ProgramParameters* parameters,
-	Client client) {
-
-    bool valid = validate_bid_input(splitLine, parameters, client);
-    if (!valid) {
-	return;
+bool take_over(ProgramParameters* parameters, const char* path) {
+    int fd = connect_unix(path);
+    if (fd < 0) {
+	return false;
     }
-
-    FILE* outputClient = client.output;
-    int bidAmount = strtol(splitLine[2], NULL, 10);
-
-    // Get item ID
-    int itemId = find_item(splitLine, parameters, outputClient);
-    ItemList item = parameters->items[itemId];
-
-    // Send outbid message to previous topBidder.
-    if (item.highestBidder && item.bidderActive) {
-	fprintf(item.topBidder.output, ":outbid %s %d\n",
-		item.item, bidAmount);
-	fflush(item.topBidder.output);
+    // The header is read a byte at a time, so as not to read past it into
+    // the messages carrying descriptors.
+    char header[64];
+    int length = 0;
+    while (length < sizeof(header) - 1 && read(fd, header + length, 1) == 1
+	    && header[length] != '\n') {
+	length++;
     }
+    header[length] = '\0';
+    int numOfConnections;
+    char word[sizeof(header)];
+    if (sscanf(header, "%s %d", word, &numOfConnections) != 2
+	    || strcmp(word, HANDOFF_HEADER) != 0 || numOfConnections < 0) {
+	close(fd);
+	return false;
+    }
+    int* fds = malloc(sizeof(int) * (numOfConnections + 1));
+    if (!receive_descriptors(fd, fds, numOfConnections + 1)) {
+	close(fd);
+	return false;
+    }
+    parameters->socketFd = fds[0];
+    adopt_listener(parameters);
+
+    FILE* state = fdopen(dup(fd), "r");
+    Connection** connections = malloc(sizeof(Connection*)
+	    * (numOfConnections + 1));
+    take_traced_lock(parameters->lock);
+    bool restored = true;
+    for (int i = 0; i < numOfConnections && restored; i++) {
+	connections[i] = restore_connection(parameters, state, fds[i + 1]);
+	restored = connections[i] != NULL;
+    }
+    char* line = NULL;
+    while (restored && (line = read_line(state))
+	    && strcmp(line, "end") != 0) {
+	restored = restore_item(parameters, connections, numOfConnections,
+		line);
+	free(line);
+	line = NULL;
+    }
+    release_traced_lock(parameters->lock);
+    fclose(state);
+    free(connections);
+    free(fds);
+
+    // Connection threads only start reading once the lock is released, and
+    // any that did would die with this process if the predecessor carries
+    // on instead.
+    const char* done = HANDOFF_DONE "\n";
+    restored = restored && line
+	    && write(fd, done, strlen(done)) == strlen(done);
+    free(line);
+    close(fd);
+    return restored;
+}
 
-    // Add client as highest bidder.
-    parameters->items[itemId].highestBid = bidAmount;
-    parameters->items[itemId].highestBidder = true;
-    parameters->items[itemId].topBidder = client;
-    parameters->items[itemId].bidderActive = true;
-
-    fprintf(outputClient, ":bid %s\n", splitLine[1]);
-
+/* adopt_listener()
+ * ----------------
+ * Works out the endpoint of a listening socket received from a predecessor.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: void
+ */
+void adopt_listener(ProgramParameters* parameters) {
+    struct sockaddr_un address;
+    socklen_t length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    if (getsockname(parameters->socketFd, (struct sockaddr*) &address,
+	    &length) == 0 && address.sun_family == AF_UNIX) {
+	char* endpoint = malloc(strlen(UNIX_PREFIX)
+		+ strlen(address.sun_path) + 1);
+	strcpy(stpcpy(endpoint, UNIX_PREFIX), address.sun_path);
+	parameters->portNumber = endpoint;
+	parameters->unixSocket = true;
+    }
 }
 
-/* validate_bid_input()
+/* restore_connection()
  * --------------------
- * Checks if the bid command from client is valid.
+ * Takes on one connection from a predecessor, with the input it had not
+ * 	handled yet and its sessions. Must be called with the lock held.
  *
- * splitLine: an array of arrays of the input from client, split by ' '.
  * parameters: a data struct containing all the data for the program.
- * client: a struct containing the client tid and output file descriptor.
+ * state: the predecessor's state.
+ * clientFd: the connection's socket.
  *
- * Returns: true if input is valid, but false if invalid.
+ * Returns: the connection, or NULL if its state is malformed.
  */
-bool validate_bid_input(char** splitLine, ProgramParameters* parameters,
-	Client client) {
-    FILE* outputClient = client.output;
-
-    // Check if bid value is valid.
-    char* remainderText;
-    int bidAmount = strtol(splitLine[2], &remainderText, 10);
-    if (strlen(remainderText) != 0 || bidAmount < 1) {
-	fprintf(outputClient, ":invalid\n");
-	return false;
+Connection* restore_connection(ProgramParameters* parameters, FILE* state,
+	int clientFd) {
+    int multiplexed;
+    int numOfSessions;
+    size_t length;
+    if (fscanf(state, "connection %d %d %zu", &multiplexed, &numOfSessions,
+	    &length) != 3 || fgetc(state) != '\n') {
+	return NULL;
     }
-
-    int itemId = find_item(splitLine, parameters, outputClient);
-    if (itemId == -1) {
-	return false;
+    Connection* connection = add_connection(parameters, clientFd);
+    connection->restored = true;
+    connection->multiplexed = multiplexed;
+    resize_input(connection, length + READ_CHUNK);
+    connection->length = fread(connection->pending, 1, length, state);
+    if (connection->length != length || fgetc(state) != '\n') {
+	return NULL;
+    }
+    FILE* output = parameters->clients[connection->clientIndex].output;
+    for (int i = 0; i < numOfSessions; i++) {
+	int session;
+	if (fscanf(state, "session %d", &session) != 1
+		|| fgetc(state) != '\n' || session < 0
+		|| session >= MAX_SESSIONS) {
+	    return NULL;
+	}
+	add_session(parameters, connection, output, session);
     }
+    return connection;
+}
 
-    // Check if client is placing a valid bid.
-    if ((client.tid == parameters->items[itemId].seller.tid
-            && parameters->items[itemId].sellerActive)
-	    || bidAmount < parameters->items[itemId].reserve
-	    || bidAmount <= parameters->items[itemId].highestBid) { 
-	fprintf(outputClient, ":rejected\n");
+/* restore_item()
+ * --------------
+ * Lists an item received from a predecessor, with its bid, remaining time,
+ * 	and seller and top bidder if their connections were handed over. Must
+ * 	be called with the lock held.
+ *
+ * parameters: a data struct containing all the data for the program.
+ * connections: the connections restored, by number.
+ * numOfConnections: the number of connections restored.
+ * line: the item's line, which is split up in place.
+ *
+ * Returns: true if the line is a valid item, false otherwise.
+ */
+bool restore_item(ProgramParameters* parameters, Connection** connections,
+	int numOfConnections, char* line) {
+    char** splitLine = split_by_char(line, ' ', 0);
+    int length = 0;
+    for (int i = 0; splitLine[i] != NULL; i++) {
+	length++;
+    }
+    // Older predecessors do not send when items opened, how they clear or
+    // their soft close.
+    if ((length != ITEM_WORDS && length != ITEM_WORDS_OPEN_TIME
+	    && length != ITEM_WORDS_BATCH && length != ITEM_WORDS_SOFT_CLOSE)
+	    || strcmp(splitLine[0], "item") != 0) {
+	free(splitLine);
 	return false;
     }
-
-    ItemList item = parameters->items[itemId];
-    if (parameters->items[itemId].highestBidder != false) {
-	Client highestBidder = parameters->items[itemId].topBidder;
-	if (client.tid == highestBidder.tid && item.bidderActive) {
-	    fprintf(outputClient, ":rejected\n");
-	    return false;
-	}
+    Client seller;
+    Client bidder;
+    bool sellerActive = restored_client(parameters, connections,
+	    numOfConnections, atoi(splitLine[7]), atoi(splitLine[8]), &seller);
+    bool bidderActive = restored_client(parameters, connections,
+	    numOfConnections, atoi(splitLine[9]), atoi(splitLine[10]),
+	    &bidder);
+    int itemId = add_item(parameters, seller, splitLine[1],
+	    atoi(splitLine[2]), atoi(splitLine[3]));
+    ItemList* item = &parameters->items[itemId];
+    item->sellerActive = sellerActive;
+    set_expiry(parameters, itemId,
+	    clock_ms(parameters) + strtod(splitLine[4], NULL));
+    item->highestBidder = atoi(splitLine[5]);
+    item->highestBid = atoi(splitLine[6]);
+    item->topBidder = bidder;
+    item->bidderActive = item->highestBidder && bidderActive;
+    if (length >= ITEM_WORDS_OPEN_TIME) {
+	item->openTime = strtod(splitLine[11], NULL);
+    }
+    if (length == ITEM_WORDS_SOFT_CLOSE) {
+	item->softWindow = atoi(splitLine[13]);
+	item->softExtension = atoi(splitLine[14]);
+    }
+    int interval = length >= ITEM_WORDS_BATCH ? atoi(splitLine[12]) : 0;
+    if (interval > 0) {
+	open_batch(parameters, itemId, interval);
     }
+    free(splitLine);
     return true;
 }
 
-/* find_item()
- * -----------
- * Finds the index of the item in the bid input command.
+/* restored_client()
+ * -----------------
+ * Finds the client an item refers to among the connections restored.
  *
- * splitLine: an array of arrays of the input from client, split by ' '.
  * parameters: a data struct containing all the data for the program.
- * outputClient: the output file descriptor of the client.
+ * connections: the connections restored, by number.
+ * numOfConnections: the number of connections restored.
+ * index: the number of the client's connection, or -1.
+ * session: the client's session on a multiplexed connection.
+ * client: set to the client, or cleared if it is not connected.
  *
- * Returns: index of item in data struct, but returns -1 if not found.
+ * Returns: true if the client is connected, false otherwise.
  */
-int find_item(char** splitLine, ProgramParameters* parameters,
-	FILE* outputClient) {
-    for (int i = 0; i < parameters->numOfItems; i++) {
-	if (strcmp(splitLine[1], parameters->items[i].item) == 0) {
-	    return i;
+bool restored_client(ProgramParameters* parameters, Connection** connections,
+	int numOfConnections, int index, int session, Client* client) {
+    memset(client, 0, sizeof(Client));
+    client->id = -1;
+    if (index < 0 || index >= numOfConnections) {
+	return false;
+    }
+    Connection* connection = connections[index];
+    int clientIndex = connection->clientIndex;
+    if (connection->multiplexed) {
+	SessionTable* table = &connection->table;
+	if (session < 0 || session >= table->capacity
+		|| table->sessions[session].output == NULL) {
+	    return false;
 	}
+	clientIndex = table->sessions[session].clientIndex;
     }
-    fprintf(outputClient, ":rejected\n");
-    return -1;
+    *client = parameters->clients[clientIndex];
+    return true;
 }
 
 /* check_argc()
@@ -620,7 +2002,9 @@ void check_argc(int argc) {
  */
 void check_valid_args(int argc, char** argv) {
     // Iterate through all args in command line and check if each is valid.
-    char* validArgs[NUM_OF_VALID_ARGS] = {MAXCONN, LISTENON};
+    char* validArgs[NUM_OF_VALID_ARGS] =
+	    {MAXCONN, LISTENON, PRIMARY_ENDPOINT, REPLICA_OF, CLOCK, RECORD,
+	    PRELOAD, HANDOFF, TAKEOVER, LIMITS, ARCHIVE, PLACEMENT};
     for (int i = 1; i < argc; i += 2) {
 	int invalidCounter = 0;
 	for (int j = 0; j < NUM_OF_VALID_ARGS; j++) {
@@ -628,7 +2012,7 @@ void check_valid_args(int argc, char** argv) {
 		invalidCounter++;
 	    }
 	}
-	if (invalidCounter > 1) {
+	if (invalidCounter == NUM_OF_VALID_ARGS) {
 	    fprintf(stderr, USAGE_ERR_MSG);
 	    exit(USAGE_ERR);
 	}
@@ -647,6 +2031,26 @@ void check_valid_args(int argc, char** argv) {
 	    exit(USAGE_ERR);
 	}
     }
+
+    // A replica's items only ever come from its primary. A replica given
+    // --primary as well only takes replicas once it is promoted.
+    if (get_endpoint(argc, argv, REPLICA_OF)
+	    && get_arg(argc, argv, PRELOAD)) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
+
+    // Replication links cannot be handed over, and a successor's socket
+    // and items come from its predecessor.
+    bool replicated = get_endpoint(argc, argv, REPLICA_OF)
+	    || get_endpoint(argc, argv, PRIMARY_ENDPOINT);
+    if (((get_arg(argc, argv, HANDOFF) || get_arg(argc, argv, TAKEOVER))
+	    && replicated) || (get_arg(argc, argv, TAKEOVER)
+	    && (get_arg(argc, argv, LISTENON)
+	    || get_arg(argc, argv, PRELOAD)))) {
+	fprintf(stderr, USAGE_ERR_MSG);
+	exit(USAGE_ERR);
+    }
 }
 
 /* get_num_connections()
@@ -687,13 +2091,42 @@ int get_num_connections(int argc, char** argv) {
  * argv: an array of arrays containing the command line arguments.
  * 
  * Returns: the port number arg specified in the command line, however it
- * 	returns 0 if it is not supplied.
+ * 	returns 0 if it is not supplied. A unix:path endpoint is returned
+ * 	as is.
  * Errors: Exits with status 10 and usage error message if the given value
- * 	is not an integer or if not between 1024 and 65535 and not 0.
+ * 	is not an integer or if not between 1024 and 65535 and not 0, or if
+ * 	a unix endpoint has no path.
  */
 const char* get_port_number(int argc, char** argv) {
+    const char* portNumber = get_endpoint(argc, argv, LISTENON);
+    return portNumber ? portNumber : DEFAULT_PORT;
+}
+
+/* get_endpoint()
+ * --------------
+ * Gets the value of an endpoint argument (a port number or unix:path) from
+ * 	the command line and checks its validity.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * option: the argument to look for, e.g. --listenon.
+ *
+ * Returns: the endpoint given for the option, or NULL if it is not supplied.
+ * Errors: Exits with status 10 and usage error message if the given value
+ * 	is not an integer or if not between 1024 and 65535 and not 0, or if
+ * 	a unix endpoint has no path.
+ */
+const char* get_endpoint(int argc, char** argv, const char* option) {
     for (int i = 1; i < argc; i += 2) {
-	if (strcmp(argv[i], LISTENON) == 0) {
+	if (strcmp(argv[i], option) == 0) {
+	    if (is_unix_endpoint(argv[i + 1])) {
+		if (strlen(unix_endpoint_path(argv[i + 1])) == 0) {
+		    fprintf(stderr, USAGE_ERR_MSG);
+		    exit(USAGE_ERR);
+		}
+		return argv[i + 1];
+	    }
+
 	    // Check if port number is an integer.
 	    char* remainderText;
 	    int portNumber = strtol(argv[i + 1], &remainderText, 10);
@@ -712,7 +2145,26 @@ const char* get_port_number(int argc, char** argv) {
 	    return argv[i + 1];
 	}
     }
-    return DEFAULT_PORT;
+    return NULL;
+}
+
+/* get_arg()
+ * ---------
+ * Gets the value given for an argument on the command line.
+ *
+ * argc: the number of command line arguments.
+ * argv: an array of arrays containing the command line arguments.
+ * option: the argument to look for, e.g. --clock.
+ *
+ * Returns: the value given for the option, or NULL if it is not supplied.
+ */
+const char* get_arg(int argc, char** argv, const char* option) {
+    for (int i = 1; i < argc; i += 2) {
+	if (strcmp(argv[i], option) == 0) {
+	    return argv[i + 1];
+	}
+    }
+    return NULL;
 }
 
 /* create_socket()
@@ -721,13 +2173,22 @@ const char* get_port_number(int argc, char** argv) {
  * 	for it.
  *
  * portNumber: the portnumber specified in the command line, or ephemeral
- * 	port number.
+ * 	port number, or a unix:path endpoint.
  *
  * Returns: the file descriptor of the socket.
  * Errors: Exits with status 17 and connect error message if it cannot connect
  * 	to the port.
  */
 int create_socket(const char* portNumber) {
+    if (is_unix_endpoint(portNumber)) {
+	int fd = create_unix_listener(unix_endpoint_path(portNumber));
+	if (fd < 0) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	return fd;
+    }
+
     struct addrinfo* ai = 0;
     struct addrinfo hints;
     memset(&hints, 0, sizeof(struct addrinfo));
@@ -759,7 +2220,8 @@ int create_socket(const char* portNumber) {
 
 /* print_port_and_listen()
  * -----------------------
- * Prints the port number and starts listening for connections from clients.
+ * Prints the port number (or unix socket path) and starts listening for
+ * 	connections from clients.
  *
  * parameters: a data struct containing all the data for the program.
  *
@@ -767,16 +2229,19 @@ int create_socket(const char* portNumber) {
  * 	to client.
  */
 void print_port_and_listen(ProgramParameters* parameters) {
-    // Check which port was given.
-    struct sockaddr_in ad;
-    memset(&ad, 0, sizeof(struct sockaddr_in));
-    socklen_t len = sizeof(struct sockaddr_in);
-    if (getsockname(parameters->socketFd, (struct sockaddr*) &ad, &len)) {
-	fprintf(stderr, PORT_CONNECT_ERR_MSG);
-	exit(PORT_CONNECT_ERR);
+    if (parameters->unixSocket) {
+	fprintf(stderr, "%s\n", unix_endpoint_path(parameters->portNumber));
+    } else {
+	// Check which port was given.
+	struct sockaddr_in ad;
+	memset(&ad, 0, sizeof(struct sockaddr_in));
+	socklen_t len = sizeof(struct sockaddr_in);
+	if (getsockname(parameters->socketFd, (struct sockaddr*) &ad, &len)) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+	fprintf(stderr, "%d\n", ntohs(ad.sin_port));
     }
-
-    fprintf(stderr, "%d\n", ntohs(ad.sin_port));
     fflush(stderr);
 
     // Listen to port and specify max number of connections.
@@ -785,3 +2250,286 @@ void print_port_and_listen(ProgramParameters* parameters) {
 	exit(PORT_CONNECT_ERR);
     }
 }
+
+/* init_replication()
+ * ------------------
+ * Starts the threads for this auctioneer's replication role: accepting
+ * 	replicas if it is a primary with --primary, or following its primary
+ * 	if it is a replica. A replica with --primary binds the endpoint now,
+ * 	but only accepts replicas on it once it has been promoted.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Errors: Exits with status 17 and connect error message if it cannot listen
+ * 	for replicas, or with status 18 if it cannot connect to its primary.
+ */
+void init_replication(ProgramParameters* parameters) {
+    pthread_t tid;
+    if (parameters->primaryEndpoint) {
+	parameters->replicaListenFd =
+		create_socket(parameters->primaryEndpoint);
+	if (!parameters->replicaOf && !start_accepting_replicas(parameters)) {
+	    fprintf(stderr, PORT_CONNECT_ERR_MSG);
+	    exit(PORT_CONNECT_ERR);
+	}
+    }
+    if (parameters->replicaOf) {
+	ReplicaState* replica = &parameters->replica;
+	sem_init(&replica->queueLock, 0, 1);
+	sem_init(&replica->queued, 0, 0);
+	replica->head = NULL;
+	replica->tail = NULL;
+	replica->receivedSeq = 0;
+	replica->appliedSeq = 0;
+	replica->lastSentTime = get_wall_time_ms();
+	replica->lastReceiveTime = replica->lastSentTime;
+
+	int fd = connect_endpoint(parameters->replicaOf);
+	if (fd < 0) {
+	    fprintf(stderr, PRIMARY_CONNECT_ERR_MSG);
+	    exit(PRIMARY_CONNECT_ERR);
+	}
+	parameters->replicationFd = fd;
+	pthread_create(&tid, NULL, follow_primary, parameters);
+	pthread_detach(tid);
+	pthread_create(&tid, NULL, apply_events, parameters);
+	pthread_detach(tid);
+    }
+}
+
+/* start_accepting_replicas()
+ * --------------------------
+ * Listens on the endpoint bound for --primary and starts the thread
+ * 	accepting replicas on it.
+ *
+ * parameters: a data struct containing all the data for the program.
+ *
+ * Returns: true if replicas are being accepted, false if the endpoint
+ * 	cannot be listened on.
+ */
+bool start_accepting_replicas(ProgramParameters* parameters) {
+    if (listen(parameters->replicaListenFd, SOMAXCONN)) {
+	return false;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, accept_replicas, parameters);
+    pthread_detach(tid);
+    return true;
+}
+
+/* accept_replicas()
+ * -----------------
+ * Function for the thread accepting replicas on a primary. Each new replica
+ * 	is sent a snapshot of the items before it joins the event stream.
+ *
+ * params: a null pointer to the struct containing all of program's data.
+ *
+ * Returns: an empty null pointer.
+ */
+void* accept_replicas(void* params) {
+    ProgramParameters* parameters = (ProgramParameters*) params;
+    while (1) {
+	int fd = accept(parameters->replicaListenFd, NULL, NULL);
+	if (fd < 0) {
+	    continue;
+	}
+	ReplicaLink* link = malloc(sizeof(ReplicaLink));
+	link->stream = fdopen(fd, "w");
+	sem_init(&link->queueLock, 0, 1);
+	sem_init(&link->queued, 0, 0);
+	link->head = NULL;
+	link->tail = NULL;
+	link->numOfQueued = 0;
+	link->failed = false;
+
+	// The snapshot is queued like any other record rather than written
+	// with the lock held.
+	char* snapshot;
+	size_t size;
+	FILE* snapshotStream = open_memstream(&snapshot, &size);
+	take_traced_lock(parameters->lock);
+	send_snapshot(parameters, snapshotStream);
+	fclose(snapshotStream);
+	queue_event(link, snapshot);
+	parameters->replicas = realloc(parameters->replicas,
+		sizeof(ReplicaLink*) * ++(parameters->numOfReplicas));
+	parameters->replicas[parameters->numOfReplicas - 1] = link;
+	release_traced_lock(parameters->lock);
+
+	pthread_t tid;
+	pthread_create(&tid, NULL, ship_events, link);
+	pthread_detach(tid);
+    }
+    return NULL;
+}
+
+/* ship_events()
+ * -------------
+ * Function for the thread writing the records queued for one replica by
+ * 	publish_event(), without holding the lock. Once the replica cannot
+ * 	be written to, records are dropped until publish_event() notices and
+ * 	stops the thread.
+ *
+ * link: a null pointer to the replica's link.
+ *
+ * Returns: an empty null pointer.
+ */
+void* ship_events(void* link) {
+    ReplicaLink* replica = (ReplicaLink*) link;
+    while (1) {
+	sem_wait(&replica->queued);
+	take_lock(&replica->queueLock);
+	ReplicationEvent* event = replica->head;
+	replica->head = event->next;
+	if (replica->head == NULL) {
+	    replica->tail = NULL;
+	}
+	bool drained = --replica->numOfQueued == 0;
+	release_lock(&replica->queueLock);
+
+	char* line = event->line;
+	free(event);
+	if (line == NULL) {
+	    break;
+	}
+	// Records are written as they come, and flushed once none are left.
+	if (!replica->failed && (fputs(line, replica->stream) == EOF
+		|| (drained && fflush(replica->stream) == EOF))) {
+	    __atomic_store_n(&replica->failed, true, __ATOMIC_RELEASE);
+	}
+	free(line);
+    }
+    fclose(replica->stream);
+    sem_destroy(&replica->queueLock);
+    sem_destroy(&replica->queued);
+    free(replica);
+    return NULL;
+}
+
+/* follow_primary()
+ * ----------------
+ * Function for the thread receiving a replica's event stream. Records are
+ * 	queued for apply_events() so that the lag behind the primary can be
+ * 	measured. When the stream ends, or a record's header is malformed,
+ * 	the queue is closed, which promotes this replica once everything
+ * 	received before has been applied.
+ *
+ * params: a null pointer to the struct containing all of program's data.
+ *
+ * Returns: an empty null pointer.
+ */
+void* follow_primary(void* params) {
+    ProgramParameters* parameters = (ProgramParameters*) params;
+    ReplicaState* replica = &parameters->replica;
+    FILE* input = fdopen(parameters->replicationFd, "r");
+    char* line;
+    do {
+	line = read_line(input);
+	ReplicationEvent* event = malloc(sizeof(ReplicationEvent));
+	event->next = NULL;
+	if (line && !parse_event_header(line, event)) {
+	    // The stream cannot be trusted past a bad record.
+	    free(line);
+	    line = NULL;
+	}
+	event->line = line;
+
+	take_lock(&replica->queueLock);
+	if (line) {
+	    replica->receivedSeq = event->seq;
+	    replica->lastSentTime = event->sentTime;
+	    replica->lastReceiveTime = get_wall_time_ms();
+	}
+	if (line && line[0] == HEARTBEAT_EVENT) {
+	    free(line);
+	    free(event);
+	    release_lock(&replica->queueLock);
+	    continue;
+	}
+	if (replica->tail) {
+	    replica->tail->next = event;
+	} else {
+	    replica->head = event;
+	}
+	replica->tail = event;
+	release_lock(&replica->queueLock);
+	sem_post(&replica->queued);
+    } while (line);
+    fclose(input);
+    return NULL;
+}
+
+/* parse_event_header()
+ * --------------------
+ * Reads the header of a record from the primary, "type seq time".
+ *
+ * line: the record.
+ * event: where the sequence number and time are stored.
+ *
+ * Returns: true if the header is well formed, false otherwise.
+ */
+bool parse_event_header(const char* line, ReplicationEvent* event) {
+    if (strlen(line) <= 2 || line[1] != ' ' || !isdigit(line[2])) {
+	return false;
+    }
+    char* remainderText;
+    event->seq = strtoul(line + 2, &remainderText, 10);
+    if (*remainderText != ' ') {
+	return false;
+    }
+    char* timeText = remainderText + 1;
+    event->sentTime = strtod(timeText, &remainderText);
+    return remainderText != timeText
+	    && (*remainderText == ' ' || *remainderText == '\0');
+}
+
+/* apply_events()
+ * --------------
+ * Function for the thread applying a replica's queued events to its items,
+ * 	and promoting the replica to primary when the stream ends.
+ *
+ * params: a null pointer to the struct containing all of program's data.
+ *
+ * Returns: an empty null pointer.
+ */
+void* apply_events(void* params) {
+    ProgramParameters* parameters = (ProgramParameters*) params;
+    ReplicaState* replica = &parameters->replica;
+    while (1) {
+	sem_wait(&replica->queued);
+	take_lock(&replica->queueLock);
+	ReplicationEvent* event = replica->head;
+	replica->head = event->next;
+	if (replica->head == NULL) {
+	    replica->tail = NULL;
+	}
+	release_lock(&replica->queueLock);
+
+	take_traced_lock(parameters->lock);
+	if (event->line == NULL) {
+	    // Primary has gone: carry on from here as a primary. Its clients
+	    // are not ours, so their items stay without active sellers and
+	    // bidders.
+	    parameters->role = PRIMARY;
+	    parameters->eventSeq = replica->appliedSeq;
+	    release_traced_lock(parameters->lock);
+	    free(event);
+	    // Replicas of its own are taken if --primary was given; if it
+	    // cannot be listened on, this carries on without them.
+	    if (parameters->replicaListenFd != -1) {
+		start_accepting_replicas(parameters);
+	    }
+	    return NULL;
+	}
+	apply_event(parameters, event->line);
+	refresh_view(parameters);
+	release_traced_lock(parameters->lock);
+
+	take_lock(&replica->queueLock);
+	replica->appliedSeq = event->seq;
+	release_lock(&replica->queueLock);
+	free(event->line);
+	free(event);
+    }
+    return NULL;
+}
@@ -0,0 +1,208 @@
+/*
+ * batch
+ * Bids on items sold by periodic clearing (a call market): bidders add bids
+ * 	to a buffer without the lock, and each interval the buffer is taken
+ * 	and cleared in one pass.
+ * Author: Hamza
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+#include "batch.h"
+
+static unsigned int batch_hash(const char* item, size_t length);
+
+/* batch_create()
+ * --------------
+ * Makes an empty batch for an item.
+ *
+ * item: the name of the item, which is copied.
+ * interval: the milliseconds between clearings.
+ *
+ * Returns: the batch.
+ */
+BidBatch* batch_create(const char* item, int interval) {
+    BidBatch* batch = calloc(1, sizeof(BidBatch));
+    batch->item = strdup(item);
+    batch->hash = batch_hash(item, strlen(item));
+    batch->interval = interval;
+    return batch;
+}
+
+/* batch_destroy()
+ * ---------------
+ * Frees a batch once no bidder can be using it.
+ *
+ * batch: the batch to free.
+ *
+ * Returns: void
+ */
+void batch_destroy(void* batch) {
+    free(((BidBatch*) batch)->item);
+    free(batch);
+}
+
+/* batch_append()
+ * --------------
+ * Adds a bid to the active buffer without a lock. The bidder announces
+ * 	itself as writing before checking that the buffer is still active, so
+ * 	batch_take() either sees it and waits or has already swapped buffers,
+ * 	in which case the bidder tries again on the new one.
+ *
+ * batch: the item's batch.
+ * client: the bidder's index in parameters->clients.
+ * amount: the bid.
+ *
+ * Returns: true if the bid was added, false if the buffer is full.
+ */
+bool batch_append(BidBatch* batch, int client, int amount) {
+    while (1) {
+	int active = __atomic_load_n(&batch->active, __ATOMIC_SEQ_CST);
+	BidBuffer* buffer = &batch->buffers[active];
+	__atomic_add_fetch(&buffer->numOfWriters, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&batch->active, __ATOMIC_SEQ_CST) != active) {
+	    __atomic_sub_fetch(&buffer->numOfWriters, 1, __ATOMIC_SEQ_CST);
+	    continue;
+	}
+	int slot = __atomic_fetch_add(&buffer->numOfClaimed, 1,
+		__ATOMIC_RELAXED);
+	if (slot < BATCH_CAPACITY) {
+	    buffer->bids[slot].client = client;
+	    buffer->bids[slot].amount = amount;
+	    __atomic_store_n(&buffer->bids[slot].ready, 1, __ATOMIC_RELEASE);
+	}
+	__atomic_sub_fetch(&buffer->numOfWriters, 1, __ATOMIC_SEQ_CST);
+	return slot < BATCH_CAPACITY;
+    }
+}
+
+/* batch_take()
+ * ------------
+ * Swaps buffers so that new bids go into the empty one, then waits for
+ * 	bidders still writing into the old one. Callers must be serialised,
+ * 	and must pass the buffer to batch_reset() before taking again.
+ *
+ * batch: the item's batch.
+ * numOfBids: set to the number of bids taken.
+ *
+ * Returns: the buffer of bids taken, in the order they were claimed.
+ */
+BidBuffer* batch_take(BidBatch* batch, int* numOfBids) {
+    int taken = batch->active;
+    BidBuffer* buffer = &batch->buffers[taken];
+    __atomic_store_n(&batch->active, !taken, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&buffer->numOfWriters, __ATOMIC_SEQ_CST)) {
+	sched_yield();
+    }
+    int claimed = __atomic_load_n(&buffer->numOfClaimed, __ATOMIC_ACQUIRE);
+    *numOfBids = claimed < BATCH_CAPACITY ? claimed : BATCH_CAPACITY;
+    return buffer;
+}
+
+/* batch_reset()
+ * -------------
+ * Empties a buffer from batch_take() once its bids have been cleared.
+ *
+ * buffer: the buffer.
+ * numOfBids: the number of bids it held.
+ *
+ * Returns: void
+ */
+void batch_reset(BidBuffer* buffer, int numOfBids) {
+    for (int i = 0; i < numOfBids; i++) {
+	buffer->bids[i].ready = 0;
+    }
+    __atomic_store_n(&buffer->numOfClaimed, 0, __ATOMIC_RELEASE);
+}
+
+/* batch_table_update()
+ * --------------------
+ * Makes a new table of batch items from an old one, with one batch added or
+ * 	removed. The table is an open-addressing table with linear probing,
+ * 	kept at most half full, as the name index is.
+ *
+ * table: the current table, or NULL for none.
+ * added: a batch to add, or NULL.
+ * removed: a batch to leave out, or NULL.
+ *
+ * Returns: the new table, or NULL if it would be empty.
+ */
+BatchTable* batch_table_update(const BatchTable* table, BidBatch* added,
+	BidBatch* removed) {
+    int numOfBatches = (table ? table->numOfBatches : 0) + (added != NULL)
+	    - (removed != NULL);
+    if (numOfBatches == 0) {
+	return NULL;
+    }
+    int capacity = MIN_BATCH_TABLE;
+    while (numOfBatches * 2 > capacity) {
+	capacity *= 2;
+    }
+    BatchTable* updated = calloc(1, sizeof(BatchTable)
+	    + sizeof(BatchSlot) * capacity);
+    updated->numOfBatches = numOfBatches;
+    updated->capacity = capacity;
+    unsigned int mask = capacity - 1;
+    for (int i = -1; i < (table ? table->capacity : 0); i++) {
+	BidBatch* batch = i == -1 ? added : table->slots[i].batch;
+	if (batch == NULL || batch == removed) {
+	    continue;
+	}
+	unsigned int slot = batch->hash & mask;
+	while (updated->slots[slot].batch) {
+	    slot = (slot + 1) & mask;
+	}
+	updated->slots[slot].hash = batch->hash;
+	updated->slots[slot].batch = batch;
+    }
+    return updated;
+}
+
+/* batch_table_find()
+ * ------------------
+ * Finds an item's batch by name.
+ *
+ * table: the table, or NULL for none.
+ * item: the name, which need not be terminated.
+ * length: the length of the name.
+ *
+ * Returns: the batch, or NULL if the item is not sold by clearing.
+ */
+BidBatch* batch_table_find(const BatchTable* table, const char* item,
+	size_t length) {
+    if (table == NULL) {
+	return NULL;
+    }
+    unsigned int mask = table->capacity - 1;
+    unsigned int hash = batch_hash(item, length);
+    for (unsigned int slot = hash & mask; table->slots[slot].batch;
+	    slot = (slot + 1) & mask) {
+	BidBatch* batch = table->slots[slot].batch;
+	if (table->slots[slot].hash == hash
+		&& strncmp(batch->item, item, length) == 0
+		&& batch->item[length] == '\0') {
+	    return batch;
+	}
+    }
+    return NULL;
+}
+
+/* batch_hash()
+ * ------------
+ * Hashes an item name (FNV-1a), as the name index does.
+ *
+ * item: the name, which need not be terminated.
+ * length: the length of the name.
+ *
+ * Returns: the hash of the name.
+ */
+static unsigned int batch_hash(const char* item, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+	hash ^= (unsigned char) item[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,73 @@
+/*
+ * batch
+ * Bids on items sold by periodic clearing (a call market): bidders add bids
+ * 	to a buffer without the lock, and each interval the buffer is taken
+ * 	and cleared in one pass.
+ * Author: Hamza
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bids an item can collect in one interval. Past this, it is cleared early.
+#define BATCH_CAPACITY 4096
+
+// Smallest table of batch items (a power of two).
+#define MIN_BATCH_TABLE 16
+
+// A bid waiting to be cleared, by the client's index in parameters->clients.
+// An amount of 0 marks a bid dropped because its client left. ready is set
+// once the rest has been written.
+typedef struct {
+    int client;
+    int amount;
+    int ready;
+} BatchBid;
+
+// Bids collected in one interval. Bidders claim a slot by counting up
+// numOfClaimed, and numOfWriters counts those still writing theirs.
+typedef struct {
+    int numOfClaimed;
+    int numOfWriters;
+    BatchBid bids[BATCH_CAPACITY];
+} BidBuffer;
+
+// An item sold by clearing. Bids go into the active buffer while the other
+// is empty or being cleared. The name is a copy, as bidders may still be
+// using the batch after the item has closed.
+typedef struct {
+    char* item;
+    unsigned int hash;
+    int interval;
+    double nextClear;
+    int active;
+    BidBuffer buffers[2];
+} BidBatch;
+
+typedef struct {
+    unsigned int hash;
+    BidBatch* batch;
+} BatchSlot;
+
+// An immutable table of the batch items by name, published for bidders
+// which take no lock, and replaced whenever a batch item opens or closes.
+typedef struct {
+    int numOfBatches;
+    int capacity;
+    BatchSlot slots[];
+} BatchTable;
+
+BidBatch* batch_create(const char* item, int interval);
+void batch_destroy(void* batch);
+bool batch_append(BidBatch* batch, int client, int amount);
+BidBuffer* batch_take(BidBatch* batch, int* numOfBids);
+void batch_reset(BidBuffer* buffer, int numOfBids);
+BatchTable* batch_table_update(const BatchTable* table, BidBatch* added,
+	BidBatch* removed);
+BidBatch* batch_table_find(const BatchTable* table, const char* item,
+	size_t length);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * capture
+ * Reading and writing the JSON lines capture files made by
+ * 	auctioneer --record and fed back by auctionreplay.
+ * Author: Hamza
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "capture.h"
+
+/* write_json_string()
+ * -------------------
+ * Writes a string as a quoted and escaped JSON string.
+ *
+ * output: the stream to write to.
+ * text: the string to write.
+ *
+ * Returns: void
+ */
+static void write_json_string(FILE* output, const char* text) {
+    fputc('"', output);
+    for (const unsigned char* c = (const unsigned char*) text; *c; c++) {
+	if (*c == '"' || *c == '\\') {
+	    fprintf(output, "\\%c", *c);
+	} else if (*c == '\n') {
+	    fputs("\\n", output);
+	} else if (*c == '\t') {
+	    fputs("\\t", output);
+	} else if (*c < ' ') {
+	    fprintf(output, "\\u%04x", *c);
+	} else {
+	    fputc(*c, output);
+	}
+    }
+    fputc('"', output);
+}
+
+/* write_capture_record()
+ * ----------------------
+ * Appends one record to a capture file as a line of JSON, e.g.
+ * 	{"type":"command","t":12.5,"client":3,"line":"bid a 7"}
+ *
+ * capture: the capture file.
+ * type: the kind of record, e.g. CAPTURE_COMMAND.
+ * time: milliseconds since the start of the capture.
+ * client: the number of the client the record is for.
+ * line: the command for a command record, or NULL.
+ *
+ * Returns: void
+ */
+void write_capture_record(FILE* capture, const char* type, double time,
+	int client, const char* line) {
+    fprintf(capture, "{\"type\":\"%s\",\"t\":%.3f,\"client\":%d", type, time,
+	    client);
+    if (line) {
+	fputs(",\"line\":", capture);
+	write_json_string(capture, line);
+    }
+    fputs("}\n", capture);
+}
+
+/* find_value()
+ * ------------
+ * Finds the value of a key in a capture record. Any quote inside a string
+ * 	value is escaped, so a quoted key followed by a colon can only be a
+ * 	real key.
+ *
+ * text: the JSON text of the record.
+ * key: the key to look for.
+ *
+ * Returns: a pointer to the start of the value, or NULL if the key is absent.
+ */
+static const char* find_value(const char* text, const char* key) {
+    char pattern[MAX_CAPTURE_TYPE + 4];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* match = strstr(text, pattern);
+    if (match == NULL) {
+	return NULL;
+    }
+    match += strlen(pattern);
+    while (*match == ' ') {
+	match++;
+    }
+    return match;
+}
+
+/* read_json_string()
+ * ------------------
+ * Reads a quoted JSON string, undoing its escapes.
+ *
+ * text: a pointer to the opening quote.
+ *
+ * Returns: the unescaped string, which the caller must free, or NULL if the
+ * 	string is malformed.
+ */
+static char* read_json_string(const char* text) {
+    if (*text != '"') {
+	return NULL;
+    }
+    char* result = malloc(strlen(text) + 1);
+    int length = 0;
+    for (text++; *text && *text != '"'; text++) {
+	if (*text != '\\') {
+	    result[length++] = *text;
+	    continue;
+	}
+	switch (*++text) {
+	    case 'n':
+		result[length++] = '\n';
+		break;
+	    case 't':
+		result[length++] = '\t';
+		break;
+	    case 'r':
+		result[length++] = '\r';
+		break;
+	    case 'u': {
+		// Only the control characters written above are expected.
+		unsigned int code = 0;
+		if (sscanf(text + 1, "%4x", &code) != 1) {
+		    free(result);
+		    return NULL;
+		}
+		result[length++] = code < 0x80 ? code : '?';
+		text += 4;
+		break;
+	    }
+	    case '\0':
+		free(result);
+		return NULL;
+	    default:
+		result[length++] = *text;
+	}
+    }
+    if (*text != '"') {
+	free(result);
+	return NULL;
+    }
+    result[length] = '\0';
+    return result;
+}
+
+/* parse_capture_record()
+ * ----------------------
+ * Parses one line of a capture file.
+ *
+ * text: the line of JSON.
+ * record: the record to fill in. Its line is NULL unless the record has one,
+ * 	in which case the caller must free it.
+ *
+ * Returns: true if the line is a valid record, false otherwise.
+ */
+bool parse_capture_record(const char* text, CaptureRecord* record) {
+    const char* type = find_value(text, "type");
+    const char* time = find_value(text, "t");
+    const char* client = find_value(text, "client");
+    if (type == NULL || time == NULL || client == NULL) {
+	return false;
+    }
+    char* typeText = read_json_string(type);
+    if (typeText == NULL || strlen(typeText) >= MAX_CAPTURE_TYPE) {
+	free(typeText);
+	return false;
+    }
+    strcpy(record->type, typeText);
+    free(typeText);
+    record->time = strtod(time, NULL);
+    record->client = atoi(client);
+
+    record->line = NULL;
+    const char* line = find_value(text, "line");
+    if (line) {
+	record->line = read_json_string(line);
+	if (record->line == NULL) {
+	    return false;
+	}
+    }
+    return true;
+}
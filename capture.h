@@ -0,0 +1,33 @@
+/*
+ * capture
+ * Reading and writing the JSON lines capture files made by
+ * 	auctioneer --record and fed back by auctionreplay.
+ * Author: Hamza
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Kinds of capture record.
+#define CAPTURE_CONNECT "connect"
+#define CAPTURE_COMMAND "command"
+#define CAPTURE_CLOSE "close"
+#define MAX_CAPTURE_TYPE 16
+
+// One record of a capture: something a client did at a point in time,
+// measured in milliseconds from the start of the capture.
+typedef struct {
+    char type[MAX_CAPTURE_TYPE];
+    double time;
+    int client;
+    char* line;
+} CaptureRecord;
+
+void write_capture_record(FILE* capture, const char* type, double time,
+	int client, const char* line);
+bool parse_capture_record(const char* text, CaptureRecord* record);
+
+#endif
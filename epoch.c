@@ -0,0 +1,168 @@
+/*
+ * epoch
+ * Epoch-based reclamation, letting readers use shared data without a lock
+ * 	while writers swap in new versions and free the old ones once no
+ * 	reader can still see them.
+ * Author: Hamza
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "epoch.h"
+
+/* epoch_init()
+ * ------------
+ * Sets up an epoch domain with no readers and nothing retired.
+ *
+ * domain: the domain to set up.
+ *
+ * Returns: void
+ */
+void epoch_init(EpochDomain* domain) {
+    memset(domain, 0, sizeof(EpochDomain));
+    // Epoch 0 marks a reader slot which is not reading.
+    domain->epoch = 1;
+}
+
+/* epoch_register()
+ * ----------------
+ * Claims a reader slot for the calling thread.
+ *
+ * domain: the domain to read from.
+ *
+ * Returns: the reader slot, or -1 if every slot is taken.
+ */
+int epoch_register(EpochDomain* domain) {
+    for (int i = 0; i < MAX_EPOCH_READERS; i++) {
+	int unclaimed = 0;
+	if (__atomic_compare_exchange_n(&domain->readers[i].claimed,
+		&unclaimed, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	    // Writers only look at slots below the highest ever claimed.
+	    int numOfSlots = __atomic_load_n(&domain->numOfSlots,
+		    __ATOMIC_RELAXED);
+	    while (numOfSlots <= i && !__atomic_compare_exchange_n(
+		    &domain->numOfSlots, &numOfSlots, i + 1, false,
+		    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	    }
+	    return i;
+	}
+    }
+    return -1;
+}
+
+/* epoch_unregister()
+ * ------------------
+ * Gives back a reader slot. The thread must not be inside the epoch.
+ *
+ * domain: the domain read from.
+ * reader: the slot from epoch_register().
+ *
+ * Returns: void
+ */
+void epoch_unregister(EpochDomain* domain, int reader) {
+    __atomic_store_n(&domain->readers[reader].claimed, 0, __ATOMIC_RELEASE);
+}
+
+/* epoch_enter()
+ * -------------
+ * Starts a read. Anything loaded from shared pointers after this stays
+ * 	valid until epoch_exit(), even if a writer retires it meanwhile.
+ *
+ * domain: the domain to read from.
+ * reader: the slot from epoch_register().
+ *
+ * Returns: void
+ */
+void epoch_enter(EpochDomain* domain, int reader) {
+    // Sequentially consistent so that the announcement is visible before
+    // any shared pointer is loaded.
+    __atomic_store_n(&domain->readers[reader].epoch,
+	    __atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST),
+	    __ATOMIC_SEQ_CST);
+}
+
+/* epoch_exit()
+ * ------------
+ * Ends a read started with epoch_enter().
+ *
+ * domain: the domain read from.
+ * reader: the slot from epoch_register().
+ *
+ * Returns: void
+ */
+void epoch_exit(EpochDomain* domain, int reader) {
+    __atomic_store_n(&domain->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* epoch_retire()
+ * --------------
+ * Hands over something a writer has just unpublished, to be destroyed once
+ * 	every reader which might have loaded it has left. Writers must be
+ * 	serialised by the caller, and must unpublish before retiring.
+ *
+ * domain: the domain the readers use.
+ * pointer: what was unpublished.
+ * destroy: the function to free it with.
+ *
+ * Returns: void
+ */
+void epoch_retire(EpochDomain* domain, void* pointer,
+	void (*destroy)(void* pointer)) {
+    Retired* retired = malloc(sizeof(Retired));
+    retired->pointer = pointer;
+    retired->destroy = destroy;
+    retired->epoch = __atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST);
+    retired->next = domain->retired;
+    domain->retired = retired;
+    domain->numOfRetired++;
+
+    // Readers entering from now on cannot have seen the pointer.
+    __atomic_add_fetch(&domain->epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+/* epoch_reclaim()
+ * ---------------
+ * Destroys whatever was retired before the oldest epoch still being read.
+ * 	The retired list is newest first, and nothing more can be destroyed
+ * 	until the oldest reader leaves, so a reader which stays a long time
+ * 	does not make each call walk everything retired meanwhile. Writers
+ * 	must be serialised by the caller.
+ *
+ * domain: the domain the readers use.
+ *
+ * Returns: the number of retired pointers still waiting for readers.
+ */
+int epoch_reclaim(EpochDomain* domain) {
+    unsigned long oldest = __atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST);
+    int numOfSlots = __atomic_load_n(&domain->numOfSlots, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < numOfSlots; i++) {
+	unsigned long epoch = __atomic_load_n(&domain->readers[i].epoch,
+		__ATOMIC_SEQ_CST);
+	if (epoch != 0 && epoch < oldest) {
+	    oldest = epoch;
+	}
+    }
+
+    if (oldest == domain->reclaimedBefore) {
+	return domain->numOfRetired;
+    }
+    domain->reclaimedBefore = oldest;
+
+    int waiting = 0;
+    Retired** link = &domain->retired;
+    while (*link && (*link)->epoch >= oldest) {
+	waiting++;
+	link = &(*link)->next;
+    }
+    Retired* retired = *link;
+    *link = NULL;
+    while (retired) {
+	Retired* next = retired->next;
+	retired->destroy(retired->pointer);
+	free(retired);
+	retired = next;
+    }
+    domain->numOfRetired = waiting;
+    return waiting;
+}
@@ -0,0 +1,48 @@
+/*
+ * epoch
+ * Epoch-based reclamation, letting readers use shared data without a lock
+ * 	while writers swap in new versions and free the old ones once no
+ * 	reader can still see them.
+ * Author: Hamza
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Most threads which can be reading at once. Threads beyond this are not
+// given a reader slot and must read under the writers' lock instead.
+#define MAX_EPOCH_READERS 256
+
+// Something a writer has replaced, waiting for its readers to leave.
+typedef struct Retired {
+    void* pointer;
+    void (*destroy)(void* pointer);
+    unsigned long epoch;
+    struct Retired* next;
+} Retired;
+
+// The epoch a reader slot is in, or 0 while the slot is not reading.
+typedef struct {
+    unsigned long epoch;
+    int claimed;
+} EpochReader;
+
+typedef struct {
+    unsigned long epoch;
+    EpochReader readers[MAX_EPOCH_READERS];
+    int numOfSlots;
+    Retired* retired;
+    int numOfRetired;
+    unsigned long reclaimedBefore;
+} EpochDomain;
+
+void epoch_init(EpochDomain* domain);
+int epoch_register(EpochDomain* domain);
+void epoch_unregister(EpochDomain* domain, int reader);
+void epoch_enter(EpochDomain* domain, int reader);
+void epoch_exit(EpochDomain* domain, int reader);
+void epoch_retire(EpochDomain* domain, void* pointer,
+	void (*destroy)(void* pointer));
+int epoch_reclaim(EpochDomain* domain);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * placement
+ * Where threads run and where large arrays live: pinning threads to CPUs,
+ * 	and mapping the item store on a chosen NUMA node and on huge pages.
+ * Author: Hamza
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "placement.h"
+
+#define CPU_SYSFS_FORMAT "/sys/devices/system/cpu/cpu%d"
+#define NODE_SYSFS_FORMAT "/sys/devices/system/node/node%d"
+
+// Set once by placement_init(), before any thread but the main one starts.
+static Placement placement = {false, 0, {0}, -1, HUGE_PAGES_OFF};
+static int nextWorker;
+static size_t mappedBytes;
+
+static bool parse_cpus(char* list);
+static void pin_to(int cpu);
+static void* map_placed(size_t size);
+
+/* placement_init()
+ * ----------------
+ * Reads what --placement asked for, as comma-separated key=value pairs,
+ * 	e.g. "cpus=0-7:16-23,node=0,huge=thp". cpus is a colon-separated list
+ * 	of CPUs and ranges to pin threads to; node is the NUMA node for the
+ * 	item store, by default that of the first CPU; huge is thp, explicit or
+ * 	off, and is thp unless given.
+ *
+ * spec: the value given with --placement.
+ *
+ * Returns: true if the spec is valid and its CPUs and node exist, false
+ * 	otherwise.
+ */
+bool placement_init(const char* spec) {
+    placement.enabled = true;
+    placement.hugePages = HUGE_PAGES_TRANSPARENT;
+    bool nodeGiven = false;
+    char* text = strdup(spec);
+    bool valid = true;
+    for (char* pair = strtok(text, ","); pair && valid;
+	    pair = strtok(NULL, ",")) {
+	char* value = strchr(pair, '=');
+	if (value == NULL) {
+	    valid = false;
+	    break;
+	}
+	*value++ = '\0';
+	if (strcmp(pair, "cpus") == 0) {
+	    valid = parse_cpus(value);
+	} else if (strcmp(pair, "node") == 0) {
+	    char* remainderText;
+	    placement.node = strtol(value, &remainderText, 10);
+	    char path[64];
+	    snprintf(path, sizeof(path), NODE_SYSFS_FORMAT, placement.node);
+	    valid = remainderText != value && *remainderText == '\0'
+		    && placement.node >= 0 && access(path, F_OK) == 0;
+	    nodeGiven = true;
+	} else if (strcmp(pair, "huge") == 0) {
+	    const char* modes[] = {"off", "thp", "explicit"};
+	    valid = false;
+	    for (int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (strcmp(value, modes[i]) == 0) {
+		    placement.hugePages = i;
+		    valid = true;
+		}
+	    }
+	} else {
+	    valid = false;
+	}
+    }
+    free(text);
+    if (!nodeGiven && placement.numOfCpus) {
+	placement.node = placement_cpu_node(placement.cpus[0]);
+    }
+    return valid;
+}
+
+/* parse_cpus()
+ * ------------
+ * Reads a list of CPUs such as "0-7:16:18", keeping those the process may
+ * 	run on.
+ *
+ * list: the list, which is split up in place.
+ *
+ * Returns: true if the list is well formed and every CPU in it may be used,
+ * 	false otherwise.
+ */
+static bool parse_cpus(char* list) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    char* rest;
+    for (char* range = strtok_r(list, ":", &rest); range;
+	    range = strtok_r(NULL, ":", &rest)) {
+	char* remainderText;
+	long first = strtol(range, &remainderText, 10);
+	long last = first;
+	if (*remainderText == '-') {
+	    char* end = remainderText + 1;
+	    last = strtol(end, &remainderText, 10);
+	    if (remainderText == end) {
+		return false;
+	    }
+	}
+	if (remainderText == range || *remainderText || first < 0
+		|| last < first || last >= CPU_SETSIZE) {
+	    return false;
+	}
+	for (long cpu = first; cpu <= last; cpu++) {
+	    if (!CPU_ISSET(cpu, &allowed)
+		    || placement.numOfCpus == MAX_PLACEMENT_CPUS) {
+		return false;
+	    }
+	    placement.cpus[placement.numOfCpus++] = cpu;
+	}
+    }
+    return placement.numOfCpus > 0;
+}
+
+/* placement_get()
+ * ---------------
+ * Gets what --placement asked for.
+ *
+ * Returns: the placement, which is not enabled without --placement.
+ */
+const Placement* placement_get(void) {
+    return &placement;
+}
+
+/* placement_cpu_node()
+ * --------------------
+ * Finds the NUMA node a CPU belongs to, from the node entry sysfs keeps in
+ * 	the CPU's directory.
+ *
+ * cpu: the CPU.
+ *
+ * Returns: the node, or -1 if the kernel does not say (e.g. without NUMA).
+ */
+int placement_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), CPU_SYSFS_FORMAT, cpu);
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+	return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while (node == -1 && (entry = readdir(directory))) {
+	if (sscanf(entry->d_name, "node%d", &node) != 1) {
+	    node = -1;
+	}
+    }
+    closedir(directory);
+    return node;
+}
+
+/* placement_pin_service()
+ * -----------------------
+ * Pins the calling thread to the first CPU given. Called by the main thread
+ * 	before it starts any other, so that they all start out there too.
+ *
+ * Returns: void
+ */
+void placement_pin_service(void) {
+    if (placement.numOfCpus) {
+	pin_to(placement.cpus[0]);
+    }
+}
+
+/* placement_pin_worker()
+ * ----------------------
+ * Pins the calling connection thread to the next of the CPUs after the
+ * 	first, in turn, or to the first if it is the only one. Memory the
+ * 	thread then allocates and touches first, such as its input buffer, is
+ * 	put on that CPU's node by the kernel.
+ *
+ * Returns: void
+ */
+void placement_pin_worker(void) {
+    if (placement.numOfCpus == 0) {
+	return;
+    }
+    int numOfWorkers = placement.numOfCpus - 1;
+    if (numOfWorkers == 0) {
+	pin_to(placement.cpus[0]);
+	return;
+    }
+    int worker = __atomic_fetch_add(&nextWorker, 1, __ATOMIC_RELAXED);
+    pin_to(placement.cpus[1 + worker % numOfWorkers]);
+}
+
+/* pin_to()
+ * --------
+ * Restricts the calling thread to one CPU. Failing is harmless, so is not
+ * 	reported: the thread keeps running where it was.
+ *
+ * cpu: the CPU.
+ *
+ * Returns: void
+ */
+static void pin_to(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* placement_alloc()
+ * -----------------
+ * Allocates memory for a large array. With --placement, allocations of at
+ * 	least PLACED_MIN_SIZE are mapped on their own, on the node and huge
+ * 	pages asked for; anything else comes from malloc.
+ *
+ * size: the bytes needed.
+ *
+ * Returns: the memory, or NULL if there is none.
+ */
+void* placement_alloc(size_t size) {
+    if (!placement.enabled || size < PLACED_MIN_SIZE) {
+	return malloc(size);
+    }
+    return map_placed(size);
+}
+
+/* placement_grow()
+ * ----------------
+ * Resizes memory from placement_alloc(), keeping its contents, like realloc.
+ *
+ * pointer: the memory, or NULL for none yet.
+ * oldSize: the size it was allocated with.
+ * newSize: the size needed, at least oldSize.
+ *
+ * Returns: the memory, which may have moved, or NULL if there is none.
+ */
+void* placement_grow(void* pointer, size_t oldSize, size_t newSize) {
+    if (!placement.enabled || newSize < PLACED_MIN_SIZE) {
+	return realloc(pointer, newSize);
+    }
+    void* grown = map_placed(newSize);
+    if (grown && pointer) {
+	memcpy(grown, pointer, oldSize);
+	placement_free(pointer, oldSize);
+    }
+    return grown;
+}
+
+/* placement_free()
+ * ----------------
+ * Frees memory from placement_alloc() or placement_grow().
+ *
+ * pointer: the memory.
+ * size: the size it was last allocated with.
+ *
+ * Returns: void
+ */
+void placement_free(void* pointer, size_t size) {
+    if (!placement.enabled || size < PLACED_MIN_SIZE) {
+	free(pointer);
+	return;
+    }
+    size_t mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    munmap(pointer, mapped);
+    __atomic_sub_fetch(&mappedBytes, mapped, __ATOMIC_RELAXED);
+}
+
+/* placement_mapped()
+ * ------------------
+ * Gets how much memory is mapped by placement_alloc() at the moment.
+ *
+ * Returns: the size in bytes, in whole huge pages.
+ */
+size_t placement_mapped(void) {
+    return __atomic_load_n(&mappedBytes, __ATOMIC_RELAXED);
+}
+
+/* map_placed()
+ * ------------
+ * Maps memory on the node and pages asked for. Explicit huge pages fall back
+ * 	to transparent ones when none are reserved, and the node is only a
+ * 	preference, which the kernel ignores where there is no NUMA.
+ *
+ * size: the bytes needed.
+ *
+ * Returns: the memory, or NULL if it could not be mapped.
+ */
+static void* map_placed(size_t size) {
+    size_t mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    void* memory = MAP_FAILED;
+    if (placement.hugePages == HUGE_PAGES_EXPLICIT) {
+	memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (memory == MAP_FAILED) {
+	memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+	    return NULL;
+	}
+	if (placement.hugePages != HUGE_PAGES_OFF) {
+	    madvise(memory, mapped, MADV_HUGEPAGE);
+	}
+    }
+#ifdef SYS_mbind
+    // Set before the pages are touched, so that they are allocated there.
+    if (placement.node >= 0
+	    && placement.node < 8 * (int) sizeof(unsigned long)) {
+	unsigned long nodes = 1UL << placement.node;
+	syscall(SYS_mbind, memory, mapped, MPOL_PREFERRED, &nodes,
+		8 * sizeof(nodes), 0);
+    }
+#endif
+    __atomic_add_fetch(&mappedBytes, mapped, __ATOMIC_RELAXED);
+    return memory;
+}
@@ -0,0 +1,51 @@
+/*
+ * placement
+ * Where threads run and where large arrays live: pinning threads to CPUs,
+ * 	and mapping the item store on a chosen NUMA node and on huge pages.
+ * Author: Hamza
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Allocations at least this large are mapped on their own, so that they can
+// be put on a node and backed by huge pages. Smaller ones use malloc.
+#define PLACED_MIN_SIZE (2UL << 20)
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+// Most CPUs --placement can pin threads to.
+#define MAX_PLACEMENT_CPUS 1024
+
+// How large mappings are backed: by transparent huge pages where the kernel
+// can, by pages from the reserved huge page pool, or by normal pages.
+enum HugePages {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_EXPLICIT
+};
+
+// What --placement asked for. The first CPU runs the service threads (the
+// acceptor, the timer and their helpers), and connection threads take the
+// others in turn. A node of -1 leaves memory wherever the kernel puts it.
+typedef struct {
+    bool enabled;
+    int numOfCpus;
+    int cpus[MAX_PLACEMENT_CPUS];
+    int node;
+    int hugePages;
+} Placement;
+
+bool placement_init(const char* spec);
+const Placement* placement_get(void);
+int placement_cpu_node(int cpu);
+void placement_pin_service(void);
+void placement_pin_worker(void);
+void* placement_alloc(size_t size);
+void* placement_grow(void* pointer, size_t oldSize, size_t newSize);
+void placement_free(void* pointer, size_t size);
+size_t placement_mapped(void);
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Stops one of two auctioneers behind auctionrouter while a client has
+# several lists waiting, then kills it. Every list must still be answered
+# from the other backend, and the client must then be hung up on rather
+# than left waiting.
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'kill $pids 2>/dev/null; rm -rf "$tmp"' EXIT
+
+./auctioneer 2>"$tmp/b1" & pids="$!"
+./auctioneer 2>"$tmp/b2" & gone="$!"; pids="$pids $gone"
+sleep 0.2
+./auctionrouter --backend "$(cat "$tmp/b1")" --backend "$(cat "$tmp/b2")" \
+	2>"$tmp/router" & pids="$pids $!"
+sleep 0.2
+router=$(cat "$tmp/router")
+
+(sleep 0.3; printf 'list\nlist\nlist\n'; sleep 2) \
+	| timeout 3 ./auctionclient "$router" >"$tmp/replies" 2>/dev/null &
+client="$!"
+sleep 0.2
+kill -STOP "$gone"
+sleep 0.3
+kill -KILL "$gone"
+wait "$client"
+status=$?
+
+cat >"$tmp/expected" <<END
+:list 
+:list 
+:list 
+END
+if [ "$status" = 124 ] || ! diff "$tmp/expected" "$tmp/replies"; then
+    echo "router_backend_gone: FAILED"
+    exit 1
+fi
+echo "router_backend_gone: passed"
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Bids on a batch item through auctionrouter, then lists. The :leading
+# notification from the clearing must reach the client as a notification,
+# not be taken as the reply to the list which follows it. The second bid,
+# from the top bidder, is ignored by the clearing.
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'kill $pids 2>/dev/null; rm -rf "$tmp"' EXIT
+
+./auctioneer 2>"$tmp/b1" & pids="$!"
+./auctioneer 2>"$tmp/b2" & pids="$pids $!"
+sleep 0.2
+./auctionrouter --backend "$(cat "$tmp/b1")" --backend "$(cat "$tmp/b2")" \
+	2>"$tmp/router" & pids="$pids $!"
+sleep 0.2
+router=$(cat "$tmp/router")
+
+(printf 'sell hot 1 60000 200\n'; sleep 1.5) \
+	| ./auctionclient "$router" >"$tmp/seller" 2>&1 & pids="$pids $!"
+sleep 0.2
+(printf 'bid hot 10\n'; sleep 0.5; printf 'list\nbid hot 20\n'; sleep 0.5;
+	printf 'list\n'; sleep 0.2) | ./auctionclient "$router" 2>/dev/null \
+	| sed 's/ [0-9]*|$/ REMAINING|/' >"$tmp/bidder"
+
+cat >"$tmp/expected" <<END
+:batched hot
+:leading hot 10
+:list hot 1 10 REMAINING|
+:batched hot
+:cleared hot 10
+:list hot 1 10 REMAINING|
+END
+if ! diff "$tmp/expected" "$tmp/bidder"; then
+    echo "router_batch: FAILED"
+    exit 1
+fi
+echo "router_batch: passed"
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Sells items through auctionrouter to two archiving auctioneers, lets them
+# close, then asks for their history. Every item must be in the reply,
+# whichever backend it was sold on.
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'kill $pids 2>/dev/null; rm -rf "$tmp"' EXIT
+
+./auctioneer --archive "$tmp/a1" 2>"$tmp/b1" & pids="$!"
+./auctioneer --archive "$tmp/a2" 2>"$tmp/b2" & pids="$pids $!"
+sleep 0.2
+./auctionrouter --backend "$(cat "$tmp/b1")" --backend "$(cat "$tmp/b2")" \
+	2>"$tmp/router" & pids="$pids $!"
+sleep 0.2
+router=$(cat "$tmp/router")
+
+(printf 'sellbatch apple 1 100 banana 1 100 cherry 1 100 date 1 100\n';
+	sleep 0.6; printf 'history\nhistory b\n'; sleep 0.2) \
+	| ./auctionclient "$router" 2>/dev/null | grep '^:history' \
+	| sed 's/^:history //' | while read -r entries; do
+	    printf '%s' "$entries" | tr '|' '\n' | cut -d' ' -f1 | sort \
+		    | tr '\n' ' '
+	    echo
+	done >"$tmp/history"
+
+cat >"$tmp/expected" <<END
+apple banana cherry date 
+banana 
+END
+if ! diff "$tmp/expected" "$tmp/history"; then
+    echo "router_history: FAILED"
+    exit 1
+fi
+echo "router_history: passed"
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Opens a session with a very large ID on a multiplexed connection to an
+# auctioneer with a small per-connection allowance. The session table it
+# would need is over the allowance, so the session must be rejected while a
+# small one is still served.
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d)
+trap 'kill $pids 2>/dev/null; rm -rf "$tmp"' EXIT
+
+./auctioneer --limits conn=64k 2>"$tmp/port" & pids="$!"
+sleep 0.2
+port=$(cat "$tmp/port")
+
+(printf 'mux\n@65535 list\n@3 sell apple 5 1000\n'; sleep 0.2) \
+	| ./auctionclient "$port" 2>/dev/null >"$tmp/replies"
+
+cat >"$tmp/expected" <<END
+:mux
+@65535 :rejected
+@3 :listed apple
+END
+if ! diff "$tmp/expected" "$tmp/replies"; then
+    echo "session_limit: FAILED"
+    exit 1
+fi
+echo "session_limit: passed"
@@ -0,0 +1,278 @@
+/*
+ * trace
+ * An always-on flight recorder: each thread keeps its latest events in a
+ * 	ring of its own, which can be dumped as a Chrome/Perfetto trace.
+ * Author: Hamza
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "trace.h"
+
+// How each kind of event appears in the trace: its name, its Chrome phase
+// ('i' instant, 'B' begin, 'E' end) and the name of its argument.
+typedef struct {
+    const char* name;
+    char phase;
+    const char* argName;
+} TraceFormat;
+
+static const TraceFormat traceFormats[NUM_OF_TRACE_KINDS] = {
+    {"command received", 'i', "client"},
+    {"command", 'B', "client"},
+    {"command", 'E', NULL},
+    {"lock", 'B', "waitNs"},
+    {"lock", 'E', NULL},
+    {"bid accepted", 'i', "amount"},
+    {"bid rejected", 'i', "amount"},
+    {"item expired", 'i', "highestBid"},
+    {"notification flushed", 'i', "session"}
+};
+
+// Rings are claimed by threads as they first record an event, and given back
+// when they exit for later threads to reuse. They are never freed, so a dump
+// can read them at any time.
+static TraceRing* rings[MAX_TRACE_THREADS];
+static int ringClaimed[MAX_TRACE_THREADS];
+static __thread TraceRing* threadRing;
+static __thread bool untraced;
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static const char* dumpPath = "auctioneer.trace.json";
+static int dumpRequested;
+
+/* trace_now()
+ * -----------
+ * Gets the time events are recorded with.
+ *
+ * Returns: nanoseconds of the monotonic clock.
+ */
+unsigned long trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* release_ring()
+ * --------------
+ * Gives back an exiting thread's ring, keeping its events for dumps until
+ * 	another thread claims it.
+ *
+ * slot: the ring's slot, offset by one as thread keys cannot hold 0.
+ */
+static void release_ring(void* slot) {
+    __atomic_store_n(&ringClaimed[(long) slot - 1], 0, __ATOMIC_RELEASE);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ringKey, release_ring);
+}
+
+/* claim_ring()
+ * ------------
+ * Gives the calling thread a ring, the first time it records an event.
+ *
+ * Returns: the ring, or NULL if every ring is taken.
+ */
+static TraceRing* claim_ring(void) {
+    pthread_once(&ringKeyOnce, create_ring_key);
+    for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+	int unclaimed = 0;
+	if (!__atomic_compare_exchange_n(&ringClaimed[i], &unclaimed, 1,
+		false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	    continue;
+	}
+	TraceRing* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+	if (ring == NULL) {
+	    ring = calloc(1, sizeof(TraceRing));
+	    __atomic_store_n(&rings[i], ring, __ATOMIC_RELEASE);
+	}
+	snprintf(ring->name, MAX_TRACE_NAME, "thread %d", i);
+	pthread_setspecific(ringKey, (void*) (long) (i + 1));
+	return ring;
+    }
+    untraced = true;
+    return NULL;
+}
+
+/* trace_event()
+ * -------------
+ * Records an event in the calling thread's ring. This takes no lock and
+ * 	costs a clock read and a few stores.
+ *
+ * kind: the kind of event, from enum TraceKind.
+ * arg: the event's argument, as listed with its kind.
+ *
+ * Returns: void
+ */
+void trace_event(int kind, int arg) {
+    TraceRing* ring = threadRing;
+    if (ring == NULL) {
+	if (untraced || (ring = threadRing = claim_ring()) == NULL) {
+	    return;
+	}
+    }
+    unsigned long head = ring->head;
+    TraceEvent* event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->time = trace_now();
+    event->kind = kind;
+    event->arg = arg;
+    // A dump only reads events below head.
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* trace_name_thread()
+ * -------------------
+ * Names the calling thread in dumps, e.g. "client 3".
+ *
+ * format: a printf format taking one int.
+ * number: the number to name the thread with.
+ *
+ * Returns: void
+ */
+void trace_name_thread(const char* format, int number) {
+    if (threadRing == NULL && (untraced
+	    || (threadRing = claim_ring()) == NULL)) {
+	return;
+    }
+    snprintf(threadRing->name, MAX_TRACE_NAME, format, number);
+}
+
+/* trace_init()
+ * ------------
+ * Sets the file dumps are written to.
+ *
+ * path: the path of the file, which must outlive the program's tracing.
+ *
+ * Returns: void
+ */
+void trace_init(const char* path) {
+    dumpPath = path;
+}
+
+/* trace_memory()
+ * --------------
+ * Returns: the bytes taken by the rings threads have claimed so far.
+ */
+long trace_memory(void) {
+    long total = 0;
+    for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+	if (__atomic_load_n(&rings[i], __ATOMIC_ACQUIRE)) {
+	    total += sizeof(TraceRing);
+	}
+    }
+    return total;
+}
+
+/* trace_path()
+ * ------------
+ * Returns: the file dumps are written to.
+ */
+const char* trace_path(void) {
+    return dumpPath;
+}
+
+/* trace_request_dump()
+ * --------------------
+ * Asks for the rings to be dumped by whichever thread next checks
+ * 	trace_dump_requested(). Safe to call from a signal handler.
+ *
+ * Returns: void
+ */
+void trace_request_dump(void) {
+    __atomic_store_n(&dumpRequested, 1, __ATOMIC_RELEASE);
+}
+
+/* trace_dump_requested()
+ * ----------------------
+ * Checks for, and clears, a request for a dump.
+ *
+ * Returns: true if a dump was requested since the last check.
+ */
+bool trace_dump_requested(void) {
+    return __atomic_exchange_n(&dumpRequested, 0, __ATOMIC_ACQ_REL);
+}
+
+/* write_ring()
+ * ------------
+ * Writes the events in one ring as Chrome trace events. The ring's thread
+ * 	keeps recording meanwhile, so the events are copied first and any
+ * 	it may have overwritten during the copy are left out.
+ *
+ * output: the trace file.
+ * ring: the ring to write.
+ * tid: the thread number to give the events.
+ * first: whether nothing has been written yet, updated.
+ *
+ * Returns: void
+ */
+static void write_ring(FILE* output, TraceRing* ring, int tid, bool* first) {
+    static TraceEvent copy[TRACE_RING_SIZE];
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    for (unsigned long i = start; i < head; i++) {
+	copy[i & (TRACE_RING_SIZE - 1)] =
+		ring->events[i & (TRACE_RING_SIZE - 1)];
+    }
+    unsigned long after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (after >= start + TRACE_RING_SIZE) {
+	// Slots below after - TRACE_RING_SIZE + 1 may have been rewritten.
+	start = after - TRACE_RING_SIZE + 1;
+    }
+
+    int pid = getpid();
+    fprintf(output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+	    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", *first ? "" : ",\n",
+	    pid, tid, ring->name);
+    *first = false;
+    for (unsigned long i = start; i < head; i++) {
+	TraceEvent* event = &copy[i & (TRACE_RING_SIZE - 1)];
+	if (event->kind < 0 || event->kind >= NUM_OF_TRACE_KINDS) {
+	    continue;
+	}
+	const TraceFormat* format = &traceFormats[event->kind];
+	fprintf(output, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+		"\"pid\":%d,\"tid\":%d", format->name, format->phase,
+		event->time / 1000.0, pid, tid);
+	if (format->phase == 'i') {
+	    fputs(",\"s\":\"t\"", output);
+	}
+	if (format->argName) {
+	    fprintf(output, ",\"args\":{\"%s\":%d}", format->argName,
+		    event->arg);
+	}
+	fputc('}', output);
+    }
+}
+
+/* trace_dump()
+ * ------------
+ * Writes every ring's events to the dump file as Chrome trace JSON, which
+ * 	chrome://tracing and Perfetto can open. Must not be called by two
+ * 	threads at once.
+ *
+ * Returns: true if the file was written, false otherwise.
+ */
+bool trace_dump(void) {
+    FILE* output = fopen(dumpPath, "w");
+    if (output == NULL) {
+	return false;
+    }
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", output);
+    bool first = true;
+    for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+	TraceRing* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+	if (ring) {
+	    write_ring(output, ring, i, &first);
+	}
+    }
+    fputs("\n]}\n", output);
+    return fclose(output) == 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * trace
+ * An always-on flight recorder: each thread keeps its latest events in a
+ * 	ring of its own, which can be dumped as a Chrome/Perfetto trace.
+ * Author: Hamza
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+// Events kept per thread (a power of two). Older events are overwritten.
+#define TRACE_RING_SIZE 4096
+
+// Most threads with a ring at once. Threads beyond this are not recorded.
+#define MAX_TRACE_THREADS 256
+
+#define MAX_TRACE_NAME 32
+
+// Kinds of event, with what their argument holds.
+enum TraceKind {
+    TRACE_COMMAND_RECEIVED,	// client index
+    TRACE_COMMAND_START,	// client index
+    TRACE_COMMAND_DONE,		// client index
+    TRACE_LOCK_ACQUIRED,	// nanoseconds spent waiting
+    TRACE_LOCK_RELEASED,	// unused
+    TRACE_BID_ACCEPTED,		// bid amount
+    TRACE_BID_REJECTED,		// bid amount
+    TRACE_ITEM_EXPIRED,		// highest bid
+    TRACE_NOTIFY_FLUSHED,	// session of the client notified
+    NUM_OF_TRACE_KINDS
+};
+
+// One event, timed in nanoseconds of the monotonic clock.
+typedef struct {
+    unsigned long time;
+    int kind;
+    int arg;
+} TraceEvent;
+
+// A thread's events. Only its thread writes; head counts every event ever
+// written, so the newest is at (head - 1) % TRACE_RING_SIZE.
+typedef struct {
+    unsigned long head;
+    char name[MAX_TRACE_NAME];
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+unsigned long trace_now(void);
+void trace_event(int kind, int arg);
+void trace_name_thread(const char* format, int number);
+void trace_init(const char* path);
+const char* trace_path(void);
+long trace_memory(void);
+void trace_request_dump(void);
+bool trace_dump_requested(void);
+bool trace_dump(void);
+
+#endif
@@ -0,0 +1,929 @@
+/*
+ * transport
+ * Endpoint parsing and local transports shared by auctioneer and
+ * 	auctionclient.
+ * Author: Hamza
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <zlib.h>
+#include "transport.h"
+
+// Direction of each ring in the shared region.
+#define SERVER_RING 0
+#define CLIENT_RING 1
+#define NUM_OF_RINGS 2
+
+// memfd, then a data and space eventfd for each ring.
+#define NUM_OF_SHM_FDS 5
+
+#define CACHE_LINE 64
+
+// zlib never compresses better than about 1032 to 1, so packed text claiming
+// to expand by more than this is not trusted.
+#define MAX_PACK_RATIO 1032
+
+// Single-producer single-consumer byte ring living in shared memory. The
+// producer owns head and the consumer owns tail; each lives on its own cache
+// line so the two sides do not false-share.
+typedef struct {
+    unsigned int head;
+    unsigned int readerWaiting;
+    unsigned int closed;
+    char headPad[CACHE_LINE - 3 * sizeof(unsigned int)];
+    unsigned int tail;
+    unsigned int writerWaiting;
+    char tailPad[CACHE_LINE - 2 * sizeof(unsigned int)];
+    char data[SHM_RING_SIZE];
+} ShmRing;
+
+typedef struct {
+    ShmRing rings[NUM_OF_RINGS];
+} ShmRegion;
+
+// Process-local state for one shared-memory connection.
+typedef struct {
+    ShmRegion* region;
+    int dataFds[NUM_OF_RINGS];
+    int spaceFds[NUM_OF_RINGS];
+    int sockFd;
+    int openEnds;
+} ShmTransport;
+
+// Cookie for a FILE stream reading or writing one ring.
+typedef struct {
+    ShmTransport* transport;
+    int ring;
+} RingEnd;
+
+/* is_unix_endpoint()
+ * ------------------
+ * Checks whether an endpoint names a unix domain socket.
+ *
+ * endpoint: a port number or unix:path endpoint.
+ *
+ * Returns: true if the endpoint starts with the unix: prefix.
+ */
+bool is_unix_endpoint(const char* endpoint) {
+    return strncmp(endpoint, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0;
+}
+
+/* unix_endpoint_path()
+ * --------------------
+ * Gets the filesystem path of a unix:path endpoint.
+ *
+ * endpoint: an endpoint for which is_unix_endpoint() is true.
+ *
+ * Returns: the path following the unix: prefix.
+ */
+const char* unix_endpoint_path(const char* endpoint) {
+    return endpoint + strlen(UNIX_PREFIX);
+}
+
+/* fill_unix_address()
+ * -------------------
+ * Fills in a unix socket address for a path.
+ *
+ * address: the address struct to fill in.
+ * path: the filesystem path of the socket.
+ *
+ * Returns: false if the path is empty or too long for a socket address.
+ */
+static bool fill_unix_address(struct sockaddr_un* address, const char* path) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) == 0 || strlen(path) >= sizeof(address->sun_path)) {
+	return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+/* create_unix_listener()
+ * ----------------------
+ * Creates a unix domain stream socket bound to the given path, replacing any
+ * 	stale socket file left at that path.
+ *
+ * path: the filesystem path to bind to.
+ *
+ * Returns: the file descriptor of the socket, or -1 on failure.
+ */
+int create_unix_listener(const char* path) {
+    struct sockaddr_un address;
+    if (!fill_unix_address(&address, path)) {
+	return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &address, sizeof(struct sockaddr_un))) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/* connect_unix()
+ * --------------
+ * Connects to a unix domain stream socket.
+ *
+ * path: the filesystem path of the socket.
+ *
+ * Returns: the file descriptor of the connected socket, or -1 on failure.
+ */
+int connect_unix(const char* path) {
+    struct sockaddr_un address;
+    if (!fill_unix_address(&address, path)) {
+	return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return -1;
+    }
+    if (connect(fd, (struct sockaddr*) &address,
+	    sizeof(struct sockaddr_un))) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/* connect_endpoint()
+ * ------------------
+ * Connects to an auctioneer endpoint on this host.
+ *
+ * endpoint: a TCP port number on localhost or a unix:path endpoint.
+ *
+ * Returns: the file descriptor of the connected socket, or -1 on failure.
+ */
+int connect_endpoint(const char* endpoint) {
+    if (is_unix_endpoint(endpoint)) {
+	return connect_unix(unix_endpoint_path(endpoint));
+    }
+
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET; // IPv4
+    hints.ai_socktype = SOCK_STREAM; // TCP
+    if (getaddrinfo("localhost", endpoint, &hints, &ai)) {
+	return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, ai->ai_addr, sizeof(struct sockaddr))) {
+	close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* signal_event()
+ * --------------
+ * Wakes the peer waiting on an eventfd.
+ *
+ * fd: the eventfd to signal.
+ *
+ * Returns: void
+ */
+static void signal_event(int fd) {
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+/* wait_for_event()
+ * ----------------
+ * Blocks until an eventfd is signalled or the peer hangs up the socket that
+ * 	the transport was set up over.
+ *
+ * eventFd: the eventfd to wait on.
+ * sockFd: the unix socket shared with the peer.
+ *
+ * Returns: true if the event was signalled, false if the peer has gone.
+ */
+static bool wait_for_event(int eventFd, int sockFd) {
+    struct pollfd fds[2] = {
+	{.fd = eventFd, .events = POLLIN},
+	{.fd = sockFd, .events = POLLIN}
+    };
+    while (poll(fds, 2, -1) < 0) {
+	if (errno != EINTR) {
+	    return false;
+	}
+    }
+    if (fds[0].revents & POLLIN) {
+	uint64_t count;
+	while (read(eventFd, &count, sizeof(count)) < 0 && errno == EINTR) {
+	}
+	return true;
+    }
+    // Nothing is sent on the socket once the rings are set up, so it only
+    // becomes readable when the peer closes it.
+    return false;
+}
+
+/* ring_read()
+ * -----------
+ * fopencookie read function which consumes bytes from a ring, blocking until
+ * 	some are available.
+ *
+ * cookie: the RingEnd being read.
+ * buf: the buffer to read into.
+ * size: the size of buf.
+ *
+ * Returns: the number of bytes read, or 0 at end of stream.
+ */
+static ssize_t ring_read(void* cookie, char* buf, size_t size) {
+    RingEnd* end = (RingEnd*) cookie;
+    ShmTransport* transport = end->transport;
+    ShmRing* ring = &transport->region->rings[end->ring];
+    bool peerGone = false;
+    while (1) {
+	unsigned int tail = ring->tail;
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head != tail) {
+	    size_t count = head - tail;
+	    if (count > size) {
+		count = size;
+	    }
+	    size_t offset = tail & (SHM_RING_SIZE - 1);
+	    size_t first = SHM_RING_SIZE - offset;
+	    if (first > count) {
+		first = count;
+	    }
+	    memcpy(buf, ring->data + offset, first);
+	    memcpy(buf + first, ring->data, count - first);
+	    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_SEQ_CST);
+
+	    // Only pay for a wakeup when the writer is blocked on a full ring.
+	    if (__atomic_load_n(&ring->writerWaiting, __ATOMIC_SEQ_CST)) {
+		signal_event(transport->spaceFds[end->ring]);
+	    }
+	    return count;
+	}
+	if (peerGone || __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+	    return 0;
+	}
+
+	// Announce that we are about to sleep, then re-check so a write that
+	// raced with the announcement is not missed.
+	__atomic_store_n(&ring->readerWaiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail
+		&& !__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+	    peerGone = !wait_for_event(transport->dataFds[end->ring],
+		    transport->sockFd);
+	}
+	__atomic_store_n(&ring->readerWaiting, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* ring_write()
+ * ------------
+ * fopencookie write function which appends bytes to a ring, blocking while
+ * 	the ring is full.
+ *
+ * cookie: the RingEnd being written.
+ * buf: the bytes to write.
+ * size: the number of bytes in buf.
+ *
+ * Returns: the number of bytes written, or -1 if the peer has gone.
+ */
+static ssize_t ring_write(void* cookie, const char* buf, size_t size) {
+    RingEnd* end = (RingEnd*) cookie;
+    ShmTransport* transport = end->transport;
+    ShmRing* ring = &transport->region->rings[end->ring];
+    size_t written = 0;
+    while (written < size) {
+	unsigned int head = ring->head;
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t space = SHM_RING_SIZE - (head - tail);
+	if (space == 0) {
+	    __atomic_store_n(&ring->writerWaiting, 1, __ATOMIC_SEQ_CST);
+	    bool peerGone = false;
+	    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == tail) {
+		peerGone = !wait_for_event(transport->spaceFds[end->ring],
+			transport->sockFd);
+	    }
+	    __atomic_store_n(&ring->writerWaiting, 0, __ATOMIC_SEQ_CST);
+	    if (peerGone) {
+		errno = EPIPE;
+		return -1;
+	    }
+	    continue;
+	}
+	size_t count = size - written;
+	if (count > space) {
+	    count = space;
+	}
+	size_t offset = head & (SHM_RING_SIZE - 1);
+	size_t first = SHM_RING_SIZE - offset;
+	if (first > count) {
+	    first = count;
+	}
+	memcpy(ring->data + offset, buf + written, first);
+	memcpy(ring->data, buf + written + first, count - first);
+	__atomic_store_n(&ring->head, head + count, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->readerWaiting, __ATOMIC_SEQ_CST)) {
+	    signal_event(transport->dataFds[end->ring]);
+	}
+	written += count;
+    }
+    return written;
+}
+
+/* release_transport()
+ * -------------------
+ * Drops one stream's reference to a transport, unmapping the shared region
+ * 	and closing the socket once both streams are closed.
+ *
+ * transport: the transport to release.
+ *
+ * Returns: void
+ */
+static void release_transport(ShmTransport* transport) {
+    if (__atomic_sub_fetch(&transport->openEnds, 1, __ATOMIC_ACQ_REL) != 0) {
+	return;
+    }
+    munmap(transport->region, sizeof(ShmRegion));
+    for (int i = 0; i < NUM_OF_RINGS; i++) {
+	close(transport->dataFds[i]);
+	close(transport->spaceFds[i]);
+    }
+    close(transport->sockFd);
+    free(transport);
+}
+
+/* ring_close()
+ * ------------
+ * fopencookie close function. Closing the writing end marks the ring closed
+ * 	so the reader sees end of stream once it has drained the ring.
+ *
+ * cookie: the RingEnd being closed.
+ *
+ * Returns: 0
+ */
+static int ring_close(void* cookie) {
+    RingEnd* end = (RingEnd*) cookie;
+    ShmTransport* transport = end->transport;
+    free(end);
+    release_transport(transport);
+    return 0;
+}
+
+/* ring_close_writer()
+ * -------------------
+ * fopencookie close function for the writing end of a ring.
+ *
+ * cookie: the RingEnd being closed.
+ *
+ * Returns: 0
+ */
+static int ring_close_writer(void* cookie) {
+    RingEnd* end = (RingEnd*) cookie;
+    ShmRing* ring = &end->transport->region->rings[end->ring];
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    signal_event(end->transport->dataFds[end->ring]);
+    return ring_close(cookie);
+}
+
+/* open_ring_stream()
+ * ------------------
+ * Wraps one ring of a transport in a stdio stream, so the rest of the
+ * 	program can keep using read_line() and fprintf() on it.
+ *
+ * transport: the transport owning the ring.
+ * ring: the index of the ring.
+ * writing: true for the producing end, false for the consuming end.
+ *
+ * Returns: the stream.
+ */
+static FILE* open_ring_stream(ShmTransport* transport, int ring,
+	bool writing) {
+    RingEnd* end = malloc(sizeof(RingEnd));
+    end->transport = transport;
+    end->ring = ring;
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    if (writing) {
+	functions.write = ring_write;
+	functions.close = ring_close_writer;
+    } else {
+	functions.read = ring_read;
+	functions.close = ring_close;
+    }
+    return fopencookie(end, writing ? "w" : "r", functions);
+}
+
+/* open_transport_streams()
+ * ------------------------
+ * Creates the stdio streams for one side of a mapped transport.
+ *
+ * transport: the mapped transport.
+ * readRing: the ring this side consumes.
+ * input: set to the stream reading from the peer.
+ * output: set to the stream writing to the peer.
+ *
+ * Returns: void
+ */
+static void open_transport_streams(ShmTransport* transport, int readRing,
+	FILE** input, FILE** output) {
+    transport->openEnds = 2;
+    *input = open_ring_stream(transport, readRing, false);
+    *output = open_ring_stream(transport, NUM_OF_RINGS - 1 - readRing, true);
+}
+
+/* close_fds()
+ * -----------
+ * Closes the descriptors of a transport which could not be set up,
+ * 	skipping any which were never opened.
+ *
+ * fds: the descriptors, -1 for those not opened.
+ * count: the number of descriptors.
+ *
+ * Returns: void
+ */
+static void close_fds(const int* fds, int count) {
+    for (int i = 0; i < count; i++) {
+	if (fds[i] >= 0) {
+	    close(fds[i]);
+	}
+    }
+}
+
+/* shm_ring_offer()
+ * ----------------
+ * Server side of the shared-memory transport. Creates the shared rings and
+ * 	their eventfds, and passes them to the client over the unix socket
+ * 	with the :shm reply.
+ *
+ * sockFd: the unix socket connected to the client.
+ * input: set to the stream reading the client's commands.
+ * output: set to the stream writing replies to the client.
+ *
+ * Returns: true if the transport was set up, in which case the streams own
+ * 	sockFd, or false if it was not, in which case the socket is untouched.
+ */
+bool shm_ring_offer(int sockFd, FILE** input, FILE** output) {
+    int fds[NUM_OF_SHM_FDS];
+    fds[0] = memfd_create("auction-ring", MFD_CLOEXEC);
+    bool created = fds[0] >= 0 && ftruncate(fds[0], sizeof(ShmRegion)) == 0;
+    for (int i = 1; i < NUM_OF_SHM_FDS; i++) {
+	fds[i] = created ? eventfd(0, EFD_CLOEXEC) : -1;
+	created = created && fds[i] >= 0;
+    }
+    if (!created) {
+	close_fds(fds, NUM_OF_SHM_FDS);
+	return false;
+    }
+    ShmTransport* transport = malloc(sizeof(ShmTransport));
+    transport->sockFd = sockFd;
+    transport->region = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fds[0], 0);
+    if (transport->region == MAP_FAILED) {
+	close_fds(fds, NUM_OF_SHM_FDS);
+	free(transport);
+	return false;
+    }
+    for (int i = 0; i < NUM_OF_RINGS; i++) {
+	transport->dataFds[i] = fds[1 + 2 * i];
+	transport->spaceFds[i] = fds[2 + 2 * i];
+    }
+
+    // Send the reply line with every descriptor attached.
+    char reply[] = SHM_REPLY "\n";
+    struct iovec iov = {.iov_base = reply, .iov_len = strlen(reply)};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    bool sent = sendmsg(sockFd, &message, MSG_NOSIGNAL) == iov.iov_len;
+    close(fds[0]);
+    if (!sent) {
+	munmap(transport->region, sizeof(ShmRegion));
+	close_fds(fds + 1, NUM_OF_SHM_FDS - 1);
+	free(transport);
+	return false;
+    }
+
+    open_transport_streams(transport, CLIENT_RING, input, output);
+    return true;
+}
+
+/* shm_ring_accept()
+ * -----------------
+ * Client side of the shared-memory transport. Asks the auctioneer for the
+ * 	rings over the unix socket and maps the descriptors it sends back.
+ *
+ * sockFd: the unix socket connected to the auctioneer.
+ * input: set to the stream reading the auctioneer's replies.
+ * output: set to the stream writing commands to the auctioneer.
+ *
+ * Returns: true if the transport was set up, in which case the streams own
+ * 	sockFd, or false otherwise.
+ */
+bool shm_ring_accept(int sockFd, FILE** input, FILE** output) {
+    const char* request = SHM_REQUEST "\n";
+    if (write(sockFd, request, strlen(request)) != strlen(request)) {
+	return false;
+    }
+
+    // Receive the reply and its descriptors.
+    char reply[] = SHM_REPLY "\n";
+    char received[sizeof(reply)];
+    memset(received, 0, sizeof(received));
+    struct iovec iov = {.iov_base = received, .iov_len = strlen(reply)};
+    int fds[NUM_OF_SHM_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t length = recvmsg(sockFd, &message, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (length <= 0 || header == NULL || header->cmsg_level != SOL_SOCKET
+	    || header->cmsg_type != SCM_RIGHTS) {
+	return false;
+    }
+    // Whatever descriptors did arrive are closed if they are not the ones
+    // expected.
+    int numOfFds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (numOfFds != NUM_OF_SHM_FDS) {
+	for (int i = 0; i < numOfFds; i++) {
+	    int fd;
+	    memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+	    close(fd);
+	}
+	return false;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    while (length < strlen(reply)) {
+	ssize_t more = read(sockFd, received + length,
+		strlen(reply) - length);
+	if (more <= 0) {
+	    break;
+	}
+	length += more;
+    }
+
+    ShmTransport* transport = malloc(sizeof(ShmTransport));
+    transport->sockFd = sockFd;
+    transport->region = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    for (int i = 0; i < NUM_OF_RINGS; i++) {
+	transport->dataFds[i] = fds[1 + 2 * i];
+	transport->spaceFds[i] = fds[2 + 2 * i];
+    }
+    if (strcmp(received, reply) != 0 || transport->region == MAP_FAILED) {
+	if (transport->region != MAP_FAILED) {
+	    munmap(transport->region, sizeof(ShmRegion));
+	}
+	close_fds(fds + 1, NUM_OF_SHM_FDS - 1);
+	free(transport);
+	return false;
+    }
+
+    open_transport_streams(transport, SERVER_RING, input, output);
+    return true;
+}
+
+/* send_descriptors()
+ * ------------------
+ * Passes file descriptors to the peer of a unix socket, as many messages of
+ * 	one byte each carrying up to MAX_FDS_PER_MESSAGE of them.
+ *
+ * sockFd: the unix socket.
+ * fds: the descriptors to pass, which stay open here as well.
+ * count: the number of descriptors.
+ *
+ * Returns: true if every descriptor was sent, false otherwise.
+ */
+bool send_descriptors(int sockFd, const int* fds, int count) {
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+    for (int sent = 0; sent < count; sent += MAX_FDS_PER_MESSAGE) {
+	int batch = count - sent < MAX_FDS_PER_MESSAGE ? count - sent
+		: MAX_FDS_PER_MESSAGE;
+	char byte = 'F';
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	memset(control, 0, sizeof(control));
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+	memcpy(CMSG_DATA(header), fds + sent, sizeof(int) * batch);
+	ssize_t length;
+	while ((length = sendmsg(sockFd, &message, MSG_NOSIGNAL)) < 0
+		&& errno == EINTR) {
+	}
+	if (length != 1) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+/* receive_descriptors()
+ * ---------------------
+ * Receives file descriptors passed with send_descriptors().
+ *
+ * sockFd: the unix socket.
+ * fds: filled in with the descriptors received.
+ * count: the number of descriptors the peer sends.
+ *
+ * Returns: true if every descriptor arrived, false otherwise.
+ */
+bool receive_descriptors(int sockFd, int* fds, int count) {
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+    int received = 0;
+    while (received < count) {
+	char byte;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	ssize_t length;
+	while ((length = recvmsg(sockFd, &message, MSG_CMSG_CLOEXEC)) < 0
+		&& errno == EINTR) {
+	}
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (length != 1 || header == NULL || header->cmsg_type != SCM_RIGHTS
+		|| (message.msg_flags & MSG_CTRUNC)) {
+	    return false;
+	}
+	int batch = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (received + batch > count) {
+	    return false;
+	}
+	memcpy(fds + received, CMSG_DATA(header), sizeof(int) * batch);
+	received += batch;
+    }
+    return true;
+}
+
+// Buffered output of one session on a multiplexed connection.
+typedef struct {
+    FILE* connection;
+    int session;
+    char* pending;
+    size_t length;
+    size_t capacity;
+} SessionStream;
+
+/* parse_session_frame()
+ * ---------------------
+ * Splits a line from a multiplexed connection into its session and line.
+ *
+ * line: the framed line, e.g. "@12 bid item 5".
+ * session: set to the session ID.
+ *
+ * Returns: the unframed line within the framed one, or NULL if the frame is
+ * 	malformed or the session ID is out of range.
+ */
+char* parse_session_frame(char* line, int* session) {
+    if (line[0] != SESSION_PREFIX) {
+	return NULL;
+    }
+    char* remainderText;
+    long id = strtol(line + 1, &remainderText, 10);
+    if (remainderText == line + 1 || *remainderText != ' ' || id < 0
+	    || id >= MAX_SESSIONS) {
+	return NULL;
+    }
+    *session = id;
+    return remainderText + 1;
+}
+
+/* session_write()
+ * ---------------
+ * fopencookie write function for a session. Output is held until whole lines
+ * 	are complete, then each is framed with the session ID and written to
+ * 	the connection in one piece, so that sessions sharing a connection
+ * 	never split each other's lines.
+ *
+ * cookie: the SessionStream being written.
+ * buf: the bytes to write.
+ * size: the number of bytes in buf.
+ *
+ * Returns: the number of bytes written, or -1 if the connection has failed.
+ */
+static ssize_t session_write(void* cookie, const char* buf, size_t size) {
+    SessionStream* stream = (SessionStream*) cookie;
+    if (stream->length + size > stream->capacity) {
+	while (stream->length + size > stream->capacity) {
+	    stream->capacity = stream->capacity ? stream->capacity * 2 : 256;
+	}
+	stream->pending = realloc(stream->pending, stream->capacity);
+    }
+    memcpy(stream->pending + stream->length, buf, size);
+    stream->length += size;
+
+    // Complete lines are always written out, so any newline is among the
+    // bytes just added.
+    char* end = memrchr(stream->pending + stream->length - size, '\n', size);
+    if (end == NULL) {
+	return size;
+    }
+    bool failed = false;
+    flockfile(stream->connection);
+    for (char* line = stream->pending; line <= end; ) {
+	char* newline = memchr(line, '\n', end + 1 - line);
+	fprintf(stream->connection, "%c%d ", SESSION_PREFIX, stream->session);
+	fwrite(line, 1, newline + 1 - line, stream->connection);
+	line = newline + 1;
+    }
+    failed = fflush(stream->connection) == EOF;
+    funlockfile(stream->connection);
+
+    stream->length -= end + 1 - stream->pending;
+    memmove(stream->pending, end + 1, stream->length);
+    if (failed) {
+	errno = EPIPE;
+	return -1;
+    }
+    return size;
+}
+
+/* session_close()
+ * ---------------
+ * fopencookie close function for a session, which leaves the connection
+ * 	open for the other sessions.
+ */
+static int session_close(void* cookie) {
+    SessionStream* stream = (SessionStream*) cookie;
+    free(stream->pending);
+    free(stream);
+    return 0;
+}
+
+/* open_session_stream()
+ * ---------------------
+ * Opens a stream for one session of a multiplexed connection. Every line
+ * 	written to it reaches the connection as "@session line". The stream is
+ * 	unbuffered, as whole lines are gathered by the stream itself.
+ *
+ * connection: the connection's output stream.
+ * session: the session ID.
+ *
+ * Returns: the stream, or NULL on failure.
+ */
+FILE* open_session_stream(FILE* connection, int session) {
+    SessionStream* stream = malloc(sizeof(SessionStream));
+    stream->connection = connection;
+    stream->session = session;
+    stream->pending = NULL;
+    stream->length = 0;
+    stream->capacity = 0;
+
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.write = session_write;
+    functions.close = session_close;
+    FILE* file = fopencookie(stream, "w", functions);
+    if (file == NULL) {
+	free(stream);
+	return NULL;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+    return file;
+}
+
+static const char base64Digits[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* pack_text()
+ * -----------
+ * Compresses text with zlib and encodes the result in base64, so that it
+ * 	can be sent as one word of a line.
+ *
+ * text: the text to pack.
+ * length: the length of the text.
+ *
+ * Returns: the packed text, which the caller must free, or NULL if it cannot
+ * 	be compressed.
+ */
+char* pack_text(const char* text, size_t length) {
+    uLongf packedLength = compressBound(length);
+    unsigned char* packed = malloc(packedLength);
+    if (compress2(packed, &packedLength, (const Bytef*) text, length,
+	    Z_BEST_SPEED) != Z_OK) {
+	free(packed);
+	return NULL;
+    }
+
+    // Every three bytes become four digits, the last group padded with '='.
+    char* encoded = malloc((packedLength + 2) / 3 * 4 + 1);
+    char* digit = encoded;
+    for (size_t i = 0; i < packedLength; i += 3) {
+	unsigned long group = (unsigned long) packed[i] << 16;
+	if (i + 1 < packedLength) {
+	    group |= packed[i + 1] << 8;
+	}
+	if (i + 2 < packedLength) {
+	    group |= packed[i + 2];
+	}
+	*digit++ = base64Digits[group >> 18];
+	*digit++ = base64Digits[(group >> 12) & 63];
+	*digit++ = i + 1 < packedLength
+		? base64Digits[(group >> 6) & 63] : '=';
+	*digit++ = i + 2 < packedLength ? base64Digits[group & 63] : '=';
+    }
+    *digit = '\0';
+    free(packed);
+    return encoded;
+}
+
+/* unpack_text()
+ * -------------
+ * Recovers text packed by pack_text().
+ *
+ * packed: the packed text.
+ * length: the length of the text before it was packed.
+ *
+ * Returns: the text, terminated, which the caller must free, or NULL if it
+ * 	is not validly packed or not of that length, if the length is more
+ * 	than the packed bytes could hold, or if there is no memory for it.
+ */
+char* unpack_text(const char* packed, size_t length) {
+    size_t numOfDigits = strlen(packed);
+    if (numOfDigits % 4 != 0) {
+	return NULL;
+    }
+    unsigned char* bytes = malloc(numOfDigits / 4 * 3 + 1);
+    if (bytes == NULL) {
+	return NULL;
+    }
+    size_t numOfBytes = 0;
+    for (size_t i = 0; i < numOfDigits; i += 4) {
+	unsigned long group = 0;
+	int numOfPadding = 0;
+	for (int j = 0; j < 4; j++) {
+	    const char* value = strchr(base64Digits, packed[i + j]);
+	    if (packed[i + j] == '=' && i + 4 == numOfDigits && j >= 2) {
+		numOfPadding++;
+		value = base64Digits;
+	    } else if (value == NULL || packed[i + j] == '\0'
+		    || numOfPadding) {
+		free(bytes);
+		return NULL;
+	    }
+	    group = group << 6 | (value - base64Digits);
+	}
+	bytes[numOfBytes++] = group >> 16;
+	bytes[numOfBytes++] = group >> 8;
+	bytes[numOfBytes++] = group;
+	numOfBytes -= numOfPadding;
+    }
+
+    char* text = length <= numOfBytes * MAX_PACK_RATIO
+	    ? malloc(length + 1) : NULL;
+    if (text == NULL) {
+	free(bytes);
+	return NULL;
+    }
+    uLongf textLength = length;
+    if (uncompress((Bytef*) text, &textLength, bytes, numOfBytes) != Z_OK
+	    || textLength != length) {
+	free(bytes);
+	free(text);
+	return NULL;
+    }
+    free(bytes);
+    text[length] = '\0';
+    return text;
+}
@@ -0,0 +1,57 @@
+/*
+ * transport
+ * Endpoint parsing and local transports shared by auctioneer and
+ * 	auctionclient.
+ * Author: Hamza
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Prefix of an endpoint naming a unix domain socket, e.g. unix:/tmp/auction
+#define UNIX_PREFIX "unix:"
+
+// Line a client sends to ask for the shared-memory ring transport, and the
+// reply which carries the ring file descriptors.
+#define SHM_REQUEST "shm"
+#define SHM_REPLY ":shm"
+
+// Size in bytes of each direction of the shared-memory ring (power of two).
+#define SHM_RING_SIZE (1 << 16)
+
+// Line a client sends to multiplex sessions over its connection, and the
+// reply. Every later line either way is framed as "@session line".
+#define MUX_REQUEST "mux"
+#define MUX_REPLY ":mux"
+#define SESSION_PREFIX '@'
+
+// Session IDs on a multiplexed connection run from 0 below this.
+#define MAX_SESSIONS 65536
+
+// Line a client sends for the items changed since a version, and the
+// replies, plain or compressed. See list_delta() in auction.c.
+#define DELTA_REQUEST "delta"
+#define DELTA_REPLY ":delta"
+#define PACKED_DELTA_REPLY ":zdelta"
+
+// Most descriptors passed in one message (the kernel allows 253).
+#define MAX_FDS_PER_MESSAGE 250
+
+bool is_unix_endpoint(const char* endpoint);
+const char* unix_endpoint_path(const char* endpoint);
+int create_unix_listener(const char* path);
+int connect_unix(const char* path);
+int connect_endpoint(const char* endpoint);
+bool shm_ring_offer(int sockFd, FILE** input, FILE** output);
+bool shm_ring_accept(int sockFd, FILE** input, FILE** output);
+bool send_descriptors(int sockFd, const int* fds, int count);
+bool receive_descriptors(int sockFd, int* fds, int count);
+char* parse_session_frame(char* line, int* session);
+FILE* open_session_stream(FILE* connection, int session);
+char* pack_text(const char* text, size_t length);
+char* unpack_text(const char* packed, size_t length);
+
+#endif